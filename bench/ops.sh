@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+#  ScummC interpreter benchmark
+#  Copyright (C) 2008  Alban Bedel
+#
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License
+#  as published by the Free Software Foundation; either version 2
+#  of the License, or (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+
+# Run a script heavy game with the tracing interpreter (scvm -trace,
+# the log is thrown away) and with the fast one, and print the ops
+# executed per second.
+#
+# Usage: ops.sh BIN_DIR [LOOPS]
+
+BIN_DIR=${1:?usage: $0 BIN_DIR [LOOPS]}
+LOOPS=${2:-20000}
+
+# the loop count is pushed as a 16 bit value
+[ "$LOOPS" -gt 0 ] && [ "$LOOPS" -le 32767 ] ||
+    { echo "LOOPS must be between 1 and 32767" ; exit 1 ; }
+
+WORK_DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+cat > "$WORK_DIR/bench.scc" <<EOS
+int res;
+
+room Bench {
+    script main(int bootParam) {
+        int i, j, a, b;
+        for(i = 0 ; i < $LOOPS ; i++) {
+            a = i;
+            b = 0;
+            for(j = 0 ; j < 16 ; j++) {
+                if(a & 1)
+                    b += a;
+                else
+                    b -= j;
+                a = a/2 + j*3;
+            }
+            res = b;
+        }
+        shutdown();
+    }
+}
+EOS
+
+"$BIN_DIR/scc" -V 6 -o "$WORK_DIR/bench.roobj" "$WORK_DIR/bench.scc" \
+    > /dev/null 2>&1 &&
+"$BIN_DIR/sld" -o "$WORK_DIR/bench" "$WORK_DIR/bench.roobj" \
+    > /dev/null 2>&1 || { echo "Failed to build the benchmark" ; exit 1 ; }
+
+# run_vm FLAGS: print the number of ops and the time in ms
+run_vm() {
+    start=$(date +%s%N)
+    ops=$(cd "$WORK_DIR" && "$BIN_DIR/scvm" -v $1 bench 2>&1 | \
+        sed -n 's/^VM stopped after .* and \([0-9]*\) ops\.$/\1/p')
+    end=$(date +%s%N)
+    echo $ops $(( (end-start)/1000000 ))
+}
+
+printf "%-8s %12s %8s %14s\n" mode ops ms ops/s
+for mode in trace fast ; do
+    if [ $mode = trace ] ; then
+        res=$(run_vm -trace)
+    else
+        res=$(run_vm)
+    fi
+    echo $mode $res | awk '{ if($2 == "" || $3 == "") exit 1;
+        printf "%-8s %12d %8d %14.0f\n", $1, $2, $3, $2*1000/($3 > 0 ? $3 : 1) }' ||
+        { echo "Benchmark failed" ; exit 1 ; }
+done
@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+#  ScummC switch benchmark
+#  Copyright (C) 2008  Alban Bedel
+#
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License
+#  as published by the Free Software Foundation; either version 2
+#  of the License, or (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+
+# Count the ops executed by the VM for a switch with N cases, with
+# the linear tests and with the comparison tree (scc -O). All the
+# cases are taken in turn, so the number given is the average cost
+# of one iteration.
+#
+# Usage: switch.sh BIN_DIR [N ...]
+
+BIN_DIR=${1:?usage: $0 BIN_DIR [N ...]}
+shift
+[ $# -gt 0 ] || set -- 2 4 8 16 32 64 128
+
+LOOPS=1024
+WORK_DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+gen_scc() {
+    echo "room Bench {"
+    echo "    script main(int bootParam) {"
+    echo "        int i, v, r;"
+    echo "        v = 0;"
+    echo "        for(i = 0 ; i < $LOOPS ; i++) {"
+    echo "            switch(v) {"
+    c=0
+    while [ $c -lt $1 ] ; do
+        echo "            case $((c*3)): r = $c; break;"
+        c=$((c+1))
+    done
+    echo "            }"
+    echo "            v += 3;"
+    echo "            if(v >= $(($1*3))) v = 0;"
+    echo "        }"
+    echo "        shutdown();"
+    echo "    }"
+    echo "}"
+}
+
+# run_vm FLAGS: print the number of ops executed
+run_vm() {
+    "$BIN_DIR/scc" -V 6 $1 -o "$WORK_DIR/bench.roobj" "$WORK_DIR/bench.scc" \
+        > /dev/null 2>&1 || return 1
+    "$BIN_DIR/sld" -o "$WORK_DIR/bench" "$WORK_DIR/bench.roobj" \
+        > /dev/null 2>&1 || return 1
+    (cd "$WORK_DIR" && "$BIN_DIR/scvm" -v bench 2>&1) | \
+        sed -n 's/^VM stopped after .* and \([0-9]*\) ops\.$/\1/p'
+}
+
+printf "%6s %12s %12s\n" cases linear tree
+for n in "$@" ; do
+    gen_scc $n > "$WORK_DIR/bench.scc"
+    lin=$(run_vm "")
+    tree=$(run_vm "-O")
+    [ -n "$lin" ] && [ -n "$tree" ] || { echo "Benchmark failed for $n cases" ; exit 1 ; }
+    echo $n $lin $tree | \
+        awk "{ printf \"%6d %12.1f %12.1f\\n\", \$1, \$2/$LOOPS, \$3/$LOOPS }"
+done
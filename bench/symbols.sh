@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+#  ScummC compiler and linker benchmark
+#  Copyright (C) 2008  Alban Bedel
+#
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License
+#  as published by the Free Software Foundation; either version 2
+#  of the License, or (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+
+# Compile and link a program with a lot of symbols and print the user
+# and system time used by scc and sld. The program has 4000 global
+# variables, 1000 bits and ROOMS rooms, each with 250 variables and 8
+# scripts of 40 assignments using random variables. With the default 20
+# rooms that is about 10k symbols.
+#
+# Usage: symbols.sh BIN_DIR [ROOMS]
+
+BIN_DIR=${1:?usage: $0 BIN_DIR [ROOMS]}
+ROOMS=${2:-20}
+
+# the room addresses are limited to 1-99
+[ "$ROOMS" -gt 0 ] && [ "$ROOMS" -le 99 ] ||
+    { echo "ROOMS must be between 1 and 99" ; exit 1 ; }
+
+WORK_DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# always generate the same program
+awk -v rooms=$ROOMS 'BEGIN {
+    srand(1);
+    for(i = 0 ; i < 4000 ; i++) printf "int g%d;\n", i;
+    for(i = 0 ; i < 1000 ; i++) printf "bit b%d;\n", i;
+    for(r = 0 ; r < rooms ; r++) {
+        printf "room R%d {\n", r;
+        if(r == 0) printf "  script main(int bootParam) { g0 = 1; }\n";
+        for(i = 0 ; i < 250 ; i++) printf "  int r%d_v%d;\n", r, i;
+        for(s = 0 ; s < 8 ; s++) {
+            printf "  script r%d_s%d() {\n", r, s;
+            printf "    int a, b;\n";
+            for(i = 0 ; i < 40 ; i++)
+                printf "    g%d = g%d + r%d_v%d + b%d;\n", int(rand()*4000),
+                    int(rand()*4000), r, int(rand()*250), int(rand()*1000);
+            printf "  }\n";
+        }
+        printf "}\n";
+    }
+}' > "$WORK_DIR/bench.scc"
+
+# run TOOL ARGS...: print the user and system time used in ms
+run() {
+    ( "$@" > /dev/null 2>&1 || exit 1 ; times ) | awk 'NR == 2 {
+        split($1,u,/[ms]/) ; split($2,s,/[ms]/) ;
+        print (u[1]*60 + u[2])*1000, (s[1]*60 + s[2])*1000 }'
+}
+
+scc_ms=$(run "$BIN_DIR/scc" -V 6 -o "$WORK_DIR/bench.roobj" \
+    "$WORK_DIR/bench.scc")
+[ -n "$scc_ms" ] || { echo "Failed to compile the benchmark" ; exit 1 ; }
+sld_ms=$(run "$BIN_DIR/sld" -o "$WORK_DIR/bench" "$WORK_DIR/bench.roobj")
+[ -n "$sld_ms" ] || { echo "Failed to link the benchmark" ; exit 1 ; }
+
+printf "%-6s %10s %10s\n" tool "user ms" "sys ms"
+printf "%-6s %10.0f %10.0f\n" scc $scc_ms sld $sld_ms
@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+#  ScummC rendering benchmark
+#  Copyright (C) 2008  Alban Bedel
+#
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License
+#  as published by the Free Software Foundation; either version 2
+#  of the License, or (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+
+# Run a game with the headless backend, rendering the view, for a
+# fixed number of cycles. It is done once redrawing the whole screen
+# on every frame (scvm -redraw) and once with the damage tracking, and
+# the time used per cycle is printed. The default game is openquest,
+# as built in the build directory. Without an input log it stays on
+# its static title screen, a log recorded with scvm -record can be
+# given to replay a real session.
+#
+# Usage: view.sh BIN_DIR [GAME_DIR] [BASENAME] [CYCLES] [INPUT_LOG]
+
+BIN_DIR=${1:?usage: $0 BIN_DIR [GAME_DIR] [BASENAME] [CYCLES] [INPUT_LOG]}
+GAME_DIR=${2:-$BIN_DIR}
+BASENAME=${3:-scummc6}
+CYCLES=${4:-1000}
+INPUT_LOG=$5
+
+[ -f "$GAME_DIR/$BASENAME.000" ] ||
+    { echo "Game $GAME_DIR/$BASENAME not found" ; exit 1 ; }
+[ -z "$INPUT_LOG" ] || [ -f "$INPUT_LOG" ] ||
+    { echo "Input log $INPUT_LOG not found" ; exit 1 ; }
+
+# run_vm FLAGS: print the time in s and the number of frames drawn
+run_vm() {
+    "$BIN_DIR/scvm" -headless -render -cycles $CYCLES \
+        ${INPUT_LOG:+-replay "$INPUT_LOG"} $1 -dir "$GAME_DIR" $BASENAME \
+        2>&1 | sed -n 's/^\([0-9.]*\) s: .* \([0-9.]*\) frames\/s$/\1 \2/p'
+}
+
+printf "%-8s %8s %8s %10s\n" mode frames ms ms/cycle
+for mode in redraw damage ; do
+    if [ $mode = redraw ] ; then
+        res=$(run_vm -redraw)
+    else
+        res=$(run_vm)
+    fi
+    echo $mode $res | awk -v cycles=$CYCLES '{
+        if($2 == "" || $3 == "") exit 1;
+        printf "%-8s %8.0f %8.1f %10.3f\n", $1, $2*$3, $2*1000,
+            $2*1000/cycles }' ||
+        { echo "Benchmark failed" ; exit 1 ; }
+done
@@ -608,7 +608,7 @@ static void expose_img_cb(GtkWidget *img,GdkEvent* ev,scc_cost_view_t* cv) {
 
   memset(cv->buf,0,cv->buf_h*cv->buf_w);
   scc_cost_dec_frame(&cv->dec,cv->buf,cv->buf_w/2,cv->buf_h/2,
-		     cv->buf_w,cv->buf_h,cv->buf_w,NULL,0,255,255);
+		     cv->buf_w,cv->buf_h,cv->buf_w,NULL,0,255,255,NULL);
 
   //printf("Draw Image !!!\n");
 
@@ -91,6 +91,7 @@ int main(int argc,char** argv) {
     scc_fd_close(fd2);
   fd2 = new_scc_fd("copy.001",O_WRONLY|O_CREAT,0x69);
   scc_write_lecf(fd2,res);
+  scc_fd_close(fd2);
 
   return 0;
 
@@ -167,6 +168,7 @@ int main(int argc,char** argv) {
       }
       c += w;
     }
+    scc_fd_close(fd2);
 
     for(ob = r->obim ; ob ; ob = ob->next) {
  
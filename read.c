@@ -222,7 +222,7 @@ scc_res_idx_t* scc_read_res_idx(scc_fd_t* fd) {
     case MKID('D','I','R','N'):
 
       printf("Such id should be handled\n");
-      if(lseek(fd->fd,itemsize,SEEK_CUR) != pos + itemsize) return NULL;
+      if(scc_fd_seek(fd,itemsize,SEEK_CUR) != pos + itemsize) return NULL;
       pos += itemsize;
       break;
     default:
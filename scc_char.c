@@ -233,6 +233,14 @@ static int decode_nut21(scc_fd_t* fd, unsigned size,
 
 }
 
+void scc_charmap_free(scc_charmap_t* chmap) {
+  int i;
+  for(i = 0 ; i < SCC_MAX_CHAR ; i++)
+    free(chmap->chars[i].data);
+  free(chmap->rgb_pal);
+  free(chmap);
+}
+
 scc_charmap_t* scc_parse_nutmap(scc_fd_t* fd, unsigned block_size) {
   uint32_t block, size;
   uint8_t pal[3*256];
@@ -46,3 +46,5 @@ typedef struct scc_charmap_st {
 scc_charmap_t* scc_parse_charmap(scc_fd_t* fd, unsigned size);
 
 scc_charmap_t* scc_parse_nutmap(scc_fd_t* fd, unsigned block_size);
+
+void scc_charmap_free(scc_charmap_t* chmap);
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "scc_parse.h"
 #include "scc_ns.h"
@@ -67,6 +68,8 @@ struct scc_loop_st {
 
 static scc_loop_t *loop_stack = NULL;
 
+int scc_code_opt_level = 0;
+
 scc_loop_t* scc_loop_get(int type,char* sym) {
   scc_loop_t* l;
 
@@ -124,30 +127,6 @@ scc_loop_t* scc_loop_pop(void) {
   return l;
 }
 
-static void scc_loop_fix_code(scc_code_t* c,int br, int cont) {
-  scc_loop_t* l = scc_loop_pop();
-  int pos = 0;
-
-  for( ; c ; c = c->next) {
-    pos += c->len;
-    if(c->fix != SCC_FIX_BRANCH) continue;
-    if(c->data[1] != l->id) continue;
-    
-    if(c->data[2] == SCC_BRANCH_BREAK) {
-      SCC_SET_S16LE(c->data,1,br - pos);
-    } else if(cont >= 0 && c->data[2] == SCC_BRANCH_CONTINUE) {
-      SCC_SET_S16LE(c->data,1,cont - pos);
-    } else {
-      SCC_SET_S16LE(c->data,1,pos);
-    }
-    c->fix = SCC_FIX_NONE;
-
-    scc_log(LOG_DBG,"Branch fixed to 0x%hx\n",SCC_GET_16LE(c->data,1));
-  }
-
-  free(l);
-}
-
 static scc_operator_t* scc_get_bin_op(int op) {
   int i;
 
@@ -170,266 +149,313 @@ static scc_operator_t* scc_get_assign_op(int op) {
   return NULL;
 }
 
-static scc_code_t* scc_statement_gen_code(scc_statement_t* st, int ret_val);
-
-scc_code_t* scc_code_new(int len) {
-  scc_code_t* c = calloc(1,sizeof(scc_code_t));
+static void scc_statement_gen_code(scc_code_t* code, scc_statement_t* st,
+                                   int ret_val);
 
-  if(len > 0) {
-    c->data = malloc(len);
-    c->len = len;
-  }
-  return c;
+scc_code_t* scc_code_new(void) {
+  return calloc(1,sizeof(scc_code_t));
 }
 
 void scc_code_free(scc_code_t* c) {
   if(!c) return;
   if(c->data) free(c->data);
+  if(c->fix) free(c->fix);
+  if(c->insn) free(c->insn);
   free(c);
 }
 
-void scc_code_free_all(scc_code_t* c) {
+// Record the start of an instruction
+static void scc_code_start_insn(scc_code_t* c) {
+
+  if(c->num_insn >= c->insn_size) {
+    c->insn_size = c->insn_size ? c->insn_size*2 : 64;
+    c->insn = realloc(c->insn,c->insn_size*sizeof(int));
+  }
+  c->insn[c->num_insn] = c->len;
+  c->num_insn++;
+}
 
-  while(c) {
-    scc_code_t* n = c->next;
-    scc_code_free(c);
-    c = n;
-  }    
+// Append some zeroed space at the end of the code,
+// the returned pointer is only valid until the next append.
+static uint8_t* scc_code_put(scc_code_t* c, int len) {
+  uint8_t* ptr;
 
+  if(c->len + len > c->size) {
+    if(!c->size) c->size = 256;
+    while(c->len + len > c->size) c->size *= 2;
+    c->data = realloc(c->data,c->size);
+  }
+  ptr = c->data + c->len;
+  memset(ptr,0,len);
+  c->len += len;
+  return ptr;
 }
 
-static scc_code_t* scc_code_push_val(uint8_t op,uint16_t v) {
-  scc_code_t* code;
+static void scc_code_put_data(scc_code_t* c, void* data, int len) {
+  if(len > 0) memcpy(scc_code_put(c,len),data,len);
+}
 
-  if(v <= 0xFF) {
-    code = scc_code_new(2);
-    code->data[0] = op-1;
-    code->data[1] = v;
-  } else {
-    code = scc_code_new(3);
-    code->data[0] = op;
-    SCC_SET_16LE(code->data,1,v);
+static void scc_code_put_op(scc_code_t* c, int op) {
+  uint8_t* ptr;
+
+  scc_code_start_insn(c);
+  if(op > 0xFF) {
+    ptr = scc_code_put(c,2);
+    ptr[0] = op >> 8;
+    ptr[1] = op & 0xFF;
+  } else
+    scc_code_put(c,1)[0] = op;
+}
+
+static void scc_code_add_fix(scc_code_t* c, int off, int type) {
+
+  if(c->num_fix >= c->fix_size) {
+    c->fix_size = c->fix_size ? c->fix_size*2 : 32;
+    c->fix = realloc(c->fix,c->fix_size*sizeof(scc_code_fix_t));
   }
+  c->fix[c->num_fix].off = off;
+  c->fix[c->num_fix].type = type;
+  c->num_fix++;
+}
 
-  return code;
+// Drop everything from pos to the end of the code
+static void scc_code_truncate(scc_code_t* c, int pos) {
+  c->len = pos;
+  while(c->num_fix > 0 && c->fix[c->num_fix-1].off >= pos)
+    c->num_fix--;
+  while(c->num_insn > 0 && c->insn[c->num_insn-1] >= pos)
+    c->num_insn--;
 }
 
-static scc_code_t* scc_code_push_res(uint8_t op,scc_symbol_t* res) {
-  scc_code_t* c,*d;
+// Put a jump instruction and return its position,
+// the destination is set later with scc_code_set_jump().
+static int scc_code_put_jump(scc_code_t* c, uint8_t op) {
+  int pos = c->len;
+  scc_code_start_insn(c);
+  scc_code_put(c,3)[0] = op;
+  scc_code_add_fix(c,pos+1,SCC_FIX_JUMP);
+  return pos;
+}
 
-  // Address is alredy assigned
-  if(res->addr >= 0) return scc_code_push_val(op,res->addr);
+static void scc_code_set_jump(scc_code_t* c, int jmp, int dst) {
+  SCC_SET_S16LE(c->data,jmp+1,dst - jmp - 3);
+}
 
-  if(!res->rid) {
-    scc_log(LOG_ERR,"Resource %s has no assigned rid!!!!\n",res->sym);
-    return NULL;
+// Resolve the branches of the current loop, the loop code start
+// at start, br and cont are the break and continue destinations.
+static void scc_loop_fix_code(scc_code_t* code, int start, int br, int cont) {
+  scc_loop_t* l = scc_loop_pop();
+  scc_code_fix_t* f;
+  int i,pos;
+
+  // the fix table is sorted, so find the first entry in the loop
+  for(i = code->num_fix ; i > 0 && code->fix[i-1].off >= start ; i--);
+
+  for( ; i < code->num_fix ; i++) {
+    f = &code->fix[i];
+    if(f->type != SCC_FIX_BRANCH || code->data[f->off+1] != l->id)
+      continue;
+    pos = f->off + 3;
+    if(code->data[f->off+2] == SCC_BRANCH_BREAK) {
+      SCC_SET_S16LE(code->data,f->off+1,br - pos);
+    } else if(cont >= 0 && code->data[f->off+2] == SCC_BRANCH_CONTINUE) {
+      SCC_SET_S16LE(code->data,f->off+1,cont - pos);
+    } else {
+      SCC_SET_S16LE(code->data,f->off+1,pos - start);
+    }
+
+    scc_log(LOG_DBG,"Branch fixed to 0x%hx\n",SCC_GET_16LE(code->data,f->off+1));
+    // from now on it is a plain jump
+    f->off++;
+    f->type = SCC_FIX_JUMP;
   }
 
-  // no addr, so code the op and addr separatly
-  c = scc_code_new(1);
-  c->data[0] = op;
-  d = scc_code_new(2);
-  SCC_SET_16LE(d->data,0,res->rid);
-  d->fix = SCC_FIX_RES + res->type;
-  c->next = d;
-
-  return c;
+  free(l);
 }
 
-static scc_code_t* scc_code_res_addr(int op, scc_symbol_t* res) {
-  scc_code_t *c,*o;
+static void scc_code_push_val(scc_code_t* code, uint8_t op, uint16_t v) {
+  uint8_t* ptr;
 
-  c = scc_code_new(2);
-  if(res->addr >= 0) {
-    SCC_SET_16LE(c->data,0,res->addr);
+  scc_code_start_insn(code);
+  if(v <= 0xFF) {
+    ptr = scc_code_put(code,2);
+    ptr[0] = op-1;
+    ptr[1] = v;
   } else {
-    SCC_SET_16LE(c->data,0,res->rid);
-    c->fix = SCC_FIX_RES + res->type;
+    ptr = scc_code_put(code,3);
+    ptr[0] = op;
+    SCC_SET_16LE(ptr,1,v);
   }
+}
 
-  if(op < 0) return c;
+// Put the address of a resource, or its rid and a fix
+// if no address is assigned yet.
+static void scc_code_put_res(scc_code_t* code, scc_symbol_t* res) {
+  int pos = code->len;
+  uint8_t* ptr = scc_code_put(code,2);
 
-  if(op > 0xFF) {
-    o = scc_code_new(2);
-    o->data[0] = op >> 8;
-    o->data[1] = op & 0xFF;
+  if(res->addr >= 0) {
+    SCC_SET_16LE(ptr,0,res->addr);
   } else {
-    o = scc_code_new(1);
-    o->data[0] = op;
+    SCC_SET_16LE(ptr,0,res->rid);
+    scc_code_add_fix(code,pos,SCC_FIX_RES + res->type);
   }
-  o->next = c;
-  return o;
 }
 
-int scc_code_size(scc_code_t* c) {
-  int size = 0;
-  while(c) {
-    size += c->len;
-    c = c->next;
+static void scc_code_push_res(scc_code_t* code, uint8_t op,
+                              scc_symbol_t* res) {
+
+  // Address is alredy assigned
+  if(res->addr >= 0) {
+    scc_code_push_val(code,op,res->addr);
+    return;
   }
-  return size;
+
+  if(!res->rid) {
+    scc_log(LOG_ERR,"Resource %s has no assigned rid!!!!\n",res->sym);
+    return;
+  }
+
+  // no addr, so code the op and addr separatly
+  scc_code_put_op(code,op);
+  scc_code_put_res(code,res);
 }
 
-static scc_code_t* scc_str_gen_code(scc_str_t* s) {
-  scc_code_t *code = NULL,*last = NULL,*c;
+static void scc_code_res_addr(scc_code_t* code, int op, scc_symbol_t* res) {
+  if(op >= 0) scc_code_put_op(code,op);
+  scc_code_put_res(code,res);
+}
+
+static void scc_str_gen_code(scc_code_t* code, scc_str_t* s) {
+  uint8_t* ptr;
+  int pos;
 
-  while(s) {
+  for( ; s ; s = s->next) {
     switch(s->type) {
     case SCC_STR_CHAR:
-      c = calloc(1,sizeof(scc_code_t));
-      c->data = (unsigned char *)strdup(s->str);
-      c->len = strlen(s->str);
+      scc_code_put_data(code,s->str,strlen(s->str));
       break;
     case SCC_STR_INT:
     case SCC_STR_VERB:
     case SCC_STR_NAME:
     case SCC_STR_STR:
-      c = scc_code_res_addr(0xFF00 | (s->type & 0xFF),s->sym);
+      ptr = scc_code_put(code,2);
+      ptr[0] = 0xFF;
+      ptr[1] = s->type;
+      scc_code_put_res(code,s->sym);
       break;
     case SCC_STR_COLOR:
-      c = scc_code_new(4);
-      c->data[0] = 0xFF;
-      c->data[1] = SCC_STR_COLOR;
-      c->data[2] = s->str[0];
-      c->data[3] = s->str[1];
+      ptr = scc_code_put(code,4);
+      ptr[0] = 0xFF;
+      ptr[1] = SCC_STR_COLOR;
+      ptr[2] = s->str[0];
+      ptr[3] = s->str[1];
       break;
     case SCC_STR_VOICE:
-      c = scc_code_new(2);
-      c->data[0] = 0xFF;
-      c->data[1] = SCC_STR_VOICE;
-      SCC_LIST_ADD(code,last,c);
-      c = scc_code_new(14);
-      SCC_SET_16LE(c->data,0,s->sym->rid);
-      c->fix |= SCC_FIX_RES + s->sym->type;
+      ptr = scc_code_put(code,2);
+      ptr[0] = 0xFF;
+      ptr[1] = SCC_STR_VOICE;
+      pos = code->len;
+      ptr = scc_code_put(code,14);
+      SCC_SET_16LE(ptr,0,s->sym->rid);
+      scc_code_add_fix(code,pos,SCC_FIX_RES + s->sym->type);
       break;
     default:
       scc_log(LOG_ERR,"Got an unknown string type.\n");
       break;
     }
-    SCC_LIST_ADD(code,last,c);
-    s = s->next;
   }
 
   // Append the terminal 0
-  c = scc_code_new(1);
-  c->data[0] = '\0';
-  SCC_LIST_ADD(code,last,c);
-
-  return code;
+  scc_code_put(code,1);
 }
 
-static scc_code_t* scc_statement_gen_ref_code(scc_statement_t* st) {
-  scc_code_t* code = NULL;
+static void scc_statement_gen_ref_code(scc_code_t* code, scc_statement_t* st) {
+  uint8_t* ptr;
 
   switch(st->type) {
   case SCC_ST_VAR:
-    code = scc_code_res_addr(-1,st->val.v.r);
+    scc_code_res_addr(code,-1,st->val.v.r);
     break;
   case SCC_ST_RES:
-    code = scc_code_res_addr(-1,st->val.r);
+    scc_code_res_addr(code,-1,st->val.r);
     break;
   case SCC_ST_VAL:
-    code = scc_code_new(2);
-    SCC_SET_16LE(code->data,0,(uint16_t)st->val.i);
+    ptr = scc_code_put(code,2);
+    SCC_SET_16LE(ptr,0,(uint16_t)st->val.i);
     break;
   case SCC_ST_STR:
-    code = scc_str_gen_code(st->val.s);
+    scc_str_gen_code(code,st->val.s);
     break;
   }
-  return code;
 }
 
 
-static scc_code_t* scc_call_gen_code(scc_call_t* call, int ret_val) {
-  scc_code_t *code = NULL,*last = NULL,*c;
+static void scc_call_gen_code(scc_code_t* code, scc_call_t* call, int ret_val) {
   scc_statement_t* a = NULL;
-  int n = 0;
-  
+  uint8_t* ptr;
+  int n = 0, start = code->len;
+
   // Check if we need to prepend an op code
   // In that case it mean the function take
   // a list as argument and we must also close it
   // with the number of arguments (including this one)
   if(call->func->hidden_args > 0 &&
-     (call->func->argt[call->func->argc] & 0xFFFF) == SCC_FA_OP) {
-      c = scc_code_push_val(SCC_OP_PUSH,
-                            call->func->argt[call->func->argc]>>16);
-      SCC_LIST_ADD(code,last,c);
-  }
-  
+     (call->func->argt[call->func->argc] & 0xFFFF) == SCC_FA_OP)
+    scc_code_push_val(code,SCC_OP_PUSH,
+                      call->func->argt[call->func->argc]>>16);
+
   // Generate arg code
   for(n = 0, a = call->argv ; a ; n++, a = a->next) {
     if(call->func->argt[n] & SCC_FA_REF) continue;
-    c = scc_statement_gen_code(a,1);
-    SCC_LIST_ADD(code,last,c);
+    scc_statement_gen_code(code,a,1);
   }
 
   // Add the arguments using the default value
   for( ; n < call->func->argc ; n++) {
     if(call->func->argt[n] & SCC_FA_REF) continue;
     if((call->func->argt[n] & 0xFFFF) != SCC_FA_VAL) continue;
-    c = scc_code_push_val(SCC_OP_PUSH,call->func->dfault[n]);
-    SCC_LIST_ADD(code,last,c);
+    scc_code_push_val(code,SCC_OP_PUSH,call->func->dfault[n]);
   }
-  
+
   // If we had an extra op code close the list
   if(call->func->hidden_args > 0 &&
-     (call->func->argt[call->func->argc] & 0xFFFF) == SCC_FA_OP) {
-    c = scc_code_push_val(SCC_OP_PUSH,n+1);
-    SCC_LIST_ADD(code,last,c);
-  }
-  
-  
-  if(call->func->opcode <= 0xFF) {
-    c = scc_code_new(1);
-    c->data[0] = call->func->opcode;
-  } else {
-    c = scc_code_new(2);
-    c->data[0] = (call->func->opcode & 0xFF00)>>8;
-    c->data[1] = call->func->opcode & 0xFF;
-  }
-  SCC_LIST_ADD(code,last,c);
+     (call->func->argt[call->func->argc] & 0xFFFF) == SCC_FA_OP)
+    scc_code_push_val(code,SCC_OP_PUSH,n+1);
+
+  scc_code_put_op(code,call->func->opcode);
 
   // add ref arguments
   for(n = 0, a = call->argv ; a ; n++, a = a->next) {
     if(!(call->func->argt[n] & SCC_FA_REF)) continue;
-    c = scc_statement_gen_ref_code(a);
-    SCC_LIST_ADD(code,last,c);
+    scc_statement_gen_ref_code(code,a);
   }
 
   for( ; n < call->func->argc+ call->func->hidden_args ; n++) {
     // only hidden arg type atm
     if(call->func->argt[n] != SCC_FA_SELF_OFF) continue;
-    c = scc_code_new(2);
-    SCC_SET_S16LE(c->data,0,-scc_code_size(code)-2);
-    SCC_LIST_ADD(code,last,c);
+    scc_code_add_fix(code,code->len,SCC_FIX_JUMP);
+    ptr = scc_code_put(code,2);
+    SCC_SET_S16LE(ptr,0,start - code->len);
   }
 
   if(call->user_script) {
-    if(ret_val) {
-      // Pass VAR_RETURN back
-      c = scc_code_push_val(SCC_OP_VAR_READ,SCC_VAR_RETURN);
-      SCC_LIST_ADD(code,last,c);
-    }
+    // Pass VAR_RETURN back
+    if(ret_val)
+      scc_code_push_val(code,SCC_OP_VAR_READ,SCC_VAR_RETURN);
   } else {
     // kick the return val if it's not needed
-    if(call->func->ret && (!ret_val)) {
-      c = scc_code_new(1);
-      c->data[0] = SCC_OP_POP;
-      SCC_LIST_ADD(code,last,c);
-    }
+    if(call->func->ret && (!ret_val))
+      scc_code_put_op(code,SCC_OP_POP);
     if(!call->func->ret && ret_val) {
       scc_log(LOG_WARN,"Warning: the function %s doesn't return anything.\n",
               call->func->sym);
-      c = scc_code_push_val(SCC_OP_PUSH,0);
-      SCC_LIST_ADD(code,last,c);
+      scc_code_push_val(code,SCC_OP_PUSH,0);
     }
   }
-
-  return code;
 }
 
-static scc_code_t* scc_assign_gen_code(scc_op_t* op, int ret_val) {
-  scc_code_t *code = NULL,*last = NULL,*c;
+static void scc_assign_gen_code(scc_code_t* code, scc_op_t* op, int ret_val) {
   scc_statement_t *a = op->argv, *b = op->argv->next;
   scc_operator_t* oper;
 
@@ -437,62 +463,44 @@ static scc_code_t* scc_assign_gen_code(scc_op_t* op, int ret_val) {
      b->type != SCC_ST_LIST &&
      b->type != SCC_ST_STR) { // simple variable
 
-    if(op->op != '=') {
-      c = scc_statement_gen_code(a,1);
-      SCC_LIST_ADD(code,last,c);
-    }
-     
-    c = scc_statement_gen_code(b,1);
-    SCC_LIST_ADD(code,last,c);
+    if(op->op != '=')
+      scc_statement_gen_code(code,a,1);
+
+    scc_statement_gen_code(code,b,1);
 
     if(op->op != '=') {
       oper = scc_get_assign_op(op->op);
-
-      c = scc_code_new(1);
-      c->data[0] = oper->op;
-      SCC_LIST_ADD(code,last,c);
+      scc_code_put_op(code,oper->op);
     }
 
     // dup the value to use it as return val
-    if(ret_val) {
-      c = scc_code_new(1);
-      c->data[0] = SCC_OP_DUP;
-      SCC_LIST_ADD(code,last,c);
-    }
-
-    c = scc_code_push_res(SCC_OP_VAR_WRITE,a->val.v.r);
-    SCC_LIST_ADD(code,last,c);
+    if(ret_val)
+      scc_code_put_op(code,SCC_OP_DUP);
 
-    return code;
+    scc_code_push_res(code,SCC_OP_VAR_WRITE,a->val.v.r);
+    return;
   }
 
   // assignement to an array
   switch(b->type) {
   case SCC_ST_LIST:
-      
-    if(a->val.v.x) {
-      c = scc_statement_gen_code(a->val.v.x,1);
-      SCC_LIST_ADD(code,last,c);
-    }
 
-    c = scc_statement_gen_code(b,1);
-    SCC_LIST_ADD(code,last,c);
+    if(a->val.v.x)
+      scc_statement_gen_code(code,a->val.v.x,1);
+
+    scc_statement_gen_code(code,b,1);
 
     if(a->val.v.y)
-        c = scc_statement_gen_code(a->val.v.y,1);
+        scc_statement_gen_code(code,a->val.v.y,1);
     else
-        c = scc_code_push_val(SCC_OP_PUSH,0);
-    SCC_LIST_ADD(code,last,c);
-      
-    c = scc_code_res_addr(a->val.v.x ? SCC_OP_ARRAY2_WRITE_LIST : SCC_OP_ARRAY_WRITE_LIST,
-                          a->val.v.r);
-    SCC_LIST_ADD(code,last,c);
+        scc_code_push_val(code,SCC_OP_PUSH,0);
+
+    scc_code_res_addr(code,a->val.v.x ? SCC_OP_ARRAY2_WRITE_LIST :
+                      SCC_OP_ARRAY_WRITE_LIST,a->val.v.r);
 
     // put a dummy return val
-    if(ret_val) {
-      c = scc_code_push_val(SCC_OP_PUSH,1);
-      SCC_LIST_ADD(code,last,c);
-    }
+    if(ret_val)
+      scc_code_push_val(code,SCC_OP_PUSH,1);
     break;
 
   case SCC_ST_STR:
@@ -503,646 +511,670 @@ static scc_code_t* scc_assign_gen_code(scc_op_t* op, int ret_val) {
       scc_log(LOG_WARN,"Warning: strings can't be assigned to 2-dim arrays, ignoring second index.\n");
 
     if(a->val.v.y)
-        c = scc_statement_gen_code(a->val.v.y,1);
+        scc_statement_gen_code(code,a->val.v.y,1);
     else
-        c = scc_code_push_val(SCC_OP_PUSH,0);
-    SCC_LIST_ADD(code,last,c);
+        scc_code_push_val(code,SCC_OP_PUSH,0);
 
-    c = scc_code_res_addr(SCC_OP_ARRAY_WRITE_STR,a->val.v.r);
-    SCC_LIST_ADD(code,last,c);
+    scc_code_res_addr(code,SCC_OP_ARRAY_WRITE_STR,a->val.v.r);
 
-    c = scc_str_gen_code(b->val.s);
-    SCC_LIST_ADD(code,last,c);
+    scc_str_gen_code(code,b->val.s);
 
     // push a dummy return value.
-    if(ret_val) {
-      c = scc_code_push_val(SCC_OP_PUSH,1);
-      SCC_LIST_ADD(code,last,c);
-    }
+    if(ret_val)
+      scc_code_push_val(code,SCC_OP_PUSH,1);
     break;
 
   default:
 
     // push the x index
-    if(a->val.v.x) {
-      c = scc_statement_gen_code(a->val.v.x,1);
-      SCC_LIST_ADD(code,last,c);
-    }
+    if(a->val.v.x)
+      scc_statement_gen_code(code,a->val.v.x,1);
 
     // the y
-    c = scc_statement_gen_code(a->val.v.y,1);
-    SCC_LIST_ADD(code,last,c);
+    scc_statement_gen_code(code,a->val.v.y,1);
 
     // If we have an op push a
-    if(op->op != '=') {
-      c = scc_statement_gen_code(a,1);
-      SCC_LIST_ADD(code,last,c);
-    }
+    if(op->op != '=')
+      scc_statement_gen_code(code,a,1);
 
     // push b
-    c = scc_statement_gen_code(b,1);
-    SCC_LIST_ADD(code,last,c);
+    scc_statement_gen_code(code,b,1);
 
     // put the op
     if(op->op != '=') {
       oper = scc_get_assign_op(op->op);
-      
-      c = scc_code_new(1);
-      c->data[0] = oper->op;
-      SCC_LIST_ADD(code,last,c);
+      scc_code_put_op(code,oper->op);
     }
-      
-    if(a->val.v.x)
-      c = scc_code_push_res(SCC_OP_ARRAY2_WRITE,a->val.v.r);
-    else
-      c = scc_code_push_res(SCC_OP_ARRAY_WRITE,a->val.v.r);
-    SCC_LIST_ADD(code,last,c);
+
+    scc_code_push_res(code,a->val.v.x ? SCC_OP_ARRAY2_WRITE : SCC_OP_ARRAY_WRITE,
+                      a->val.v.r);
 
     // put a dummy return val
-    if(ret_val) {
-      c = scc_code_push_val(SCC_OP_PUSH,1);
-      SCC_LIST_ADD(code,last,c);
-    }
+    if(ret_val)
+      scc_code_push_val(code,SCC_OP_PUSH,1);
     break;
   }
-
-  return code;
 }
 
-static scc_code_t* scc_bop_gen_code(scc_op_t* op, int ret_val) {
-  scc_code_t *code = NULL,*last = NULL,*c;
+static void scc_bop_gen_code(scc_code_t* code, scc_op_t* op, int ret_val) {
   scc_statement_t *a = op->argv, *b = op->argv->next;
   scc_operator_t* oper = scc_get_bin_op(op->op);
-  
+
   if(!oper) {
     scc_log(LOG_ERR,"Got unhandled binary operator.\n");
-    return NULL;
+    return;
   }
 
-  c = scc_statement_gen_code(a,1);
-  SCC_LIST_ADD(code,last,c);
-  c = scc_statement_gen_code(b,1);
-  SCC_LIST_ADD(code,last,c);
-  
-  c = scc_code_new(1);
-  c->data[0] = oper->op;
-  SCC_LIST_ADD(code,last,c);  
-
-  if(!ret_val) {
-    c = scc_code_new(1);
-    c->data[0] = SCC_OP_POP;
-    SCC_LIST_ADD(code,last,c);
-  }
+  scc_statement_gen_code(code,a,1);
+  scc_statement_gen_code(code,b,1);
+
+  scc_code_put_op(code,oper->op);
 
-  return code;
+  if(!ret_val)
+    scc_code_put_op(code,SCC_OP_POP);
 }
 
-static scc_code_t* scc_uop_gen_code(scc_op_t* op, int ret_val) {
-  scc_code_t *code = NULL,*last = NULL,*c;
+static void scc_uop_gen_code(scc_code_t* code, scc_op_t* op, int ret_val) {
   int o;
 
   switch(op->op) {
   case '-':
-    c = scc_statement_gen_code(op->argv,ret_val);
-    SCC_LIST_ADD(code,last,c);
+    scc_statement_gen_code(code,op->argv,ret_val);
     if(!ret_val) break;
 
-    c = scc_code_push_val(SCC_OP_PUSH,-1);
-    SCC_LIST_ADD(code,last,c);
-
-    c = scc_code_new(1);
-    c->data[0] = SCC_OP_MUL;
-    SCC_LIST_ADD(code,last,c);
+    scc_code_push_val(code,SCC_OP_PUSH,-1);
+    scc_code_put_op(code,SCC_OP_MUL);
     break;
   case '!':
-    c = scc_statement_gen_code(op->argv,ret_val);
-    SCC_LIST_ADD(code,last,c);
+    scc_statement_gen_code(code,op->argv,ret_val);
     if(!ret_val) break;
 
-    c = scc_code_new(1);
-    c->data[0] = SCC_OP_NOT;
-    SCC_LIST_ADD(code,last,c);
+    scc_code_put_op(code,SCC_OP_NOT);
     break;
   case PREINC:
   case PREDEC:
     if(op->argv->val.v.y) {
       if(op->argv->val.v.x) {
         // push the index for the final write
-        c = scc_statement_gen_code(op->argv->val.v.x,1);
-        SCC_LIST_ADD(code,last,c);
-        c = scc_statement_gen_code(op->argv->val.v.y,1);
-        SCC_LIST_ADD(code,last,c);
+        scc_statement_gen_code(code,op->argv->val.v.x,1);
+        scc_statement_gen_code(code,op->argv->val.v.y,1);
 
         // for 2dim array we have to expand to a full addition
         // push the x index and choose the op we need
-        c = scc_statement_gen_code(op->argv->val.v.x,1);
-        SCC_LIST_ADD(code,last,c);
+        scc_statement_gen_code(code,op->argv->val.v.x,1);
         o = (op->op == PREINC ? SCC_OP_ADD : SCC_OP_SUB);
       } else
         o = (op->op == PREINC ? SCC_OP_INC_ARRAY : SCC_OP_DEC_ARRAY);
 
       // push the index
-      c = scc_statement_gen_code(op->argv->val.v.y,1);
-      SCC_LIST_ADD(code,last,c);
+      scc_statement_gen_code(code,op->argv->val.v.y,1);
 
     } else
       o = (op->op == PREINC ? SCC_OP_INC_VAR : SCC_OP_DEC_VAR);
 
     if(op->argv->val.v.x) {
       // push the array entry on the stack
-      c = scc_code_push_res(SCC_OP_ARRAY2_READ,op->argv->val.v.r);
-      SCC_LIST_ADD(code,last,c);
+      scc_code_push_res(code,SCC_OP_ARRAY2_READ,op->argv->val.v.r);
       // push a 1
-      c = scc_code_push_val(SCC_OP_PUSH,1);
-      SCC_LIST_ADD(code,last,c);
-
+      scc_code_push_val(code,SCC_OP_PUSH,1);
       // push the op
-      c = scc_code_new(1);
-      c->data[0] = o;
-      SCC_LIST_ADD(code,last,c);
+      scc_code_put_op(code,o);
       // put the result back into the variable
-      c = scc_code_push_res(SCC_OP_ARRAY2_WRITE,op->argv->val.v.r);
+      scc_code_push_res(code,SCC_OP_ARRAY2_WRITE,op->argv->val.v.r);
     } else  // put the opcode
-      c = scc_code_push_res(o,op->argv->val.v.r);
-    SCC_LIST_ADD(code,last,c);
+      scc_code_push_res(code,o,op->argv->val.v.r);
     if(!ret_val) break;
-    c = scc_statement_gen_code(op->argv,1);
-    SCC_LIST_ADD(code,last,c);
+    scc_statement_gen_code(code,op->argv,1);
     break;
   case POSTINC:
   case POSTDEC:
-    if(ret_val) {
-      c = scc_statement_gen_code(op->argv,1);
-      SCC_LIST_ADD(code,last,c);
-    }
+    if(ret_val)
+      scc_statement_gen_code(code,op->argv,1);
     if(op->argv->val.v.y) {
       if(op->argv->val.v.x) {
         // push the index for the final write
-        c = scc_statement_gen_code(op->argv->val.v.x,1);
-        SCC_LIST_ADD(code,last,c);
-        c = scc_statement_gen_code(op->argv->val.v.y,1);
-        SCC_LIST_ADD(code,last,c);
+        scc_statement_gen_code(code,op->argv->val.v.x,1);
+        scc_statement_gen_code(code,op->argv->val.v.y,1);
 
         // for 2dim array we have to expand to a full addition
         // push the x index and choose the op we need
-        c = scc_statement_gen_code(op->argv->val.v.x,1);
-        SCC_LIST_ADD(code,last,c);
+        scc_statement_gen_code(code,op->argv->val.v.x,1);
         o = (op->op == POSTINC ? SCC_OP_ADD : SCC_OP_SUB);
       } else
         o = (op->op == POSTINC ? SCC_OP_INC_ARRAY : SCC_OP_DEC_ARRAY);
 
       // push the index
-      c = scc_statement_gen_code(op->argv->val.v.y,1);
-      SCC_LIST_ADD(code,last,c);
+      scc_statement_gen_code(code,op->argv->val.v.y,1);
     } else
       o = (op->op == POSTINC ? SCC_OP_INC_VAR : SCC_OP_DEC_VAR);
 
     if(op->argv->val.v.x) {
       // push the array entry on the stack
-      c = scc_code_push_res(SCC_OP_ARRAY2_READ,op->argv->val.v.r);
-      SCC_LIST_ADD(code,last,c);
+      scc_code_push_res(code,SCC_OP_ARRAY2_READ,op->argv->val.v.r);
       // push a 1
-      c = scc_code_push_val(SCC_OP_PUSH,1);
-      SCC_LIST_ADD(code,last,c);
-
+      scc_code_push_val(code,SCC_OP_PUSH,1);
       // push the op
-      c = scc_code_new(1);
-      c->data[0] = o;
-      SCC_LIST_ADD(code,last,c);
+      scc_code_put_op(code,o);
       // put the result back into the variable
-      c = scc_code_push_res(SCC_OP_ARRAY2_WRITE,op->argv->val.v.r);
+      scc_code_push_res(code,SCC_OP_ARRAY2_WRITE,op->argv->val.v.r);
     } else
-      c = scc_code_push_res(o,op->argv->val.v.r);
-    SCC_LIST_ADD(code,last,c);
+      scc_code_push_res(code,o,op->argv->val.v.r);
     break;
   default:
     scc_log(LOG_ERR,"Got unhandled unary operator: %c\n",op->op);
-    return NULL;
   }
-
-  return code;
 }
 
-static scc_code_t* scc_top_gen_code(scc_op_t* op, int ret_val) {
-  scc_code_t *code = NULL,*last = NULL,*c;
-  scc_code_t *cb,*cc;
+static void scc_top_gen_code(scc_code_t* code, scc_op_t* op, int ret_val) {
   scc_statement_t *a,*x,*y;
-  int lb,lc;
+  int start = code->len, jz, jmp, lb, lc;
 
   a = op->argv; x = a->next; y = x->next;
 
-  cb = scc_statement_gen_code(x,ret_val);
-  lb = scc_code_size(cb);
-  cc = scc_statement_gen_code(y,ret_val);
-  lc = scc_code_size(cc);
-
-  if(lb + lc == 0) {
-    if(ret_val)
-      scc_log(LOG_ERR,"Something went badly wrong.\n");
-    return NULL;
-  }
-
   // gen the condition value code
-  c = scc_statement_gen_code(a,1);
-  SCC_LIST_ADD(code,last,c);
+  scc_statement_gen_code(code,a,1);
 
   // if
-  c = scc_code_new(3);
-  c->data[0] = SCC_OP_JZ;
-  SCC_SET_S16LE(c->data,1,scc_code_size(cb) + 3);
-  SCC_LIST_ADD(code,last,c);
+  jz = scc_code_put_jump(code,SCC_OP_JZ);
+  scc_statement_gen_code(code,x,ret_val);
+  jmp = scc_code_put_jump(code,SCC_OP_JMP);
+  lb = jmp - jz - 3;
+  scc_code_set_jump(code,jz,code->len);
 
-  SCC_LIST_ADD(code,last,cb);
-
-  c = scc_code_new(3);
-  c->data[0] = SCC_OP_JMP;
-  SCC_SET_S16LE(c->data,1,scc_code_size(cc));
-  SCC_LIST_ADD(code,last,c);
-  
-  SCC_LIST_ADD(code,last,cc);
+  // else
+  scc_statement_gen_code(code,y,ret_val);
+  lc = code->len - jmp - 3;
+  scc_code_set_jump(code,jmp,code->len);
 
-  return code;
+  if(lb + lc == 0) {
+    if(ret_val)
+      scc_log(LOG_ERR,"Something went badly wrong.\n");
+    scc_code_truncate(code,start);
+  }
 }
 
-static scc_code_t* scc_op_gen_code(scc_op_t* op, int ret_val) {
-  scc_code_t *code = NULL; //,*last = NULL,*c;
+static void scc_op_gen_code(scc_code_t* code, scc_op_t* op, int ret_val) {
 
   switch(op->type) {
   case SCC_OT_ASSIGN:
-    code = scc_assign_gen_code(op,ret_val);
+    scc_assign_gen_code(code,op,ret_val);
     break;
   case SCC_OT_BINARY:
-    code = scc_bop_gen_code(op,ret_val);
+    scc_bop_gen_code(code,op,ret_val);
     break;
   case SCC_OT_UNARY:
-    code = scc_uop_gen_code(op,ret_val);
+    scc_uop_gen_code(code,op,ret_val);
     break;
   case SCC_OT_TERNARY:
-    code = scc_top_gen_code(op,ret_val);
+    scc_top_gen_code(code,op,ret_val);
     break;
   default:
     scc_log(LOG_ERR,"Got unhandled op %c (%d)\n",op->op,op->op);
   }
-
-  return code;
 }
 
-static scc_code_t* scc_statement_gen_code(scc_statement_t* st, int ret_val) {
-  scc_code_t *code = NULL,*last = NULL,*c;
+static void scc_statement_gen_code(scc_code_t* code, scc_statement_t* st,
+                                   int ret_val) {
   scc_statement_t* a = NULL;
   int n = 0;
 
   switch(st->type) {
   case SCC_ST_VAL:
-    if(ret_val) {
-      c = scc_code_push_val(SCC_OP_PUSH,st->val.i);
-      SCC_LIST_ADD(code,last,c);
-    }
+    if(ret_val)
+      scc_code_push_val(code,SCC_OP_PUSH,st->val.i);
     break;
   case SCC_ST_RES:
-    if(ret_val) {
-      c = scc_code_push_res(SCC_OP_PUSH,st->val.r);
-      SCC_LIST_ADD(code,last,c);
-    }
+    if(ret_val)
+      scc_code_push_res(code,SCC_OP_PUSH,st->val.r);
     break;
   case SCC_ST_CALL:
-    c = scc_call_gen_code(&st->val.c,ret_val);
-    SCC_LIST_ADD(code,last,c);
+    scc_call_gen_code(code,&st->val.c,ret_val);
     break;
   case SCC_ST_LIST:
     if(!ret_val) break;
-    // count the elements
-    //for(a = st->val.l ; a ; a = a->next) n++;
-    
     // gen their code and count the elements
     for(a = st->val.l ; a ; a = a->next) {
-      c = scc_statement_gen_code(a,1);
-      SCC_LIST_ADD(code,last,c);
+      scc_statement_gen_code(code,a,1);
       n++;
     }
     // push the number of element
-    c = scc_code_push_val(SCC_OP_PUSH,n);
-    SCC_LIST_ADD(code,last,c);
+    scc_code_push_val(code,SCC_OP_PUSH,n);
     break;
   case SCC_ST_VAR:
     if(!ret_val) break;
 
     if(st->val.v.y) {
       // push x value
-      if(st->val.v.x) {
-        c = scc_statement_gen_code(st->val.v.x,1);
-        SCC_LIST_ADD(code,last,c);
-      }
+      if(st->val.v.x)
+        scc_statement_gen_code(code,st->val.v.x,1);
       // push y value
-      c = scc_statement_gen_code(st->val.v.y,1);
-      SCC_LIST_ADD(code,last,c);
+      scc_statement_gen_code(code,st->val.v.y,1);
       // op code
-      c = scc_code_push_res(st->val.v.x ? SCC_OP_ARRAY2_READ  : SCC_OP_ARRAY_READ,
-                            st->val.v.r);
-      SCC_LIST_ADD(code,last,c);
-    } else {
-      c = scc_code_push_res(SCC_OP_VAR_READ,st->val.v.r);
-      SCC_LIST_ADD(code,last,c);
-    }
+      scc_code_push_res(code,st->val.v.x ? SCC_OP_ARRAY2_READ  : SCC_OP_ARRAY_READ,
+                        st->val.v.r);
+    } else
+      scc_code_push_res(code,SCC_OP_VAR_READ,st->val.v.r);
     break;
   case SCC_ST_OP:
-    c = scc_op_gen_code(&st->val.o,ret_val);
-    SCC_LIST_ADD(code,last,c);
+    scc_op_gen_code(code,&st->val.o,ret_val);
     break;
   case SCC_ST_CHAIN:
     // gen the code for each element
     // only the last one one should potentialy return a value
-    for(a = st->val.l ; a ; a = a->next) {
-      c = scc_statement_gen_code(a,a->next ? 0 : ret_val);
-      SCC_LIST_ADD(code,last,c);
-    }
+    for(a = st->val.l ; a ; a = a->next)
+      scc_statement_gen_code(code,a,a->next ? 0 : ret_val);
     break;
   default:
     scc_log(LOG_ERR,"Got unhandled statement type: %d\n",st->type);
   }
-
-  return code;
-
 }
 
-static scc_code_t* scc_instruct_gen_code(scc_instruct_t* inst);
-static scc_code_t* scc_branch_gen_code(scc_instruct_t* inst);
+static void scc_instruct_gen_code(scc_code_t* code, scc_instruct_t* inst);
+static void scc_branch_gen_code(scc_code_t* code, scc_instruct_t* inst);
 
-static scc_code_t* scc_if_gen_code(scc_instruct_t* inst) {
-  scc_code_t *code=NULL,*last=NULL,*c;
-  scc_code_t *a = NULL;
-  int len = 0;
+static void scc_if_gen_code(scc_code_t* code, scc_instruct_t* inst) {
+  int pos, jmp = -1;
 
   // gen the condition value code
-  c = scc_statement_gen_code(inst->cond,1);
-  SCC_LIST_ADD(code,last,c);
+  scc_statement_gen_code(code,inst->cond,1);
 
   // Optimize out the branch instructions, they all generate a jump
   if(inst->body->type == SCC_INST_BRANCH &&
      inst->body->subtype != SCC_BRANCH_RETURN) {
-    // get the code
-    c = scc_branch_gen_code(inst->body);
+    pos = code->len;
+    scc_branch_gen_code(code,inst->body);
     // set our condition instead of the unconditional jmp
-    c->data[0] = inst->subtype ? SCC_OP_JZ : SCC_OP_JNZ;
-    SCC_LIST_ADD(code,last,c);
-  } else {  
-    // gen the if body code so we can know how big it is
-    a = scc_instruct_gen_code(inst->body);
-    len = scc_code_size(a);
-    // if we have an else block we need to add a jump at the
-    // end of the first body
-    if(inst->body2) len += 3;
-
+    if(code->len > pos)
+      code->data[pos] = inst->subtype ? SCC_OP_JZ : SCC_OP_JNZ;
+  } else {
     // if
-    c = scc_code_new(3);
-    c->data[0] = inst->subtype ? SCC_OP_JNZ : SCC_OP_JZ;
-
-    SCC_SET_S16LE(c->data,1,len);
-    SCC_LIST_ADD(code,last,c);
+    pos = scc_code_put_jump(code,inst->subtype ? SCC_OP_JNZ : SCC_OP_JZ);
     // body 1
-    SCC_LIST_ADD(code,last,a);
+    scc_instruct_gen_code(code,inst->body);
+    // if we have an else block we need to add a jump at the
+    // end of the first body
+    if(inst->body2)
+      jmp = scc_code_put_jump(code,SCC_OP_JMP);
+    scc_code_set_jump(code,pos,code->len);
   }
 
   // else
   if(inst->body2) {
-
- 
-    // we need the size of the else block to jump above it
-    // at the end of the if block
-    a = scc_instruct_gen_code(inst->body2);
-
+    // body 2
+    scc_instruct_gen_code(code,inst->body2);
     // If we optimized a branch inst we don't have a first body
     // so we don't need a jump after it
-    if(len) {
-      // endif :)
-      c = scc_code_new(3);
-      c->data[0] = SCC_OP_JMP;
-      SCC_SET_S16LE(c->data,1,scc_code_size(a));
-      SCC_LIST_ADD(code,last,c);
-    }
-
-    // body 2
-    SCC_LIST_ADD(code,last,a);
+    if(jmp >= 0)
+      scc_code_set_jump(code,jmp,code->len);
   }
-  return code;
 }
 
-static scc_code_t* scc_for_gen_code(scc_instruct_t* inst) {
-  scc_code_t *code=NULL,*last=NULL,*c;
-  scc_code_t *loop,*body,*post = NULL;
-  int cont;
+static void scc_for_gen_code(scc_code_t* code, scc_instruct_t* inst) {
+  int start = code->len, loop, cont, jz, jmp;
 
   // push the loop context
   scc_loop_push(inst->type,inst->sym);
 
-  body = scc_instruct_gen_code(inst->body);
-  if(inst->post)
-      post = scc_statement_gen_code(inst->post,0);
-
   // pre
-  if(inst->pre) {
-      c = scc_statement_gen_code(inst->pre,0);
-      SCC_LIST_ADD(code,last,c);
-  }
+  if(inst->pre)
+    scc_statement_gen_code(code,inst->pre,0);
 
-  // cond  
-  loop = c = scc_statement_gen_code(inst->cond,1);
-  SCC_LIST_ADD(code,last,c);
-
-  c = scc_code_new(3);
-  c->data[0] = SCC_OP_JZ;
-  SCC_SET_S16LE(c->data,1,scc_code_size(body) + scc_code_size(post) + 3);
-  SCC_LIST_ADD(code,last,c);
+  // cond
+  loop = code->len;
+  scc_statement_gen_code(code,inst->cond,1);
+  jz = scc_code_put_jump(code,SCC_OP_JZ);
 
   // body
-  SCC_LIST_ADD(code,last,body);
+  scc_instruct_gen_code(code,inst->body);
   // post
-  cont = scc_code_size(code);
-  SCC_LIST_ADD(code,last,post);
-
-  c = scc_code_new(3);
-  c->data[0] = SCC_OP_JMP;
-  SCC_LIST_ADD(code,last,c);
-
-  SCC_SET_S16LE(c->data,1, - scc_code_size(loop));
-
-  //  br = scc_code_size(code);
+  cont = code->len;
+  if(inst->post)
+    scc_statement_gen_code(code,inst->post,0);
 
-  scc_loop_fix_code(code,scc_code_size(code),cont);
+  jmp = scc_code_put_jump(code,SCC_OP_JMP);
+  scc_code_set_jump(code,jmp,loop);
+  scc_code_set_jump(code,jz,code->len);
 
-  return code;
+  scc_loop_fix_code(code,start,code->len,cont);
 }
 
-static scc_code_t* scc_while_gen_code(scc_instruct_t* inst) {
-  scc_code_t *code=NULL,*last=NULL,*c;
-  scc_code_t *body;
+static void scc_while_gen_code(scc_code_t* code, scc_instruct_t* inst) {
+  int start = code->len, jz, jmp;
 
   // push the loop context
   scc_loop_push(inst->type,inst->sym);
 
-  body = scc_instruct_gen_code(inst->body);
-
   // cond
-  c = scc_statement_gen_code(inst->cond,1);
-  SCC_LIST_ADD(code,last,c);
-
-  c = scc_code_new(3);
-  c->data[0] = inst->subtype ? SCC_OP_JNZ : SCC_OP_JZ;
-  SCC_SET_S16LE(c->data,1, scc_code_size(body) + 3);
-  SCC_LIST_ADD(code,last,c);
+  scc_statement_gen_code(code,inst->cond,1);
+  jz = scc_code_put_jump(code,inst->subtype ? SCC_OP_JNZ : SCC_OP_JZ);
 
   // body
-  SCC_LIST_ADD(code,last,body);
-
-  c = scc_code_new(3);
-  c->data[0] = SCC_OP_JMP;
-  SCC_LIST_ADD(code,last,c);
-
-  SCC_SET_S16LE(c->data,1, - scc_code_size(code));
+  scc_instruct_gen_code(code,inst->body);
 
-  scc_loop_fix_code(code,scc_code_size(code),0);
+  jmp = scc_code_put_jump(code,SCC_OP_JMP);
+  scc_code_set_jump(code,jmp,start);
+  scc_code_set_jump(code,jz,code->len);
 
-  return code;
+  scc_loop_fix_code(code,start,code->len,start);
 }
 
 
-static scc_code_t* scc_do_gen_code(scc_instruct_t* inst) {
-  scc_code_t *code=NULL,*last=NULL,*c;
-  int cont;
+static void scc_do_gen_code(scc_code_t* code, scc_instruct_t* inst) {
+  int start = code->len, cont, jmp;
+
   // push the loop context
   scc_loop_push(inst->type,inst->sym);
 
   // body
-  c = scc_instruct_gen_code(inst->body);
-  SCC_LIST_ADD(code,last,c);
-  cont = scc_code_size(c);
+  scc_instruct_gen_code(code,inst->body);
+  cont = code->len;
 
   // cond
-  c = scc_statement_gen_code(inst->cond,1);
-  SCC_LIST_ADD(code,last,c);
-
-  c = scc_code_new(3);
-  c->data[0] = inst->subtype ? SCC_OP_JZ : SCC_OP_JNZ;
-  SCC_LIST_ADD(code,last,c);
-
-  SCC_SET_S16LE(c->data,1, -scc_code_size(code));
+  scc_statement_gen_code(code,inst->cond,1);
 
-  scc_loop_fix_code(code,scc_code_size(code),cont);
+  jmp = scc_code_put_jump(code,inst->subtype ? SCC_OP_JZ : SCC_OP_JNZ);
+  scc_code_set_jump(code,jmp,start);
 
-  return code;
+  scc_loop_fix_code(code,start,code->len,cont);
 }
 
-static scc_code_t* scc_branch_gen_code(scc_instruct_t* inst) {
-  scc_code_t *code=NULL,*last=NULL,*c;
+static void scc_branch_gen_code(scc_code_t* code, scc_instruct_t* inst) {
   scc_loop_t* l;
+  uint8_t* ptr;
+  int pos;
 
   if(inst->subtype == SCC_BRANCH_RETURN) {
     if(inst->pre) {
-      c = scc_statement_gen_code(inst->pre,1);
-      SCC_LIST_ADD(code,last,c);
-      c = scc_code_push_val(SCC_OP_VAR_WRITE,SCC_VAR_RETURN);
-      SCC_LIST_ADD(code,last,c);
+      scc_statement_gen_code(code,inst->pre,1);
+      scc_code_push_val(code,SCC_OP_VAR_WRITE,SCC_VAR_RETURN);
     }
-    c = scc_code_new(1);
-    c->data[0] = SCC_OP_SCR_RET;
-    c->fix = SCC_FIX_RETURN;
-    SCC_LIST_ADD(code,last,c);
-    return code;
+    scc_code_add_fix(code,code->len,SCC_FIX_RETURN);
+    scc_code_put_op(code,SCC_OP_SCR_RET);
+    return;
   }
 
   if(!loop_stack) {
     scc_log(LOG_ERR,"Branching instructions can't be used outside of loops.\n");
-    return NULL;
+    return;
   }
 
   l = scc_loop_get(inst->subtype,inst->sym);
   if(!l) {
     scc_log(LOG_ERR,"No loop named %s was found in the loop stack.\n",
 	   inst->sym);
-    return NULL;
+    return;
   }
 
   if(l->type == SCC_INST_SWITCH && inst->subtype == SCC_BRANCH_CONTINUE) {
     scc_log(LOG_ERR,"Continue is not allowed in switch blocks.\n");
-    return NULL;
+    return;
   }
 
-  c = scc_code_new(3);
-  c->fix = SCC_FIX_BRANCH;
-  c->data[0] = SCC_OP_JMP;
-  c->data[1] = l->id;
-  c->data[2] = inst->subtype;
-  
-  
-  return c;
+  // the destination is resolved by scc_loop_fix_code()
+  pos = code->len;
+  scc_code_start_insn(code);
+  ptr = scc_code_put(code,3);
+  ptr[0] = SCC_OP_JMP;
+  ptr[1] = l->id;
+  ptr[2] = inst->subtype;
+  scc_code_add_fix(code,pos,SCC_FIX_BRANCH);
+}
+
+// check if a block end with a break, the jump to the next block
+// can then be spared.
+static scc_instruct_t* scc_switch_last_break(scc_instruct_t* body,
+                                             scc_instruct_t** prev) {
+  scc_instruct_t *i, *i1 = NULL;
+  for(i = body ; i && i->next ; i1 = i, i = i->next);
+  if(prev) *prev = i1;
+  if(i && i->type == SCC_INST_BRANCH &&
+     i->subtype == SCC_BRANCH_BREAK)
+    return i;
+  return NULL;
+}
+
+static void scc_switch_default_gen_code(scc_code_t* code, scc_instruct_t* i) {
+  scc_instruct_t *i1;
+
+  // a break at the end of the default is useless
+  if(scc_switch_last_break(i->body,&i1)) {
+    if(i1)
+      i1->next = NULL;
+    else
+      i->body = NULL;
+  }
+
+  if(i->body)
+    scc_instruct_gen_code(code,i->body);
 }
 
-static scc_code_t* scc_switch_gen_code(scc_instruct_t* inst) {
-  scc_code_t *code=NULL,*last=NULL,*c;
-  scc_code_t *cond_code,*body_code;
-  scc_instruct_t *i = inst->body, *i0 = NULL;
+// Switch with only constant cases are dispatched with a balanced
+// comparison tree instead of testing all the cases one after the other.
+// Consecutive values going to the same block are tested as a range.
+
+#define SCC_SWITCH_TREE_MIN   4
+#define SCC_SWITCH_TREE_LEAF  3
+
+typedef struct scc_switch_case {
+  int first,last; // range of values
+  int blk;        // block index
+} scc_switch_case_t;
+
+typedef struct scc_switch_tree {
+  scc_switch_case_t* cases;
+  int num_case;
+  int *jmp, *jmp_blk;
+  int num_jmp;
+} scc_switch_tree_t;
+
+static int scc_switch_case_cmp(const void* a, const void* b) {
+  const scc_switch_case_t *ca = a, *cb = b;
+  if(ca->first != cb->first)
+    return ca->first < cb->first ? -1 : 1;
+  return ca->blk - cb->blk;
+}
+
+static int scc_switch_tree_init(scc_switch_tree_t* t, scc_instruct_t* inst) {
+  scc_instruct_t* i;
+  scc_statement_t* cond;
+  int n = 0, blk, j;
+
+  memset(t,0,sizeof(scc_switch_tree_t));
+  if(scc_code_opt_level < 1) return 0;
+
+  for(i = inst->body ; i && i->cond ; i = i->next)
+    for(cond = i->cond ; cond ; cond = cond->next) {
+      if(cond->type != SCC_ST_VAL ||
+         cond->val.i < -0x8000 || cond->val.i > 0x7FFF)
+        return 0;
+      n++;
+    }
+  if(n < SCC_SWITCH_TREE_MIN) return 0;
+
+  t->cases = malloc(n*sizeof(scc_switch_case_t));
+  for(i = inst->body, blk = 0 ; i && i->cond ; i = i->next, blk++)
+    for(cond = i->cond ; cond ; cond = cond->next) {
+      t->cases[t->num_case].first = t->cases[t->num_case].last = cond->val.i;
+      t->cases[t->num_case].blk = blk;
+      t->num_case++;
+    }
+  qsort(t->cases,t->num_case,sizeof(scc_switch_case_t),scc_switch_case_cmp);
+
+  // drop the duplicates, the first block wins like with the linear tests,
+  // and merge the consecutive values going to the same block
+  for(n = 1, j = 0 ; n < t->num_case ; n++) {
+    if(t->cases[n].first == t->cases[j].last) continue;
+    if(t->cases[n].first == t->cases[j].last+1 &&
+       t->cases[n].blk == t->cases[j].blk) {
+      t->cases[j].last = t->cases[n].first;
+      continue;
+    }
+    t->cases[++j] = t->cases[n];
+  }
+  t->num_case = j+1;
+
+  if(t->num_case < SCC_SWITCH_TREE_MIN) {
+    free(t->cases);
+    t->cases = NULL;
+    return 0;
+  }
+
+  t->jmp = malloc(2*t->num_case*sizeof(int));
+  t->jmp_blk = malloc(2*t->num_case*sizeof(int));
+  return 1;
+}
+
+static void scc_switch_tree_jump(scc_code_t* code, scc_switch_tree_t* t,
+                                 uint8_t op, int blk) {
+  t->jmp[t->num_jmp] = scc_code_put_jump(code,op);
+  t->jmp_blk[t->num_jmp] = blk;
+  t->num_jmp++;
+}
+
+static int scc_switch_tree_test(scc_code_t* code, int val, uint8_t op) {
+  scc_code_put_op(code,SCC_OP_DUP);
+  scc_code_push_val(code,SCC_OP_PUSH,val);
+  scc_code_put_op(code,op);
+  return scc_code_put_jump(code,SCC_OP_JNZ);
+}
+
+// the value is known to be in [lo,hi], blk -1 is the default block
+static void scc_switch_tree_gen_code(scc_code_t* code, scc_switch_tree_t* t,
+                                     scc_switch_case_t* c, int n,
+                                     int lo, int hi) {
+  int i, m, jmp;
+
+  if(n > SCC_SWITCH_TREE_LEAF) {
+    m = n/2;
+    jmp = scc_switch_tree_test(code,c[m].first,SCC_OP_L);
+    scc_switch_tree_gen_code(code,t,c+m,n-m,c[m].first,hi);
+    scc_code_set_jump(code,jmp,code->len);
+    scc_switch_tree_gen_code(code,t,c,m,lo,c[m].first-1);
+    return;
+  }
+
+  for(i = 0 ; i < n ; i++) {
+    if(c[i].first <= lo && c[i].last >= hi) {
+      scc_switch_tree_jump(code,t,SCC_OP_JMP,c[i].blk);
+      return;
+    }
+    if(c[i].first == c[i].last) {
+      scc_code_put_op(code,SCC_OP_DUP);
+      scc_code_push_val(code,SCC_OP_PUSH,c[i].first);
+      scc_code_put_op(code,SCC_OP_EQ);
+    } else if(c[i].first <= lo) {
+      scc_code_put_op(code,SCC_OP_DUP);
+      scc_code_push_val(code,SCC_OP_PUSH,c[i].last);
+      scc_code_put_op(code,SCC_OP_LE);
+    } else if(c[i].last >= hi) {
+      scc_code_put_op(code,SCC_OP_DUP);
+      scc_code_push_val(code,SCC_OP_PUSH,c[i].first);
+      scc_code_put_op(code,SCC_OP_GE);
+    } else {
+      jmp = scc_switch_tree_test(code,c[i].first,SCC_OP_L);
+      scc_code_put_op(code,SCC_OP_DUP);
+      scc_code_push_val(code,SCC_OP_PUSH,c[i].last);
+      scc_code_put_op(code,SCC_OP_LE);
+      scc_switch_tree_jump(code,t,SCC_OP_JNZ,c[i].blk);
+      scc_code_set_jump(code,jmp,code->len);
+      continue;
+    }
+    scc_switch_tree_jump(code,t,SCC_OP_JNZ,c[i].blk);
+    if(c[i].first <= lo) lo = c[i].last+1;
+  }
+  scc_switch_tree_jump(code,t,SCC_OP_JMP,-1);
+}
+
+static void scc_switch_tree_body_gen_code(scc_code_t* code,
+                                          scc_switch_tree_t* t,
+                                          scc_instruct_t* inst) {
+  scc_instruct_t* i;
+  int blk, j, jmp = -1;
+
+  for(i = inst->body, blk = 0 ; i ; i = i->next, blk++) {
+    // resolve the jumps to this block
+    for(j = 0 ; j < t->num_jmp ; j++)
+      if(t->jmp_blk[j] == (i->cond ? blk : -1))
+        scc_code_set_jump(code,t->jmp[j],code->len);
+
+    // kill the switched value before entering the body
+    scc_code_put_op(code,SCC_OP_POP);
+
+    // the previous block fall through here
+    if(jmp >= 0)
+      scc_code_set_jump(code,jmp,code->len);
+
+    if(!i->cond) {
+      scc_switch_default_gen_code(code,i);
+      return;
+    }
+
+    scc_instruct_gen_code(code,i->body);
+    jmp = scc_switch_last_break(i->body,NULL) ? -1 :
+      scc_code_put_jump(code,SCC_OP_JMP);
+  }
+
+  // no default block
+  for(j = 0 ; j < t->num_jmp ; j++)
+    if(t->jmp_blk[j] < 0)
+      scc_code_set_jump(code,t->jmp[j],code->len);
+  scc_code_put_op(code,SCC_OP_POP);
+  if(jmp >= 0)
+    scc_code_set_jump(code,jmp,code->len);
+}
+
+static void scc_switch_gen_code(scc_code_t* code, scc_instruct_t* inst) {
+  scc_instruct_t *i = inst->body;
   scc_statement_t* cond = i->cond;
-  int add_jmp = 0;
+  scc_switch_tree_t tree;
+  int start = code->len, add_jmp = 0, jnz, jmp = -1;
 
   // gen the switched value code, if we have some conditions
-  if(cond) {
-    c = scc_statement_gen_code(inst->cond,1);
-    SCC_LIST_ADD(code,last,c);
-  }
+  if(cond)
+    scc_statement_gen_code(code,inst->cond,1);
 
   // push the loop context
   scc_loop_push(inst->type,inst->sym);
 
-  // generate the first condition code
-  if(cond)
-    cond_code = scc_statement_gen_code(cond,1);
+  if(scc_switch_tree_init(&tree,inst)) {
+    scc_switch_tree_gen_code(code,&tree,tree.cases,tree.num_case,
+                             INT_MIN,INT_MAX);
+    scc_switch_tree_body_gen_code(code,&tree,inst);
+    free(tree.cases);
+    free(tree.jmp);
+    free(tree.jmp_blk);
+    scc_loop_fix_code(code,start,code->len,-1);
+    return;
+  }
 
   while(cond) {
 
     // dup the switched value
-    c = scc_code_new(1);
-    c->data[0] = SCC_OP_DUP;
-    SCC_LIST_ADD(code,last,c);
+    scc_code_put_op(code,SCC_OP_DUP);
     // put the condition
-    SCC_LIST_ADD(code,last,cond_code);
+    scc_statement_gen_code(code,cond,1);
     // if
-    c = scc_code_new(4);
-    c->data[0] = SCC_OP_NEQ;
-    c->data[1] = SCC_OP_JNZ;
+    scc_code_put_op(code,SCC_OP_NEQ);
+    jnz = scc_code_put_jump(code,SCC_OP_JNZ);
+
+    // kill the switched value before entering the body
+    scc_code_put_op(code,SCC_OP_POP);
+
+    // the previous block jump here
+    if(jmp >= 0)
+      scc_code_set_jump(code,jmp,code->len);
 
     // there's a next condition, so we'll add a jump
     // instead of a real body
     if(cond->next) {
       add_jmp = 1;
-      SCC_SET_S16LE(c->data,2,1 /*kill*/ + 3 /*jmp*/);
-
+      cond = cond->next;
     } else { // that's the last condition so put the body
-#if 1
       // look if the last instruction is a break, if so spare the
       // useless jump.
-      // here and under we could probably stop at the first break found
-      for(i0 = i->body ; i0 && i0->next ; i0 = i0->next);
-      if(i0 && i0->type == SCC_INST_BRANCH && 
-	 i0->subtype == SCC_BRANCH_BREAK)
-	add_jmp = 0;
-      else
-#endif
-	add_jmp = 1;
-      
-      body_code = scc_instruct_gen_code(i->body);
-      
-      SCC_SET_S16LE(c->data,2,scc_code_size(body_code) + 1 + (add_jmp ? 3 : 0));
-    }
-    SCC_LIST_ADD(code,last,c);
-
-    // kill the switched value before entering the body
-    c = scc_code_new(1);
-    c->data[0] = SCC_OP_POP;
-    SCC_LIST_ADD(code,last,c);
+      add_jmp = scc_switch_last_break(i->body,NULL) ? 0 : 1;
 
-    if(!cond->next) {
-      // no next condition, add the body
-      SCC_LIST_ADD(code,last,body_code);
+      scc_instruct_gen_code(code,i->body);
 
       // find the next condition
       i = i->next;
@@ -1150,198 +1182,164 @@ static scc_code_t* scc_switch_gen_code(scc_instruct_t* inst) {
 	cond = i->cond;
       else
 	cond = NULL;
-    } else
-      cond = cond->next;
-
-    // generate the code for the next condition so we can get its size
-    if(cond) cond_code = scc_statement_gen_code(cond,1);
+    }
 
     // if needed add the jump to the next block
-    if(add_jmp) {
-      c = scc_code_new(3);
-      c->data[0] = SCC_OP_JMP;
-      SCC_SET_S16LE(c->data,1,1 + (cond ? scc_code_size(cond_code) + 4 + 1 : 0));
-      SCC_LIST_ADD(code,last,c);
-    }
+    jmp = add_jmp ? scc_code_put_jump(code,SCC_OP_JMP) : -1;
+    scc_code_set_jump(code,jnz,code->len);
+
     if(!cond && i) break;
   }
 
   // the "final" kill is not needed if we had no condition at all
-  if(inst->body->cond) {
-    c = scc_code_new(1);
-    c->data[0] = SCC_OP_POP;
-    SCC_LIST_ADD(code,last,c);
-  }
+  if(inst->body->cond)
+    scc_code_put_op(code,SCC_OP_POP);
+  if(jmp >= 0)
+    scc_code_set_jump(code,jmp,code->len);
 
   // default
-  if(i) {
-    scc_instruct_t* i1 = NULL;
-    for(i0 = i->body ; i0 && i0->next ; i1 = i0, i0 = i0->next);
-    if(i0 && i0->type == SCC_INST_BRANCH &&
-       i0->subtype == SCC_BRANCH_BREAK) {
-      if(i1)
-	i1->next = NULL;
-      else
-	i->body = NULL;
-      free(i0); // check me
-    }
-    
-    if(i->body) {
-      c = scc_instruct_gen_code(i->body);
-      SCC_LIST_ADD(code,last,c);
-    }
-  }
-  
-  scc_loop_fix_code(code,scc_code_size(code),-1);
-
+  if(i)
+    scc_switch_default_gen_code(code,i);
 
-  return code;
+  scc_loop_fix_code(code,start,code->len,-1);
 }
 
-static scc_code_t* scc_cutscene_gen_code(scc_instruct_t* inst) {
-    scc_code_t *code=NULL,*last=NULL,*c;
+static void scc_cutscene_gen_code(scc_code_t* code, scc_instruct_t* inst) {
     scc_statement_t* st;
     int n;
 
     // generate the argument list
     for(st = inst->cond, n=0 ; st ; st = st->next) {
-        c = scc_statement_gen_code(st,1);
-        SCC_LIST_ADD(code,last,c);
+        scc_statement_gen_code(code,st,1);
         n++;
     }
     // push the number of element
-    c = scc_code_push_val(SCC_OP_PUSH,n);
-    SCC_LIST_ADD(code,last,c);
+    scc_code_push_val(code,SCC_OP_PUSH,n);
     // put the cutscene begin op code
-    c = scc_code_new(1);
-    c->data[0] = SCC_OP_CUTSCENE_BEGIN;
-    SCC_LIST_ADD(code,last,c);
+    scc_code_put_op(code,SCC_OP_CUTSCENE_BEGIN);
     // add the body code
-    c = scc_instruct_gen_code(inst->body);
-    SCC_LIST_ADD(code,last,c);
+    scc_instruct_gen_code(code,inst->body);
     // put the cutscene end op code
-    c = scc_code_new(1);
-    c->data[0] = SCC_OP_CUTSCENE_END;
-    SCC_LIST_ADD(code,last,c);
-
-    return code;
+    scc_code_put_op(code,SCC_OP_CUTSCENE_END);
 }
 
-static scc_code_t* scc_override_gen_code(scc_instruct_t* inst) {
-  scc_code_t *code=NULL,*last=NULL,*c;
-  scc_code_t *try;
-  int try_size;
-
-  // generate the code in the try block
-  try = scc_instruct_gen_code(inst->body);
-  try_size = scc_code_size(try);
+static void scc_override_gen_code(scc_code_t* code, scc_instruct_t* inst) {
+  int jmp;
 
   // make the override op
-  c = scc_code_new(4);
-  c->data[0] = SCC_OP_OVERRIDE_BEGIN;
-  c->data[1] = SCC_OP_JMP;
-  SCC_SET_S16LE(c->data,2,try_size);
-  SCC_LIST_ADD(code,last,c);
+  scc_code_put_op(code,SCC_OP_OVERRIDE_BEGIN);
+  jmp = scc_code_put_jump(code,SCC_OP_JMP);
 
   // append the try code
-  SCC_LIST_ADD(code,last,try);
+  scc_instruct_gen_code(code,inst->body);
+  scc_code_set_jump(code,jmp,code->len);
 
   // then the override block
-  c = scc_instruct_gen_code(inst->body2);
-  SCC_LIST_ADD(code,last,c);
+  scc_instruct_gen_code(code,inst->body2);
 
   // end the block
-  c = scc_code_new(1);
-  c->data[0] = SCC_OP_OVERRIDE_END;
-  SCC_LIST_ADD(code,last,c);
-
-  return code;
+  scc_code_put_op(code,SCC_OP_OVERRIDE_END);
 }
 
-static scc_code_t* scc_instruct_gen_code(scc_instruct_t* inst) {
-  scc_code_t *code=NULL,*last=NULL,*c;
+static void scc_instruct_gen_code(scc_code_t* code, scc_instruct_t* inst) {
 
   for( ; inst ; inst = inst->next ) {
     switch(inst->type) {
     case SCC_INST_ST:
-      c = scc_statement_gen_code(inst->pre,0);
+      scc_statement_gen_code(code,inst->pre,0);
       break;
     case SCC_INST_IF:
-      c = scc_if_gen_code(inst);
+      scc_if_gen_code(code,inst);
       break;
     case SCC_INST_FOR:
-      c = scc_for_gen_code(inst);
+      scc_for_gen_code(code,inst);
       break;
     case SCC_INST_WHILE:
-      c = scc_while_gen_code(inst);
+      scc_while_gen_code(code,inst);
       break;
     case SCC_INST_DO:
-      c = scc_do_gen_code(inst);
+      scc_do_gen_code(code,inst);
       break;
     case SCC_INST_BRANCH:
-      c = scc_branch_gen_code(inst);
+      scc_branch_gen_code(code,inst);
       break;
     case SCC_INST_SWITCH:
-      c = scc_switch_gen_code(inst);
+      scc_switch_gen_code(code,inst);
       break;
     case SCC_INST_CUTSCENE:
-      c = scc_cutscene_gen_code(inst);
+      scc_cutscene_gen_code(code,inst);
       break;
     case SCC_INST_OVERRIDE:
-      c = scc_override_gen_code(inst);
+      scc_override_gen_code(code,inst);
       break;
     default:
       scc_log(LOG_ERR,"Unsupported instruction type: %d\n",inst->type);
-      c = NULL;
     }
-    SCC_LIST_ADD(code,last,c);
   }
-
-  return code;
 }
 
-scc_script_t* scc_script_new(scc_ns_t* ns, scc_instruct_t* inst,
+scc_script_t* scc_script_new(scc_ns_t* ns, scc_symbol_t* sym,
+                             scc_instruct_t* inst,
                              uint8_t return_op,char close_scr) {
-  scc_code_t* code = scc_instruct_gen_code(inst);
+  scc_code_t* code = scc_code_new();
+  scc_code_stat_t before,after;
+  scc_code_fix_t* f;
   scc_sym_fix_t* rf = NULL, *rf_last = NULL, *r;
-  scc_symbol_t* sym;
-  int p,l;
-  uint8_t* data;
+  scc_symbol_t* res;
   scc_script_t* scr;
-  
-  if(!code) return NULL;
+  uint16_t rid;
+  int i;
+
+  scc_instruct_gen_code(code,inst);
+  if(!code->len) {
+    scc_code_free(code);
+    return NULL;
+  }
+
+  if(close_scr) scc_code_put_op(code,return_op);
 
-  l = scc_code_size(code) + (close_scr ? 1 : 0);
-  data = malloc(l);
+  for(i = 0 ; i < code->num_fix ; i++)
+    if(code->fix[i].type == SCC_FIX_RETURN)
+      code->data[code->fix[i].off] = return_op;
+
+  if(scc_code_opt_level > 0 &&
+     scc_code_optimize(code,return_op,&before,&after)) {
+    // verbs are named after their object
+    if(!sym || sym->type == SCC_RES_VERB)
+      scc_log(LOG_V,"%s::%s: %d -> %d bytes, ~%d -> ~%d ops\n",
+              ns->cur ? ns->cur->sym : "?",sym ? sym->sym : "default",
+              before.size,after.size,before.ops,after.ops);
+    else
+      scc_log(LOG_V,"%s: %d -> %d bytes, ~%d -> ~%d ops\n",sym->sym,
+              before.size,after.size,before.ops,after.ops);
+  }
 
-  for(p = 0 ; code ; p+= code->len, code = code->next) {
-    memcpy(&data[p],code->data,code->len);
-    if(code->fix == SCC_FIX_RETURN) {
-      data[p] = return_op;
+  // Collect the resource relocations for the linker
+  for(i = 0 ; i < code->num_fix ; i++) {
+    f = &code->fix[i];
+    if(f->type < SCC_FIX_RES) continue;
+    rid = SCC_GET_16LE(code->data,f->off);
+    res = scc_ns_get_sym_with_id(ns,f->type - SCC_FIX_RES,rid);
+    if(!res) {
+      scc_log(LOG_ERR,"Unable to find resource %d of type %d\n",
+              rid,f->type - SCC_FIX_RES);
       continue;
     }
-    if(code->fix >= SCC_FIX_RES) {
-      uint16_t rid = SCC_GET_16LE(data,p);
-      sym = scc_ns_get_sym_with_id(ns,code->fix - SCC_FIX_RES,rid);
-      if(!sym) {
-	scc_log(LOG_ERR,"Unable to find resource %d of type %d\n",
-                rid,code->fix - SCC_FIX_RES);
-	continue;
-      }
-      r = calloc(1,sizeof(scc_sym_fix_t));
-      r->off = p;
-      r->sym = sym;
-      SCC_LIST_ADD(rf,rf_last,r);
-    }
+    r = calloc(1,sizeof(scc_sym_fix_t));
+    r->off = f->off;
+    r->sym = res;
+    SCC_LIST_ADD(rf,rf_last,r);
   }
 
-  if(close_scr) data[l-1] = return_op;
-
   scr = calloc(1,sizeof(scc_script_t));
-  scr->code = data;
-  scr->code_len = l;
+  scr->sym = sym;
+  scr->code = realloc(code->data,code->len);
+  scr->code_len = code->len;
   scr->sym_fix = rf;
 
+  code->data = NULL;
+  scc_code_free(code);
+
   return scr;
 }
 
@@ -48,14 +48,36 @@ scc_loop_t* scc_loop_get(int type,char* sym);
 /// @name Code blocks
 //@(
 
-/// Create a new code block
-scc_code_t* scc_code_new(int len);
+/// Create a new empty code buffer
+scc_code_t* scc_code_new(void);
 
-/// Destroy a code block
+/// Destroy a code buffer
 void scc_code_free(scc_code_t* c);
 
-/// Destroy a code block list
-void scc_code_free_all(scc_code_t* c);
+//@}
+
+/// @name Optimizer
+//@{
+
+/// Run the optimizer on the generated scripts
+extern int scc_code_opt_level;
+
+/// Code statistics
+typedef struct scc_code_stat {
+  /// Size in bytes
+  int size;
+  /// Estimated number of ops executed
+  int ops;
+} scc_code_stat_t;
+
+/// @brief            Run the peephole optimizer on a code buffer.
+/// @param code       The code, with all its jumps resolved
+/// @param return_op  The op code used for return
+/// @param before     Filled with the stats before optimization or NULL
+/// @param after      Filled with the stats after optimization or NULL
+/// @return           0 if the code couldn't be optimized
+int scc_code_optimize(scc_code_t* code, uint8_t return_op,
+                      scc_code_stat_t* before, scc_code_stat_t* after);
 
 //@}
 
@@ -64,10 +86,12 @@ void scc_code_free_all(scc_code_t* c);
 
 /// @brief            Generate a script from a parse tree.
 /// @param ns         Namespace to use
+/// @param sym        Symbol of the script, or verb symbol for verbs
 /// @param inst       The parse tree
 /// @param return_op  The op code to use for return
 /// @param close_scr  If true add a return at the end of the script.
-scc_script_t* scc_script_new(scc_ns_t* ns, scc_instruct_t* inst,
+scc_script_t* scc_script_new(scc_ns_t* ns, scc_symbol_t* sym,
+                             scc_instruct_t* inst,
                              uint8_t return_op,char close_scr);
 
 /// Destroy a script
@@ -340,6 +340,26 @@ scc_cost_pic_t* scc_cost_get_limb_pic(scc_cost_t* cost,uint8_t limb,
   return NULL;
 }
 
+void scc_cost_free(scc_cost_t* cost) {
+  scc_cost_pic_t* pic;
+  scc_cost_anim_t* anim;
+  int i;
+
+  for(i = 0 ; i < 16 ; i++)
+    while((pic = cost->limb_pic[i])) {
+      cost->limb_pic[i] = pic->next;
+      free(pic->data);
+      free(pic);
+    }
+  while((anim = cost->anims)) {
+    cost->anims = anim->next;
+    free(anim);
+  }
+  free(cost->pal);
+  free(cost->cmds);
+  free(cost);
+}
+
 scc_cost_t* scc_parse_cost(scc_fd_t* fd,int len) {
   uint8_t num_anim;
   uint16_t cmds_off,mask,cmask = 0;
@@ -670,12 +690,156 @@ int scc_cost_dec_bbox(scc_cost_dec_t* dec,int* x1p,int* y1p,
   return 1;
 }
 
+// Area covered by scc_cost_dec_frame() around the actor position
+int scc_cost_dec_frame_bbox(scc_cost_dec_t* dec,
+                            int x_scale, int y_scale,
+                            int* x1p,int* y1p,
+                            int* x2p,int* y2p) {
+  int x1 = 34000, y1 = 34000, x2 = -34000, y2 = -34000;
+  int i,n = 0,rel_x,rel_y,width,height,flip;
+  scc_cost_pic_t* pic;
+  uint8_t cmd;
+
+  if(!dec->anim)
+    return 0;
+
+  flip = (!(dec->cost->format & 0x80)) && (!(dec->anim_id&3));
+
+  for(i = 0 ; i < 16 ; i++) {
+    if(dec->pc[i] == 0xFFFF || dec->stopped & (1<<i) ||
+       dec->pc[i] >= dec->cost->cmds_size) continue;
+    cmd = dec->cost->cmds[dec->pc[i]];
+    if(cmd > 0x70) continue;
+
+    pic = scc_cost_get_limb_pic(dec->cost,i,cmd,4);
+    if(!pic || !pic->data) continue;
+
+    rel_x = pic->rel_x*x_scale/255;
+    rel_y = pic->rel_y*y_scale/255;
+    width = pic->width*x_scale/255;
+    height = pic->height*y_scale/255;
+    if(flip) rel_x = -width-rel_x;
+    n++;
+
+    if(rel_x < x1) x1 = rel_x;
+    if(rel_y < y1) y1 = rel_y;
+    if(rel_x+width > x2) x2 = rel_x+width;
+    if(rel_y+height > y2) y2 = rel_y+height;
+  }
+
+  if(!n) return 0;
+
+  *x1p = x1;
+  *x2p = x2;
+  *y1p = y1;
+  *y2p = y2;
+
+  return 1;
+}
+
+void scc_cost_cache_init(scc_cost_cache_t* cache, unsigned max_size) {
+  memset(cache,0,sizeof(scc_cost_cache_t));
+  cache->max_size = max_size;
+}
+
+static void scc_cost_cache_remove(scc_cost_cache_t* cache,
+                                  scc_cost_cache_entry_t* e) {
+  scc_cost_cache_entry_t** h;
+  unsigned hash = (e->cost_id*16 + e->limb + e->pic*7) %
+    SCC_COST_CACHE_HASH_SIZE;
+
+  for(h = &cache->hash[hash] ; *h != e ; h = &(*h)->hash_next);
+  *h = e->hash_next;
+
+  if(e->prev) e->prev->next = e->next;
+  else cache->first = e->next;
+  if(e->next) e->next->prev = e->prev;
+  else cache->last = e->prev;
+
+  cache->size -= sizeof(scc_cost_cache_entry_t) + e->width*e->height;
+  free(e);
+}
+
+void scc_cost_cache_clear(scc_cost_cache_t* cache) {
+  while(cache->first)
+    scc_cost_cache_remove(cache,cache->first);
+}
+
+// Get a decoded picture from the cache, decode it if needed.
+// NULL is returned if the picture doesn't fit in the cache.
+static scc_cost_cache_entry_t* scc_cost_cache_get(scc_cost_cache_t* cache,
+                                                  scc_cost_t* cost,
+                                                  uint8_t limb, uint8_t id,
+                                                  scc_cost_pic_t* pic,
+                                                  int width, int height,
+                                                  uint8_t trans,
+                                                  int x_scale, int y_scale,
+                                                  int flip) {
+  scc_cost_cache_entry_t* e;
+  unsigned hash = (cost->id*16 + limb + id*7) % SCC_COST_CACHE_HASH_SIZE;
+  unsigned size = sizeof(scc_cost_cache_entry_t) + width*height;
+
+  for(e = cache->hash[hash] ; e ; e = e->hash_next)
+    if(e->cost_id == cost->id && e->limb == limb && e->pic == id &&
+       e->x_scale == x_scale && e->y_scale == y_scale && e->flip == flip)
+      break;
+
+  if(e) {
+    cache->hits++;
+    // move it to the head of the LRU list
+    if(e->prev) {
+      e->prev->next = e->next;
+      if(e->next) e->next->prev = e->prev;
+      else cache->last = e->prev;
+      e->prev = NULL;
+      e->next = cache->first;
+      cache->first->prev = e;
+      cache->first = e;
+    }
+    return e;
+  }
+
+  cache->misses++;
+  if(size > cache->max_size) return NULL;
+
+  while(cache->size + size > cache->max_size)
+    scc_cost_cache_remove(cache,cache->last);
+
+  e = malloc(size);
+  e->cost_id = cost->id;
+  e->limb = limb;
+  e->pic = id;
+  e->flip = flip;
+  e->x_scale = x_scale;
+  e->y_scale = y_scale;
+  e->width = width;
+  e->height = height;
+
+  // Everything that is not drawn stays transparent
+  memset(e->data,trans,width*height);
+  scc_cost_decode_pic(cost,pic,e->data,width,NULL,0,
+                      0,width,0,height,trans,x_scale,y_scale,flip);
+
+  e->hash_next = cache->hash[hash];
+  cache->hash[hash] = e;
+  e->prev = NULL;
+  e->next = cache->first;
+  if(cache->first) cache->first->prev = e;
+  else cache->last = e;
+  cache->first = e;
+  cache->size += size;
+
+  return e;
+}
+
 int scc_cost_dec_frame(scc_cost_dec_t* dec,uint8_t* dst,
 		       int x, int y,
 		       int dst_width, int dst_height,
 		       int dst_stride,
                        uint8_t* mask, int mask_stride,
-                       int x_scale, int y_scale) {
+                       int x_scale, int y_scale,
+                       scc_cost_cache_t* cache) {
+  scc_cost_cache_entry_t* e;
   int i,l,c,l_max,c_max,rel_x,rel_y,width,height,flip;
   scc_cost_pic_t* pic;
   uint8_t cmd,trans = dec->cost->pal[0];
@@ -721,7 +885,21 @@ int scc_cost_dec_frame(scc_cost_dec_t* dec,uint8_t* dst,
 
     if(c_max < 0 || l_max < 0) continue;
 
-    
+    if(cache && width > 0 && height > 0 &&
+       (e = scc_cost_cache_get(cache,dec->cost,i,cmd,pic,width,height,
+                               trans,x_scale,y_scale,flip))) {
+      int xx,yy;
+      for(yy = l ; yy < l_max ; yy++) {
+        uint8_t* src = e->data + yy*width;
+        uint8_t* d = &dst[dst_stride*(y+rel_y+yy)+x+rel_x];
+        uint8_t* m = mask ? &mask[mask_stride*(y+rel_y+yy)+x+rel_x] : NULL;
+        for(xx = c ; xx < c_max ; xx++)
+          if(src[xx] != trans && (!m || !m[xx]))
+            d[xx] = src[xx];
+      }
+      continue;
+    }
+
     scc_cost_decode_pic(dec->cost,pic,
 			&dst[dst_stride*(y+rel_y)+x+rel_x],
 			dst_stride,
@@ -97,6 +97,35 @@ typedef struct scc_cost_dec {
   unsigned anim_counter;
 } scc_cost_dec_t;
 
+#define SCC_COST_CACHE_HASH_SIZE 256
+
+/// A decoded (scaled and flipped) limb picture, the pixels
+/// using the transparent color are not drawn.
+typedef struct scc_cost_cache_entry scc_cost_cache_entry_t;
+struct scc_cost_cache_entry {
+  scc_cost_cache_entry_t *hash_next;
+  // LRU list, the head is the most recently used
+  scc_cost_cache_entry_t *prev,*next;
+
+  unsigned cost_id;
+  uint8_t limb,pic;
+  uint8_t flip;
+  int x_scale,y_scale;
+
+  int width,height;
+  uint8_t data[0];
+};
+
+/// Bounded cache of decoded limb pictures.
+/// The costumes are identified by their id, so it can only be used
+/// with costumes that have a unique id.
+typedef struct scc_cost_cache {
+  unsigned size, max_size;
+  unsigned hits, misses;
+  scc_cost_cache_entry_t *first,*last;
+  scc_cost_cache_entry_t *hash[SCC_COST_CACHE_HASH_SIZE];
+} scc_cost_cache_t;
+
 
 scc_cost_anim_t* scc_cost_new_anim(scc_cost_t* cost,uint8_t id);
 
@@ -118,6 +147,8 @@ scc_cost_pic_t* scc_cost_get_limb_pic(scc_cost_t* cost,uint8_t limb,
 
 scc_cost_t* scc_parse_cost(scc_fd_t* fd,int len);
 
+void scc_cost_free(scc_cost_t* cost);
+
 void scc_cost_dec_init(scc_cost_dec_t* dec);
 
 int scc_cost_dec_load_anim(scc_cost_dec_t* dec,uint16_t aid);
@@ -127,9 +158,19 @@ int scc_cost_dec_step(scc_cost_dec_t* dec);
 int scc_cost_dec_bbox(scc_cost_dec_t* dec,int* x1p,int* y1p,
 		      int* x2p,int* y2p);
 
+int scc_cost_dec_frame_bbox(scc_cost_dec_t* dec,
+                            int x_scale, int y_scale,
+                            int* x1p,int* y1p,
+                            int* x2p,int* y2p);
+
 int scc_cost_dec_frame(scc_cost_dec_t* dec,uint8_t* dst,
 		       int x, int y,
 		       int dst_width, int dst_height,
 		       int dst_stride,
 		       uint8_t* mask, int mask_stride,
-		       int x_scale, int y_scale);
+		       int x_scale, int y_scale,
+		       scc_cost_cache_t* cache);
+
+void scc_cost_cache_init(scc_cost_cache_t* cache, unsigned max_size);
+
+void scc_cost_cache_clear(scc_cost_cache_t* cache);
@@ -36,6 +36,17 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdarg.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_WRITEV
+#include <sys/uio.h>
+#else
+struct iovec {
+  void* iov_base;
+  size_t iov_len;
+};
+#endif
 
 #include "scc_fd.h"
 #include "scc_util.h"
@@ -54,33 +65,222 @@ scc_fd_t* new_scc_fd(char* path,int flags,uint8_t key) {
   else
     fd = open(path,flags);
   if(fd < 0) return NULL;
-  scc_fd = malloc(sizeof(scc_fd_t));
+  scc_fd = calloc(1,sizeof(scc_fd_t));
   scc_fd->fd = fd;
   scc_fd->enckey = key;
   scc_fd->filename = strdup(path);
+  // Only buffer the read only files, that avoid any trouble
+  // with mixed read and writes.
+  if(!(flags & (O_WRONLY|O_RDWR)))
+    scc_fd->buf = malloc(SCC_FD_BUF_SIZE);
+  else
+    scc_fd->wbuf = malloc(SCC_FD_BUF_SIZE);
 
   return scc_fd;
 }
 
+// Write all the vectors, return 0 on success
+static int scc_fd_raw_writev(scc_fd_t* f, struct iovec* iov, int num) {
+  ssize_t w;
+
+  while(num > 0) {
+#ifdef HAVE_WRITEV
+    w = writev(f->fd,iov,num);
+#else
+    w = write(f->fd,iov->iov_base,iov->iov_len);
+#endif
+    if(w < 0) {
+      if(errno == EINTR) continue;
+      return -1;
+    }
+    f->pos += w;
+    while(num > 0 && w >= iov->iov_len) {
+      w -= iov->iov_len;
+      iov++, num--;
+    }
+    if(num > 0) {
+      iov->iov_base = ((uint8_t*)iov->iov_base) + w;
+      iov->iov_len -= w;
+    }
+  }
+  return 0;
+}
+
+int scc_fd_flush(scc_fd_t* f) {
+  struct iovec iov;
+
+  if(!f->wbuf_len) return 0;
+  iov.iov_base = f->wbuf;
+  iov.iov_len = f->wbuf_len;
+  f->wbuf_len = 0;
+  return scc_fd_raw_writev(f,&iov,1);
+}
+
 int scc_fd_close(scc_fd_t* f) {
+  int w = scc_fd_flush(f);
   int r = close(f->fd);
+  if(w < 0) {
+    scc_log(LOG_ERR,"Failed to write %s: %s\n",f->filename,strerror(errno));
+    r = w;
+  }
+  free(f->wbuf);
+#ifdef HAVE_MMAP
+  if(f->map) {
+    munmap(f->map,f->map_size);
+    free(f->map_decoded);
+  } else
+#endif
+  free(f->buf);
   free(f->filename);
   free(f);
   return r;
 }
 
-int scc_fd_read(scc_fd_t* f,void *buf, size_t count) {
-  if(count <= 0) return 0;
-  count = read(f->fd,buf,count);
-  if(count <= 0) return count;
-  else {
-    uint8_t* ptr = ((uint8_t*)buf) + count;
+#ifdef HAVE_MMAP
+int scc_fd_map(scc_fd_t* f) {
+  struct stat st;
+  off_t pos;
+  void* map;
+
+  if(f->map) return 1;
+  // only for the read only files
+  if(!f->buf) return 0;
+  if(fstat(f->fd,&st) || st.st_size <= 0) return 0;
+
+  // encoded files get a private mapping to decode in place
+  map = mmap(NULL,st.st_size,f->enckey ? PROT_READ|PROT_WRITE : PROT_READ,
+             MAP_PRIVATE,f->fd,0);
+  if(map == MAP_FAILED) {
+    scc_log(LOG_DBG,"Failed to map %s: %s\n",f->filename,strerror(errno));
+    return 0;
+  }
+  if(f->enckey)
+    f->map_decoded = calloc((st.st_size+SCC_FD_BUF_SIZE-1)/SCC_FD_BUF_SIZE,1);
+
+  pos = scc_fd_pos(f);
+  free(f->buf);
+  f->map = map;
+  f->map_size = st.st_size;
+  f->buf = f->map;
+  f->buf_len = f->buf_pos = f->pos = 0;
+  scc_fd_seek(f,pos,SEEK_SET);
+  return 1;
+}
+
+static void scc_fd_map_decode(scc_fd_t* f, size_t start, size_t size) {
+  unsigned chunk = start/SCC_FD_BUF_SIZE;
+  unsigned last = (start+size+SCC_FD_BUF_SIZE-1)/SCC_FD_BUF_SIZE;
+
+  if(!f->map_decoded) return;
+
+  for( ; chunk < last ; chunk++) {
+    uint8_t *ptr, *end;
+    if(f->map_decoded[chunk]) continue;
+    ptr = f->map + chunk*SCC_FD_BUF_SIZE;
+    end = ptr + SCC_FD_BUF_SIZE;
+    if(end > f->map + f->map_size) end = f->map + f->map_size;
+    for( ; ptr < end ; ptr++)
+      *ptr ^= f->enckey;
+    f->map_decoded[chunk] = 1;
+  }
+}
+
+// Move the buffer window forward in the mapping
+static int scc_fd_map_fill(scc_fd_t* f) {
+  size_t end;
+
+  if(f->pos >= f->map_size) return 0;
+  if(f->map_decoded) {
+    end = (f->pos/SCC_FD_BUF_SIZE+1)*SCC_FD_BUF_SIZE;
+    if(end > f->map_size) end = f->map_size;
+    scc_fd_map_decode(f,f->pos,end-f->pos);
+  } else
+    end = f->map_size;
+
+  f->buf = f->map + f->pos;
+  f->buf_len = end - f->pos;
+  f->buf_pos = 0;
+  f->pos = end;
+  return f->buf_len;
+}
+
+uint8_t* scc_fd_view(scc_fd_t* f, size_t size) {
+  off_t start;
+
+  if(!f->map) return NULL;
+  start = scc_fd_pos(f);
+  if(start + size > f->map_size) return NULL;
+  scc_fd_map_decode(f,start,size);
+  scc_fd_seek(f,start+size,SEEK_SET);
+  return f->map + start;
+}
+#else
+int scc_fd_map(scc_fd_t* f) {
+  return 0;
+}
+
+uint8_t* scc_fd_view(scc_fd_t* f, size_t size) {
+  return NULL;
+}
+#endif
+
+static int scc_fd_raw_read(scc_fd_t* f,void *buf, size_t count) {
+  int r;
+  if(scc_fd_flush(f) < 0) return -1;
+  r = read(f->fd,buf,count);
+  // the read buffer keep track of the position itself
+  if(r > 0 && f->wbuf) f->pos += r;
+  if(r > 0 && f->enckey) {
+    uint8_t* ptr = ((uint8_t*)buf) + r;
     do {
       ptr--;
       *ptr ^= f->enckey;
     } while(ptr != buf);
   }
-  return count;
+  return r;
+}
+
+static int scc_fd_fill(scc_fd_t* f) {
+  int r;
+#ifdef HAVE_MMAP
+  if(f->map) return scc_fd_map_fill(f);
+#endif
+  r = scc_fd_raw_read(f,f->buf,SCC_FD_BUF_SIZE);
+  if(r <= 0) return r;
+  f->pos += r;
+  f->buf_len = r;
+  f->buf_pos = 0;
+  return r;
+}
+
+int scc_fd_read(scc_fd_t* f,void *buf, size_t count) {
+  uint8_t* dst = buf;
+  int r = 0, done = 0, len;
+
+  if(count <= 0) return 0;
+  if(!f->buf) return scc_fd_raw_read(f,buf,count);
+
+  while(done < count) {
+    if(f->buf_pos >= f->buf_len) {
+      // Big reads go directly to the destination
+      if(!f->map && count - done >= SCC_FD_BUF_SIZE) {
+        r = scc_fd_raw_read(f,dst+done,count-done);
+        if(r <= 0) break;
+        f->pos += r;
+        f->buf_len = f->buf_pos = 0;
+        done += r;
+        continue;
+      }
+      if((r = scc_fd_fill(f)) <= 0) break;
+    }
+    len = f->buf_len - f->buf_pos;
+    if(len > count - done) len = count - done;
+    memcpy(dst+done,f->buf+f->buf_pos,len);
+    f->buf_pos += len;
+    done += len;
+  }
+
+  return done > 0 ? done : r;
 }
 
 uint8_t* scc_fd_load(scc_fd_t* f,size_t count) {
@@ -132,15 +332,55 @@ int scc_fd_dump(scc_fd_t* f,char* path,int size) {
 }
 
 off_t scc_fd_seek(scc_fd_t* f, off_t offset, int whence) {
-  return lseek(f->fd,offset,whence);
+  off_t start;
+
+  if(!f->buf) {
+    if(scc_fd_flush(f) < 0) return -1;
+    offset = lseek(f->fd,offset,whence);
+    if(offset >= 0) f->pos = offset;
+    return offset;
+  }
+
+  if(whence == SEEK_CUR) {
+    offset += scc_fd_pos(f);
+    whence = SEEK_SET;
+  }
+  // Stay in the buffer if possible
+  start = f->pos - f->buf_len;
+  if(whence == SEEK_SET && offset >= start && offset <= f->pos) {
+    f->buf_pos = offset - start;
+    return offset;
+  }
+
+  // With a mapping just restart the window at the new position
+  if(f->map) {
+    if(whence == SEEK_END) offset += f->map_size;
+    if(offset < 0 || offset > f->map_size) {
+      errno = EINVAL;
+      return -1;
+    }
+    f->buf = f->map + offset;
+    f->buf_len = f->buf_pos = 0;
+    f->pos = offset;
+    return offset;
+  }
+
+  offset = lseek(f->fd,offset,whence);
+  if(offset < 0) return offset;
+  f->pos = offset;
+  f->buf_len = f->buf_pos = 0;
+  return offset;
 }
 
 off_t scc_fd_pos(scc_fd_t* f) {
-  return lseek(f->fd,0,SEEK_CUR);
+  if(!f->buf) return f->pos + f->wbuf_len;
+  return f->pos - f->buf_len + f->buf_pos;
 }
 
 uint8_t scc_fd_r8(scc_fd_t* f) {
   uint8_t r = 0;
+  if(f->buf_pos < f->buf_len)
+    return f->buf[f->buf_pos++];
   scc_fd_read(f,&r,1);
   return r;
 }
@@ -170,17 +410,90 @@ uint32_t scc_fd_r32be(scc_fd_t* f) {
 }
 
 int scc_fd_write(scc_fd_t* f,void *buf, size_t count) {
-  int w;
-  uint8_t tmp[count];
   uint8_t* ptr = buf;
+  size_t done = 0;
+  unsigned len, i;
 
-  for(w = 0 ; w < count ; w++)
-    tmp[w] = ptr[w] ^ f->enckey;
+  if(!f->wbuf) {
+    errno = EBADF;
+    return -1;
+  }
 
-  return write(f->fd,tmp,count);
+  // Big unencoded payloads are written along with the buffer
+  if(!f->enckey && f->wbuf_len + count > SCC_FD_BUF_SIZE &&
+     count >= SCC_FD_BUF_SIZE/2) {
+    struct iovec iov[2];
+    iov[0].iov_base = f->wbuf;
+    iov[0].iov_len = f->wbuf_len;
+    iov[1].iov_base = buf;
+    iov[1].iov_len = count;
+    f->wbuf_len = 0;
+    return scc_fd_raw_writev(f,iov,2) < 0 ? -1 : count;
+  }
+
+  // Otherwise encode into the buffer and flush it when it is full
+  while(done < count) {
+    if(f->wbuf_len >= SCC_FD_BUF_SIZE &&
+       scc_fd_flush(f) < 0) return -1;
+    len = SCC_FD_BUF_SIZE - f->wbuf_len;
+    if(len > count - done) len = count - done;
+    for(i = 0 ; i < len ; i++)
+      f->wbuf[f->wbuf_len+i] = ptr[done+i] ^ f->enckey;
+    f->wbuf_len += len;
+    done += len;
+  }
+
+  return count;
+}
+
+int scc_fd_pwrite(scc_fd_t* f,void *buf, size_t count, off_t offset) {
+  uint8_t tmp[256];
+  uint8_t* ptr = buf;
+  size_t done = 0;
+  unsigned len, i;
+
+  if(!f->wbuf) {
+    errno = EBADF;
+    return -1;
+  }
+
+  // Patch the buffer if the data hasn't been written out yet
+  if(offset >= f->pos && offset + count <= f->pos + f->wbuf_len) {
+    for(i = 0 ; i < count ; i++)
+      f->wbuf[offset - f->pos + i] = ptr[i] ^ f->enckey;
+    return count;
+  }
+
+  if(scc_fd_flush(f) < 0) return -1;
+
+  while(done < count) {
+    len = count - done;
+    if(len > sizeof(tmp)) len = sizeof(tmp);
+    for(i = 0 ; i < len ; i++)
+      tmp[i] = ptr[done+i] ^ f->enckey;
+#ifdef HAVE_PWRITE
+    if(pwrite(f->fd,tmp,len,offset+done) != len) return -1;
+#else
+    if(lseek(f->fd,offset+done,SEEK_SET) < 0 ||
+       write(f->fd,tmp,len) != len) {
+      lseek(f->fd,f->pos,SEEK_SET);
+      return -1;
+    }
+#endif
+    done += len;
+  }
+#ifndef HAVE_PWRITE
+  if(lseek(f->fd,f->pos,SEEK_SET) < 0) return -1;
+#endif
+
+  return count;
 }
 
 int scc_fd_w8(scc_fd_t*f,uint8_t a) {
+  if(f->wbuf && f->wbuf_len < SCC_FD_BUF_SIZE) {
+    f->wbuf[f->wbuf_len++] = a ^ f->enckey;
+    return 1;
+  }
   return scc_fd_write(f,&a,sizeof(a));
 }
 
@@ -24,16 +24,50 @@
  */
 
 
+/// Size of the read buffer used with read only files,
+/// and of the write buffer used with the writable files.
+#define SCC_FD_BUF_SIZE 8192
+
 typedef struct scc_fd {
   int fd;
   uint8_t enckey;
   char* filename;
+  // read buffer, only allocated for read only files.
+  // the data in it is already decoded.
+  uint8_t* buf;
+  unsigned buf_len, buf_pos;
+  // position of the underlying fd, that is the end of the buffer
+  off_t pos;
+  // memory mapped file, the buffer is then a window in the mapping
+  uint8_t* map;
+  size_t map_size;
+  // decoded flag for each SCC_FD_BUF_SIZE chunk of an encoded mapping
+  uint8_t* map_decoded;
+  // write buffer, only allocated for writable files.
+  // the data in it is already encoded and pos is then the
+  // position of the underlying fd, that is the start of the buffer.
+  uint8_t* wbuf;
+  unsigned wbuf_len;
 } scc_fd_t;
 
 scc_fd_t* new_scc_fd(char* path,int flags,uint8_t key);
 
+/// Flush the write buffer and close the file. The writes are only
+/// guaranteed to have reached the file when this returned 0.
 int scc_fd_close(scc_fd_t* f);
 
+/// Write out the content of the write buffer, return 0 on success.
+int scc_fd_flush(scc_fd_t* f);
+
+/// Map a read only file in memory, return 0 if it is not possible.
+/// The decoding is done lazily as the data get accessed.
+int scc_fd_map(scc_fd_t* f);
+
+/// Get a pointer to the next size bytes of a mapped file and skip them.
+/// Return NULL if the file is not mapped. The data stay valid until
+/// the file is closed.
+uint8_t* scc_fd_view(scc_fd_t* f, size_t size);
+
 int scc_fd_read(scc_fd_t* f,void *buf, size_t count);
 
 uint8_t* scc_fd_load(scc_fd_t* f,size_t count);
@@ -54,6 +88,10 @@ uint32_t scc_fd_r32be(scc_fd_t* f);
 
 int scc_fd_write(scc_fd_t* f,void *buf, size_t count);
 
+/// Write at the given position without moving the file position.
+/// Used to patch the data that has already been written.
+int scc_fd_pwrite(scc_fd_t* f,void *buf, size_t count, off_t offset);
+
 int scc_fd_w8(scc_fd_t*f,uint8_t a);
 
 int scc_fd_w16le(scc_fd_t*f,uint16_t a);
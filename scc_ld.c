@@ -36,6 +36,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "scc_fd.h"
 #include "scc_util.h"
 
@@ -62,12 +66,30 @@ struct scc_ld_block_st {
   int asis;
   /// Ressource address, used for scripts
   int addr;
+  /// Offset in the LFLF, set when the room is written
+  int offset;
+  /// Identical resource written in place of this one
+  scc_ld_block_t* dup;
+  /// Room containing the identical resource
+  int dup_room;
 
 
   int data_len;
   uint8_t data[0];
 };
 
+/// Object table entry, the tables are only filled once
+/// all the rooms have been patched.
+typedef struct scc_ld_obj_st scc_ld_obj_t;
+struct scc_ld_obj_st {
+  scc_ld_obj_t* next;
+
+  int addr;
+  uint8_t state;
+  uint8_t owner;
+  uint32_t class;
+};
+
 typedef struct scc_ld_room_st scc_ld_room_t;
 struct scc_ld_room_st {
   scc_ld_room_t* next;
@@ -85,6 +107,26 @@ struct scc_ld_room_st {
   scc_ld_block_t* snd;
   scc_ld_block_t* cost;
   scc_ld_block_t* chset;
+
+  /// Objects found while patching
+  scc_ld_obj_t* obj, *last_obj;
+  /// Set when the room has been successfully patched
+  int patched;
+
+  /// Hash of the room in the roobj, used for incremental links
+  uint64_t hash;
+  /// Set when the room is reused from the previous link
+  int unchanged;
+  /// Position and size of the LFLF in the data file
+  off_t offset;
+  unsigned size;
+};
+
+/// Unused space left in the data file by the incremental links
+typedef struct scc_ld_slot_st scc_ld_slot_t;
+struct scc_ld_slot_st {
+  scc_ld_slot_t* next;
+  unsigned offset, size;
 };
 
 typedef struct scc_ld_voice_st scc_ld_voice_t;
@@ -100,9 +142,22 @@ struct scc_ld_voice_st {
 };
 
 static scc_ld_room_t* scc_room = NULL;
+static int incremental = 0;
 static scc_ld_voice_t* scc_voice = NULL, *scc_last_voice = NULL;
 static unsigned scc_voice_off = 8;
 
+/// Initial value for scc_ld_hash()
+#define SCC_LD_HASH_INIT 14695981039346656037ULL
+
+// FNV-1a
+static uint64_t scc_ld_hash(uint64_t hash, const void* data, unsigned len) {
+  const uint8_t* ptr = data;
+  unsigned i;
+  for(i = 0 ; i < len ; i++)
+    hash = (hash ^ ptr[i]) * 1099511628211ULL;
+  return hash;
+}
+
 static int scc_fd_get_block(scc_fd_t* fd, int max_len,uint32_t* type) {
   int len;
 
@@ -123,6 +178,8 @@ static scc_ld_block_t* scc_fd_read_block(scc_fd_t* fd,uint32_t type, int len) {
   blk->type = type;
   blk->data_len = len;
   blk->asis = 0;
+  blk->offset = -1;
+  blk->dup = NULL;
   if(scc_fd_read(fd,blk->data,len) != len) {
     scc_log(LOG_ERR,"Error while reading block.\n");
     return NULL;
@@ -144,15 +201,39 @@ static int scc_ld_write_block(scc_ld_block_t* blk,scc_fd_t* fd) {
   return 1;
 }
 
-static int scc_ld_write_block_list(scc_ld_block_t* blk,scc_fd_t* fd) {
+// Write the header of a container with a dummy size,
+// scc_ld_close_block() patch the size once the content is written.
+static off_t scc_ld_open_block(uint32_t type, scc_fd_t* fd) {
+  off_t pos = scc_fd_pos(fd);
+  scc_fd_w32(fd,type);
+  scc_fd_w32be(fd,0);
+  return pos;
+}
+
+static int scc_ld_close_block(off_t pos, scc_fd_t* fd) {
+  uint8_t size[4];
+
+  SCC_SET_32BE(size,0,scc_fd_pos(fd) - pos);
+  if(scc_fd_pwrite(fd,size,4,pos+4) != 4) {
+    scc_log(LOG_ERR,"Error while writing block size.\n");
+    return 0;
+  }
+  return 1;
+}
+
+static int scc_ld_write_block_list(scc_ld_block_t* blk,scc_fd_t* fd,
+                                   off_t base) {
 
   while(blk) {
-    if(!blk->asis) {
-      scc_log(LOG_WARN,"Warning: skipping non-patched block %c%c%c%c.\n",
-              UNMKID(blk->type));
+    if(!blk->asis || blk->dup) {
+      if(!blk->dup)
+        scc_log(LOG_WARN,"Warning: skipping non-patched block %c%c%c%c.\n",
+                UNMKID(blk->type));
+      blk->offset = -1;
       blk = blk->next;
       continue;
     }
+    blk->offset = scc_fd_pos(fd) - base;
     if(!scc_ld_write_block(blk,fd)) return 0;
     blk = blk->next;
   }
@@ -178,6 +259,7 @@ void scc_ld_room_free(scc_ld_room_t* room) {
   scc_ld_block_list_free(room->scr);
   scc_ld_block_list_free(room->snd);
   scc_ld_block_list_free(room->cost);
+  SCC_LIST_FREE(room->obj,room->last_obj);
 
   free(room);
 }
@@ -237,7 +319,7 @@ int scc_ld_parse_sym_block(scc_fd_t* fd, scc_ld_room_t* room, int len) {
     sym = scc_ns_add_sym(room->ns,name,type,subtype,addr,status);
     if(!sym) return 0;
     // set its rid
-    sym->rid = rid;
+    scc_ns_set_sym_rid(room->ns,sym,rid);
     // the first exported room should be ourself.
     if(type == SCC_RES_ROOM && status == 'E') {
       if(room->sym) 
@@ -486,6 +568,17 @@ int scc_ld_load_roobj(char* path) {
     }
     ro = scc_ld_parse_room(fd,len);
     if(!ro) return 0;
+    // hash the raw room for the incremental links
+    if(incremental) {
+      uint8_t* data;
+      scc_fd_seek(fd,pos,SEEK_SET);
+      if(!(data = scc_fd_load(fd,len))) {
+        scc_log(LOG_ERR,"Failed to read %s.\n",path);
+        return 0;
+      }
+      ro->hash = scc_ld_hash(SCC_LD_HASH_INIT,data,len);
+      free(data);
+    }
     pos += len;
     ro->next = scc_room;
     scc_room = ro;
@@ -704,6 +797,7 @@ static scc_ld_block_t* scc_ld_obcd_patch(scc_ld_room_t* room,
   int nverb=0,verb_size=0,len,pos = 0,new_size,vbase,vpos,vn,i;
   scc_script_t* scr=NULL,*scr_last=NULL,*new_scr;
   scc_ld_block_t* new;
+  scc_ld_obj_t* obj;
   int cdhd_size = scc_ns->target->version == 7 ? 8 : 17;
 
   scc_log(LOG_DBG,"Patching obcd.\n");
@@ -721,8 +815,13 @@ static scc_ld_block_t* scc_ld_obcd_patch(scc_ld_room_t* room,
     return NULL;
   }
   addr = sym->addr;
+  // the object tables are shared by all the rooms,
+  // so only record the entry here
+  obj = calloc(1,sizeof(scc_ld_obj_t));
+  obj->addr = sym->addr;
+  SCC_LIST_ADD(room->obj,room->last_obj,obj);
   // initial state
-  obj_state[sym->addr] = blk->data[10];
+  obj->state = blk->data[10];
   // owner
   oid = SCC_GET_16LE(blk->data,11);
   if(oid) {
@@ -731,11 +830,9 @@ static scc_ld_block_t* scc_ld_obcd_patch(scc_ld_room_t* room,
       scc_log(LOG_ERR,"cdhd block contains an invalid owner id (0x%x)????\n",oid);
       return NULL;
     }
-    obj_owner[sym->addr] = osym->addr;
+    obj->owner = osym->addr;
   } else
-    obj_owner[sym->addr] = 0x0F;
-  // room
-  obj_room[sym->addr] = room->sym->addr;
+    obj->owner = 0x0F;
 
   for(i = 0 ; i < SCC_MAX_CLASS ; i++) {
     cid = SCC_GET_16LE(blk->data,8+2+1+2+2*i);
@@ -745,7 +842,7 @@ static scc_ld_block_t* scc_ld_obcd_patch(scc_ld_room_t* room,
       scc_log(LOG_ERR,"cdhd block contains an invalid class id (0x%x)????\n",cid);
       return NULL;
     }
-    obj_class[sym->addr] |= (1 << (csym->addr-1));
+    obj->class |= (1 << (csym->addr-1));
   }
   
   pos = size;
@@ -797,6 +894,7 @@ static scc_ld_block_t* scc_ld_obcd_patch(scc_ld_room_t* room,
   new->type = MKID('O','B','C','D');
   new->next = blk->next;
   new->asis = 1;
+  new->dup = NULL;
   new->data_len = new_size;
   
   // make the cdhd header
@@ -859,6 +957,7 @@ static scc_ld_block_t* scc_ld_ecd_patch(scc_ld_room_t* room,
   new = malloc(sizeof(scc_ld_block_t) + scr->code_len);
   new->type = type;
   new->asis = 1;
+  new->dup = NULL;
   new->next = blk->next;
   new->data_len = scr->code_len;
   memcpy(new->data,scr->code,scr->code_len);
@@ -881,6 +980,7 @@ static scc_ld_block_t* scc_ld_lscr_patch(scc_ld_room_t* room,
   new = malloc(sizeof(scc_ld_block_t) + id_size + scr->code_len);
   new->type = MKID('L','S','C','R');
   new->asis = 1;
+  new->dup = NULL;
   new->next = blk->next;
   new->data_len = scr->code_len+id_size;
   memcpy(new->data,blk->data,id_size);
@@ -911,6 +1011,7 @@ static scc_ld_block_t* scc_ld_scrp_patch(scc_ld_room_t* room,
   new = malloc(sizeof(scc_ld_block_t) + scr->code_len);
   new->type = MKID('S','C','R','P');
   new->asis = 1;
+  new->dup = NULL;
   new->addr = sym->addr;
   new->next = blk->next;
   new->data_len = scr->code_len;
@@ -1022,103 +1123,606 @@ int scc_ld_room_patch(scc_ld_room_t* room) {
   return 1;
 }
 
-static int scc_ld_block_list_size(scc_ld_block_t* blk) {
-  int size = 0;
+static void scc_ld_patch_room(scc_ld_room_t* room) {
+  if(room->patched) return;
+  scc_log(LOG_V,"Patching room %s\n",room->sym->sym);
+  room->patched = scc_ld_room_patch(room);
+}
 
-  for( ; blk ; blk = blk->next) {
-    if(!blk->asis) continue;
-    size += 8 + blk->data_len;
+#ifdef HAVE_PTHREAD
+typedef struct scc_ld_patch_queue {
+  pthread_mutex_t lock;
+  scc_ld_room_t* next;
+} scc_ld_patch_queue_t;
+
+static void* scc_ld_patch_thread(void* arg) {
+  scc_ld_patch_queue_t* queue = arg;
+  scc_ld_room_t* room;
+
+  while(1) {
+    pthread_mutex_lock(&queue->lock);
+    room = queue->next;
+    if(room) queue->next = room->next;
+    pthread_mutex_unlock(&queue->lock);
+    if(!room) return NULL;
+    scc_ld_patch_room(room);
   }
+}
+#endif
 
-  return size;
+// The rooms only read the global ns while they are patched, so they
+// can be patched in parallel. The object tables are then filled in
+// the room order to get the same result as a serial link.
+int scc_ld_patch_rooms(scc_ld_room_t* room, int jobs) {
+  scc_ld_obj_t* obj;
+  scc_ld_room_t* r;
+
+#ifdef HAVE_PTHREAD
+  if(jobs > 1) {
+    pthread_t* thread = malloc((jobs-1)*sizeof(pthread_t));
+    scc_ld_patch_queue_t queue;
+    int i, n = 0;
+
+    pthread_mutex_init(&queue.lock,NULL);
+    queue.next = room;
+    for(i = 0 ; i < jobs-1 ; i++) {
+      if(pthread_create(&thread[n],NULL,scc_ld_patch_thread,&queue)) {
+        scc_log(LOG_WARN,"Failed to create patching thread.\n");
+        break;
+      }
+      n++;
+    }
+    // the main thread works too
+    scc_ld_patch_thread(&queue);
+    for(i = 0 ; i < n ; i++)
+      pthread_join(thread[i],NULL);
+    pthread_mutex_destroy(&queue.lock);
+    free(thread);
+  } else
+#endif
+  for(r = room ; r ; r = r->next) {
+    scc_ld_patch_room(r);
+    if(!r->patched) return 0;
+  }
+
+  for(r = room ; r ; r = r->next) {
+    if(!r->patched) return 0;
+    for(obj = r->obj ; obj ; obj = obj->next) {
+      obj_state[obj->addr] = obj->state;
+      obj_owner[obj->addr] = obj->owner;
+      obj_room[obj->addr] = r->sym->addr;
+      obj_class[obj->addr] |= obj->class;
+    }
+  }
+  return 1;
 }
 
-int scc_ld_lflf_size(scc_ld_room_t* room) {
-  int size = 8; // ROOM
+// The block offsets recorded here are relative to the LFLF data,
+// that is what the resource index use.
+int scc_ld_write_lflf(scc_ld_room_t* room, scc_fd_t* fd) {
+  off_t lflf, rm;
 
-  size += scc_ld_block_list_size(room->room);
+  lflf = scc_ld_open_block(MKID('L','F','L','F'),fd);
+  room->offset = lflf;
 
-  size += scc_ld_block_list_size(room->scr);
+  rm = scc_ld_open_block(MKID('R','O','O','M'),fd);
+  if(!scc_ld_write_block_list(room->room,fd,lflf+8)) return 0;
+  if(!scc_ld_close_block(rm,fd)) return 0;
 
-  size += scc_ld_block_list_size(room->snd);
+  if(!scc_ld_write_block_list(room->scr,fd,lflf+8)) return 0;
 
-  size += scc_ld_block_list_size(room->cost);
+  if(!scc_ld_write_block_list(room->snd,fd,lflf+8)) return 0;
 
-  size += scc_ld_block_list_size(room->chset);
+  if(!scc_ld_write_block_list(room->cost,fd,lflf+8)) return 0;
 
-  return size;
+  if(!scc_ld_write_block_list(room->chset,fd,lflf+8)) return 0;
+
+  room->size = scc_fd_pos(fd) - lflf;
+  return scc_ld_close_block(lflf,fd);
 }
 
-int scc_ld_write_lflf(scc_ld_room_t* room, scc_fd_t* fd) {
-  
-  scc_fd_w32(fd,MKID('L','F','L','F'));
-  scc_fd_w32be(fd,8 + scc_ld_lflf_size(room));
+// The LOFF table is first written with null offsets, and patched
+// once all the rooms have been written.
+int scc_ld_write_lecf(scc_ld_room_t* room, scc_fd_t* fd) {
+  off_t lecf, loff;
+  scc_ld_room_t* r;
+  uint8_t* tab;
+  int n, i;
 
-  scc_fd_w32(fd,MKID('R','O','O','M'));
-  scc_fd_w32be(fd,8 + scc_ld_block_list_size(room->room));
-  if(!scc_ld_write_block_list(room->room,fd)) return 0;
+  for(n = 0, r = room ; r ; r = r->next) n++;
+  tab = calloc(1,1+5*n);
+  tab[0] = n;
+  for(i = 0, r = room ; r ; i++, r = r->next)
+    tab[1+5*i] = r->sym->addr;
+
+  lecf = scc_ld_open_block(MKID('L','E','C','F'),fd);
+  loff = scc_ld_open_block(MKID('L','O','F','F'),fd);
+  scc_fd_write(fd,tab,1+5*n);
+  if(!scc_ld_close_block(loff,fd)) {
+    free(tab);
+    return 0;
+  }
 
-  if(!scc_ld_write_block_list(room->scr,fd)) return 0;
+  for(i = 0, r = room ; r ; i++, r = r->next) {
+    // offset of the LFLF data
+    SCC_SET_32LE(tab,2+5*i,scc_fd_pos(fd) + 8);
+    if(!scc_ld_write_lflf(r,fd)) {
+      free(tab);
+      return 0;
+    }
+  }
 
-  if(!scc_ld_write_block_list(room->snd,fd)) return 0;
+  if(scc_fd_pwrite(fd,tab,1+5*n,loff+8) != 1+5*n) {
+    scc_log(LOG_ERR,"Error while writing the LOFF block.\n");
+    free(tab);
+    return 0;
+  }
+  free(tab);
 
-  if(!scc_ld_write_block_list(room->cost,fd)) return 0;
+  return scc_ld_close_block(lecf,fd);
+}
 
-  if(!scc_ld_write_block_list(room->chset,fd)) return 0;
+static uint64_t scc_ld_hash_int(uint64_t hash, int val) {
+  uint8_t buf[4];
+  SCC_SET_32LE(buf,0,val);
+  return scc_ld_hash(hash,buf,4);
+}
 
-  return 1;  
+static uint64_t scc_ld_hash_syms(uint64_t hash, scc_symbol_t* s) {
+  for( ; s ; s = s->next) {
+    hash = scc_ld_hash(hash,s->sym,strlen(s->sym)+1);
+    hash = scc_ld_hash_int(hash,s->type);
+    hash = scc_ld_hash_int(hash,s->subtype);
+    hash = scc_ld_hash_int(hash,s->addr);
+    if(s->type == SCC_RES_ROOM)
+      hash = scc_ld_hash_syms(hash,s->childs);
+  }
+  return hash;
 }
 
-int scc_ld_lecf_size(scc_ld_room_t* room) {
-  int size = 0;
-  int n = 0;
-  
-  // LFLF blocks
-  while(room) {
-    size += 8 + scc_ld_lflf_size(room);
-    n++;
-    room = room->next;
+// Hash everything the patched rooms depend on, beside their own
+// content: the target, the key, the addresses and the voices.
+static uint64_t scc_ld_link_hash(int key) {
+  uint64_t hash = SCC_LD_HASH_INIT;
+  scc_ld_voice_t* v;
+
+  hash = scc_ld_hash_int(hash,scc_ns->target->version);
+  hash = scc_ld_hash_int(hash,key);
+  hash = scc_ld_hash_syms(hash,scc_ns->glob_sym);
+  for(v = scc_voice ; v ; v = v->next) {
+    hash = scc_ld_hash_int(hash,v->offset);
+    hash = scc_ld_hash_int(hash,v->vctl_size);
   }
+  return hash;
+}
+
+static unsigned scc_ld_lflf_size(scc_ld_room_t* room) {
+  scc_ld_block_t* list[] = { room->room, room->scr, room->snd,
+                             room->cost, room->chset };
+  scc_ld_block_t* blk;
+  unsigned i, size = 8 + 8; // LFLF ROOM
 
-  // LOFF
-  size += 8 + 1 + 5*n;
+  for(i = 0 ; i < sizeof(list)/sizeof(list[0]) ; i++)
+    for(blk = list[i] ; blk ; blk = blk->next)
+      if(blk->asis) size += 8 + blk->data_len;
 
   return size;
 }
 
-int scc_ld_write_loff(scc_ld_room_t* room, scc_fd_t* fd) {
-  int n;
+/// Version of the link state files
+#define SCC_LD_STATE_VERSION 3
+
+// The link state start with a header:
+//   SLDS, version, link hash, data file size, inode, mtime, ctime,
+//   free slot count, room count
+// followed by the free slots: { offset, size }
+// and the rooms in the LOFF order:
+//   address, roobj hash, LFLF offset and size,
+//   object count, { address, state, owner, class }
+//   resource count, { type, address, offset in the LFLF }
+static void scc_ld_write_state_res(scc_fd_t* fd, scc_ld_block_t* blk,
+                                   int rtype) {
+  for( ; blk ; blk = blk->next) {
+    if(blk->offset < 0) continue;
+    scc_fd_w8(fd,rtype);
+    scc_fd_w16le(fd,blk->addr);
+    scc_fd_w32le(fd,blk->offset);
+  }
+}
+
+static void scc_ld_w64le(scc_fd_t* fd, uint64_t v) {
+  scc_fd_w32le(fd,v & 0xFFFFFFFF);
+  scc_fd_w32le(fd,v >> 32);
+}
+
+static uint64_t scc_ld_r64le(scc_fd_t* fd) {
+  uint64_t v = scc_fd_r32le(fd);
+  return v | ((uint64_t)scc_fd_r32le(fd)) << 32;
+}
+
+/// What identify a version of the data file
+typedef struct scc_ld_file_id {
+  uint64_t size, ino;
+  /// Modification and change time in ns
+  uint64_t mtime, ctime;
+} scc_ld_file_id_t;
+
+// The state can't be used with a file that was rewritten or modified
+// since the state was written, so the file size, inode and times are
+// recorded with it.
+static int scc_ld_get_file_id(char* path, scc_ld_file_id_t* id) {
+  struct stat st;
+  if(stat(path,&st)) return 0;
+  id->size = st.st_size;
+  id->ino = st.st_ino;
+  id->mtime = st.st_mtime*1000000000ULL;
+  id->ctime = st.st_ctime*1000000000ULL;
+#ifdef HAVE_STAT_NSEC
+  id->mtime += st.st_mtim.tv_nsec;
+  id->ctime += st.st_ctim.tv_nsec;
+#endif
+  return 1;
+}
+
+static unsigned scc_ld_slots_size(scc_ld_slot_t* slot) {
+  unsigned size = 0;
+  for( ; slot ; slot = slot->next)
+    size += slot->size;
+  return size;
+}
+
+// Add some unused space to the list, it is kept sorted by offset
+// and the adjacent slots are merged.
+static void scc_ld_free_slot(scc_ld_slot_t** list, unsigned offset,
+                             unsigned size) {
+  scc_ld_slot_t** ptr, *prev = NULL, *next, *slot;
+
+  if(!size) return;
+  for(ptr = list ; *ptr && (*ptr)->offset < offset ; ptr = &(*ptr)->next)
+    prev = *ptr;
+  next = *ptr;
+
+  if(prev && prev->offset + prev->size == offset) {
+    prev->size += size;
+    slot = prev;
+  } else {
+    slot = calloc(1,sizeof(scc_ld_slot_t));
+    slot->offset = offset;
+    slot->size = size;
+    slot->next = next;
+    *ptr = slot;
+  }
+  if(next && slot->offset + slot->size == next->offset) {
+    slot->size += next->size;
+    slot->next = next->next;
+    free(next);
+  }
+}
+
+// Take the smallest slot that is big enough
+static int scc_ld_alloc_slot(scc_ld_slot_t** list, unsigned size,
+                             unsigned* offset) {
+  scc_ld_slot_t** ptr, **best = NULL, *slot;
+
+  for(ptr = list ; *ptr ; ptr = &(*ptr)->next)
+    if((*ptr)->size >= size && (!best || (*ptr)->size < (*best)->size))
+      best = ptr;
+  if(!best) return 0;
+
+  slot = *best;
+  *offset = slot->offset;
+  slot->offset += size;
+  slot->size -= size;
+  if(!slot->size) {
+    *best = slot->next;
+    free(slot);
+  }
+  return 1;
+}
+
+static unsigned scc_ld_count_state_res(scc_ld_block_t* blk) {
+  unsigned n = 0;
+  for( ; blk ; blk = blk->next)
+    if(blk->offset >= 0) n++;
+  return n;
+}
+
+int scc_ld_write_state(scc_ld_room_t* room, char* path, int key,
+                       scc_ld_file_id_t* data_id, scc_ld_slot_t* slots) {
+  scc_fd_t* fd = new_scc_fd(path,O_WRONLY|O_CREAT|O_TRUNC,0);
+  uint64_t hash = scc_ld_link_hash(key);
   scc_ld_room_t* r;
-  int off = 8 + 8 + 8; // LECF LOFF LFLF
+  scc_ld_obj_t* obj;
+  scc_ld_slot_t* slot;
+  unsigned n;
+
+  if(!fd) {
+    scc_log(LOG_ERR,"Failed to open %s: %s\n",path,strerror(errno));
+    return 0;
+  }
 
+  scc_fd_w32(fd,MKID('S','L','D','S'));
+  scc_fd_w32le(fd,SCC_LD_STATE_VERSION);
+  scc_ld_w64le(fd,hash);
+  scc_ld_w64le(fd,data_id->size);
+  scc_ld_w64le(fd,data_id->ino);
+  scc_ld_w64le(fd,data_id->mtime);
+  scc_ld_w64le(fd,data_id->ctime);
+  for(n = 0, slot = slots ; slot ; slot = slot->next) n++;
+  scc_fd_w32le(fd,n);
   for(n = 0, r = room ; r ; r = r->next) n++;
+  scc_fd_w32le(fd,n);
 
-  scc_fd_w32(fd,MKID('L','O','F','F'));
-  scc_fd_w32be(fd,8 + 1 + 5*n);
+  for(slot = slots ; slot ; slot = slot->next) {
+    scc_fd_w32le(fd,slot->offset);
+    scc_fd_w32le(fd,slot->size);
+  }
 
-  scc_fd_w8(fd,n);
-  off += 1+5*n;
   for(r = room ; r ; r = r->next) {
-    scc_fd_w8(fd,r->sym->addr);
-    scc_fd_w32le(fd,off);
-    off += 8 + scc_ld_lflf_size(r);
+    scc_fd_w32le(fd,r->sym->addr);
+    scc_ld_w64le(fd,r->hash);
+    scc_fd_w32le(fd,r->offset);
+    scc_fd_w32le(fd,r->size);
+
+    for(n = 0, obj = r->obj ; obj ; obj = obj->next) n++;
+    scc_fd_w32le(fd,n);
+    for(obj = r->obj ; obj ; obj = obj->next) {
+      scc_fd_w16le(fd,obj->addr);
+      scc_fd_w8(fd,obj->state);
+      scc_fd_w8(fd,obj->owner);
+      scc_fd_w32le(fd,obj->class);
+    }
+
+    scc_fd_w32le(fd,scc_ld_count_state_res(r->scr) +
+                 scc_ld_count_state_res(r->snd) +
+                 scc_ld_count_state_res(r->cost) +
+                 scc_ld_count_state_res(r->chset));
+    scc_ld_write_state_res(fd,r->scr,SCC_RES_SCR);
+    scc_ld_write_state_res(fd,r->snd,SCC_RES_SOUND);
+    scc_ld_write_state_res(fd,r->cost,SCC_RES_COST);
+    scc_ld_write_state_res(fd,r->chset,SCC_RES_CHSET);
+  }
+
+  return scc_fd_close(fd) ? 0 : 1;
+}
+
+typedef struct scc_ld_state_room {
+  uint64_t hash;
+  off_t offset;
+  unsigned size;
+  scc_ld_obj_t* obj, *last_obj;
+  /// Resource offsets, the block type is the resource type
+  scc_ld_block_t* res, *last_res;
+} scc_ld_state_room_t;
+
+static void scc_ld_free_state(scc_ld_state_room_t* state, unsigned n) {
+  unsigned i;
+  for(i = 0 ; i < n ; i++) {
+    SCC_LIST_FREE(state[i].obj,state[i].last_obj);
+    SCC_LIST_FREE(state[i].res,state[i].last_res);
   }
+  free(state);
+}
+
+static int scc_ld_parse_state(scc_fd_t* fd, scc_ld_room_t* room,
+                              scc_ld_state_room_t* state) {
+  scc_ld_room_t* r;
+  scc_ld_obj_t* obj;
+  scc_ld_block_t* blk;
+  scc_symbol_t* sym;
+  unsigned i, j, n;
+
+  for(i = 0, r = room ; r ; i++, r = r->next) {
+    // the rooms only get their address when they are patched
+    sym = scc_ns_get_sym(scc_ns,NULL,r->sym->sym);
+    if(!sym || scc_fd_r32le(fd) != sym->addr) return 0;
+    state[i].hash = scc_ld_r64le(fd);
+    state[i].offset = scc_fd_r32le(fd);
+    state[i].size = scc_fd_r32le(fd);
+
+    n = scc_fd_r32le(fd);
+    if(n > 0xFFFF) return 0;
+    for(j = 0 ; j < n ; j++) {
+      obj = calloc(1,sizeof(scc_ld_obj_t));
+      obj->addr = scc_fd_r16le(fd);
+      obj->state = scc_fd_r8(fd);
+      obj->owner = scc_fd_r8(fd);
+      obj->class = scc_fd_r32le(fd);
+      SCC_LIST_ADD(state[i].obj,state[i].last_obj,obj);
+    }
 
+    n = scc_fd_r32le(fd);
+    if(n > 0xFFFF) return 0;
+    for(j = 0 ; j < n ; j++) {
+      blk = calloc(1,sizeof(scc_ld_block_t));
+      blk->type = scc_fd_r8(fd);
+      blk->addr = scc_fd_r16le(fd);
+      blk->offset = scc_fd_r32le(fd);
+      blk->asis = 1;
+      SCC_LIST_ADD(state[i].res,state[i].last_res,blk);
+    }
+  }
   return 1;
 }
 
-int scc_ld_write_lecf(scc_ld_room_t* room, scc_fd_t* fd) {
-  
-  scc_fd_w32(fd,MKID('L','E','C','F'));
-  scc_fd_w32be(fd,8 + scc_ld_lecf_size(room));
+// Replace the content of an unchanged room with what was
+// recorded in the state, it is then neither patched nor written.
+static int scc_ld_room_set_state(scc_ld_room_t* room,
+                                 scc_ld_state_room_t* state) {
+  scc_ld_block_t* scr_last = NULL, *snd_last = NULL;
+  scc_ld_block_t* cost_last = NULL, *chset_last = NULL;
+  scc_ld_block_t* blk, *next;
 
-  if(!scc_ld_write_loff(room,fd)) return 0;
+  // the room address is still needed for the index
+  if(!scc_ns_get_addr_from(room->ns,scc_ns)) {
+    scc_log(LOG_ERR,"Failed to import the address in the room ns.\n");
+    return 0;
+  }
 
-  while(room) {
-    if(!scc_ld_write_lflf(room,fd)) return 0;
-    room = room->next;
+  scc_ld_block_list_free(room->room);
+  scc_ld_block_list_free(room->scr);
+  scc_ld_block_list_free(room->snd);
+  scc_ld_block_list_free(room->cost);
+  scc_ld_block_list_free(room->chset);
+  room->room = room->scr = room->snd = room->cost = room->chset = NULL;
+
+  for(blk = state->res ; blk ; blk = next) {
+    next = blk->next;
+    blk->next = NULL;
+    switch(blk->type) {
+    case SCC_RES_SCR:
+      SCC_LIST_ADD(room->scr,scr_last,blk);
+      break;
+    case SCC_RES_SOUND:
+      SCC_LIST_ADD(room->snd,snd_last,blk);
+      break;
+    case SCC_RES_COST:
+      SCC_LIST_ADD(room->cost,cost_last,blk);
+      break;
+    case SCC_RES_CHSET:
+      SCC_LIST_ADD(room->chset,chset_last,blk);
+      break;
+    default:
+      free(blk);
+    }
   }
+  state->res = state->last_res = NULL;
 
+  room->obj = state->obj;
+  room->last_obj = state->last_obj;
+  state->obj = state->last_obj = NULL;
+
+  room->unchanged = room->patched = 1;
+  return 1;
+}
+
+/// Load the state of the previous link, return the number of
+/// unchanged rooms or -1 if a full link is needed.
+int scc_ld_read_state(scc_ld_room_t* room, char* path, char* data_path,
+                      int key, unsigned* data_size, scc_ld_slot_t** slots) {
+  scc_fd_t* fd = new_scc_fd(path,O_RDONLY,0);
+  scc_ld_state_room_t* state;
+  scc_ld_room_t* r;
+  scc_ld_slot_t* slot;
+  scc_ld_file_id_t id, file_id;
+  uint64_t hash;
+  unsigned i, n, num_slot, num_room, offset, size;
+
+  if(!fd) {
+    scc_log(LOG_V,"No link state found, doing a full link.\n");
+    return -1;
+  }
+  if(scc_fd_r32(fd) != MKID('S','L','D','S') ||
+     scc_fd_r32le(fd) != SCC_LD_STATE_VERSION) {
+    scc_log(LOG_WARN,"%s is not a valid link state.\n",path);
+    scc_fd_close(fd);
+    return -1;
+  }
+  hash = scc_ld_r64le(fd);
+  id.size = scc_ld_r64le(fd);
+  id.ino = scc_ld_r64le(fd);
+  id.mtime = scc_ld_r64le(fd);
+  id.ctime = scc_ld_r64le(fd);
+  num_slot = scc_fd_r32le(fd);
+  num_room = scc_fd_r32le(fd);
+  for(n = 0, r = room ; r ; r = r->next) n++;
+
+  if(hash != scc_ld_link_hash(key) || num_room != n) {
+    scc_log(LOG_V,"The addresses changed, doing a full link.\n");
+    scc_fd_close(fd);
+    return -1;
+  }
+  if(!scc_ld_get_file_id(data_path,&file_id) ||
+     memcmp(&id,&file_id,sizeof(id))) {
+    scc_log(LOG_V,"%s changed, doing a full link.\n",data_path);
+    scc_fd_close(fd);
+    return -1;
+  }
+  *data_size = id.size;
+
+  for(i = 0 ; i < num_slot ; i++) {
+    offset = scc_fd_r32le(fd);
+    size = scc_fd_r32le(fd);
+    if(offset + size > *data_size) break;
+    scc_ld_free_slot(slots,offset,size);
+  }
+  if(i < num_slot) {
+    scc_log(LOG_WARN,"%s is not a valid link state.\n",path);
+    SCC_LIST_FREE((*slots),slot);
+    scc_fd_close(fd);
+    return -1;
+  }
+  // don't let the relocated rooms waste too much space
+  if(scc_ld_slots_size(*slots) > *data_size/4) {
+    scc_log(LOG_V,"Too much unused space in %s, doing a full link.\n",
+            data_path);
+    SCC_LIST_FREE((*slots),slot);
+    scc_fd_close(fd);
+    return -1;
+  }
+
+  state = calloc(num_room,sizeof(scc_ld_state_room_t));
+  if(!scc_ld_parse_state(fd,room,state)) {
+    scc_log(LOG_WARN,"%s is not a valid link state.\n",path);
+    scc_ld_free_state(state,num_room);
+    SCC_LIST_FREE((*slots),slot);
+    scc_fd_close(fd);
+    return -1;
+  }
+  scc_fd_close(fd);
+
+  for(n = 0, i = 0, r = room ; r ; i++, r = r->next) {
+    r->offset = state[i].offset;
+    r->size = state[i].size;
+    if(state[i].hash != r->hash) continue;
+    // the room will be patched normally
+    if(!scc_ld_room_set_state(r,&state[i])) continue;
+    n++;
+  }
+  scc_ld_free_state(state,num_room);
+
+  return n;
+}
+
+// Rewrite the changed rooms in an existing data file. The rooms that
+// don't fit in their old place anymore are moved to the smallest
+// unused slot that can hold them, or to the end.
+int scc_ld_update_lecf(scc_ld_room_t* room, scc_fd_t* fd,
+                       unsigned* data_size, scc_ld_slot_t** slots) {
+  scc_ld_room_t* r;
+  uint8_t buf[4];
+  off_t pos, end = *data_size;
+  unsigned size, offset;
+  int i;
+
+  for(i = 0, r = room ; r ; i++, r = r->next) {
+    if(r->unchanged) continue;
+
+    size = scc_ld_lflf_size(r);
+    if(size <= r->size) {
+      pos = r->offset;
+      scc_ld_free_slot(slots,r->offset + size,r->size - size);
+    } else {
+      scc_ld_free_slot(slots,r->offset,r->size);
+      if(scc_ld_alloc_slot(slots,size,&offset))
+        pos = offset;
+      else {
+        pos = end;
+        end += size;
+      }
+    }
+    scc_log(LOG_V,"Writing room %s at 0x%x\n",r->sym->sym,(unsigned)pos);
+    if(scc_fd_seek(fd,pos,SEEK_SET) != pos ||
+       !scc_ld_write_lflf(r,fd)) return 0;
+
+    // LOFF entry: LECF LOFF count, room, offset of the LFLF data
+    SCC_SET_32LE(buf,0,pos + 8);
+    if(scc_fd_pwrite(fd,buf,4,8+8+1+5*i+1) != 4) return 0;
+  }
+
+  SCC_SET_32BE(buf,0,end);
+  if(scc_fd_pwrite(fd,buf,4,4) != 4) return 0;
+  *data_size = end;
   return 1;
 }
 
@@ -1147,6 +1751,80 @@ static scc_ld_block_t* scc_ld_room_get_res_list(scc_ld_room_t* r, int rtype) {
   return NULL;
 }
 
+#define SCC_LD_DEDUP_HASH_SIZE 1024
+
+typedef struct scc_ld_dedup_entry scc_ld_dedup_entry_t;
+struct scc_ld_dedup_entry {
+  scc_ld_dedup_entry_t* next;
+  uint64_t hash;
+  scc_ld_block_t* blk;
+  int room;
+};
+
+// Find the global resources with the same content, only the first
+// one is written and the index entries of the others point to it.
+// The engine still see them as different resources, but the data
+// file only contains one copy.
+void scc_ld_dedup(scc_ld_room_t* room) {
+  static const struct {
+    int type;
+    char* name;
+  } res[] = {
+    { SCC_RES_SCR,   "scripts" },
+    { SCC_RES_SOUND, "sounds" },
+    { SCC_RES_COST,  "costumes" },
+    { SCC_RES_CHSET, "charsets" },
+  };
+  unsigned saved[4] = { 0 }, num[4] = { 0 }, total = 0;
+  scc_ld_dedup_entry_t* hash[SCC_LD_DEDUP_HASH_SIZE] = { NULL };
+  scc_ld_dedup_entry_t* e, *next;
+  scc_ld_block_t* blk;
+  scc_ld_room_t* r;
+  uint64_t h;
+  int i;
+
+  for(r = room ; r ; r = r->next)
+    for(i = 0 ; i < 4 ; i++)
+      for(blk = scc_ld_room_get_res_list(r,res[i].type) ;
+          blk ; blk = blk->next) {
+        if(!blk->asis) continue;
+        h = scc_ld_hash_int(SCC_LD_HASH_INIT,blk->type);
+        h = scc_ld_hash(h,blk->data,blk->data_len);
+        for(e = hash[h % SCC_LD_DEDUP_HASH_SIZE] ; e ; e = e->next)
+          if(e->hash == h && e->blk->type == blk->type &&
+             e->blk->data_len == blk->data_len &&
+             !memcmp(e->blk->data,blk->data,blk->data_len)) break;
+        if(e) {
+          scc_log(LOG_V,"%c%c%c%c %d is identical to %d.\n",
+                  UNMKID(blk->type),blk->addr,e->blk->addr);
+          blk->dup = e->blk;
+          blk->dup_room = e->room;
+          saved[i] += 8 + blk->data_len;
+          num[i]++;
+          continue;
+        }
+        e = malloc(sizeof(scc_ld_dedup_entry_t));
+        e->hash = h;
+        e->blk = blk;
+        e->room = r->sym->addr;
+        e->next = hash[h % SCC_LD_DEDUP_HASH_SIZE];
+        hash[h % SCC_LD_DEDUP_HASH_SIZE] = e;
+      }
+
+  for(i = 0 ; i < SCC_LD_DEDUP_HASH_SIZE ; i++)
+    for(e = hash[i] ; e ; e = next) {
+      next = e->next;
+      free(e);
+    }
+
+  for(i = 0 ; i < 4 ; i++) total += saved[i];
+  scc_log(LOG_MSG,"Deduplication saved %u bytes.\n",total);
+  for(i = 0 ; i < 4 ; i++)
+    if(num[i])
+      scc_log(LOG_MSG,"  %-9s %u duplicates, %u bytes\n",
+              res[i].name,num[i],saved[i]);
+}
+
 int scc_ld_write_res_idx(scc_fd_t* fd, int n,char* name,int rtype) {
   uint8_t* room_no = calloc(1,n);
   uint32_t* room_off = calloc(4,n);
@@ -1156,7 +1834,6 @@ int scc_ld_write_res_idx(scc_fd_t* fd, int n,char* name,int rtype) {
   int a;
 
   for(a = 1 ; a < n ; a++) {
-    int off;
     if(!scc_ns_is_addr_alloc(scc_ns,rtype,a)) continue;
     s = scc_ns_get_sym_at(scc_ns,rtype,a);
     if(!s || !s->parent) {
@@ -1169,28 +1846,20 @@ int scc_ld_write_res_idx(scc_fd_t* fd, int n,char* name,int rtype) {
       return 0;
     }
 
-    off = 8;
-    switch(rtype) {
-    case SCC_RES_CHSET:
-      off += scc_ld_block_list_size(r->cost);
-    case SCC_RES_COST:
-      off += scc_ld_block_list_size(r->snd);
-    case SCC_RES_SOUND:
-      off += scc_ld_block_list_size(r->scr);
-    case SCC_RES_SCR:
-      off += scc_ld_block_list_size(r->room);
-    }
-
     for(blk = scc_ld_room_get_res_list(r,rtype) ; 
-        blk && blk->addr != a ; blk = blk->next) {
-      off += 8 + blk->data_len;
+        blk && blk->addr != a ; blk = blk->next);
+    // point the duplicated resources to the written copy
+    if(blk && blk->dup) {
+      room_no[a] = blk->dup_room;
+      room_off[a] = SCC_TO_32LE(blk->dup->offset);
+      continue;
     }
-    if(!blk) {
+    if(!blk || blk->offset < 0) {
       scc_log(LOG_ERR,"Error while writing script index (type = %i).\n", rtype);
       return 0;
     }
     room_no[a] = r->sym->addr;
-    room_off[a] = SCC_TO_32LE(off);
+    room_off[a] = SCC_TO_32LE(blk->offset);
   }
   scc_fd_write(fd,room_no,n);
   scc_fd_write(fd,room_off,n*4);
@@ -1382,6 +2051,8 @@ static int max_local = 200;
 static int max_array = 100;
 static int max_flobj = 20;
 static int max_inventory = 20;
+static int num_jobs = 1;
+static int dedup = 0;
 
 
 static scc_param_t scc_ld_params[] = {
@@ -1395,6 +2066,9 @@ static scc_param_t scc_ld_params[] = {
   { "v", SCC_PARAM_FLAG, LOG_MSG, LOG_V, &scc_log_level },
   { "vv", SCC_PARAM_FLAG, LOG_MSG, LOG_DBG, &scc_log_level },
   { "write-room-names", SCC_PARAM_FLAG, 0, 1, &write_room_names },
+  { "j", SCC_PARAM_INT, 1, 256, &num_jobs },
+  { "incremental", SCC_PARAM_FLAG, 0, 1, &incremental },
+  { "dedup", SCC_PARAM_FLAG, 0, 1, &dedup },
   { "help", SCC_PARAM_HELP, 0, 0, &sld_help },
   { NULL, 0, 0, 0, NULL }
 };
@@ -1402,12 +2076,23 @@ static scc_param_t scc_ld_params[] = {
 int main(int argc,char** argv) {
   scc_ld_room_t* r;
   scc_cl_arg_t* files,*f;
-  int obj_n;
-  char default_name[255];
+  int obj_n, unchanged = -1;
+  unsigned data_size = 0;
+  scc_ld_slot_t* slots = NULL;
+  scc_ld_file_id_t data_id;
+  char default_name[255], state_name[255];
 
   files = scc_param_parse_argv(scc_ld_params,argc-1,&argv[1]);
   if(!files) scc_print_help(&sld_help,1);
 
+  // the room dumps are always fully written
+  if(dump_rooms) incremental = dedup = 0;
+  // the shared resources would have to be tracked across the rooms
+  if(incremental && dedup) {
+    scc_log(LOG_WARN,"Incremental links can't be used with -dedup.\n");
+    incremental = 0;
+  }
+
   // The global ns is now created just before loading the
   // the first to get the target vm version.
   //scc_ns = scc_ns_new(vm_version);
@@ -1443,18 +2128,36 @@ int main(int argc,char** argv) {
   obj_room  = calloc(1,obj_n);
   obj_class = calloc(4,obj_n);
 
-  // patch the rooms
-  for(r = scc_room ; r ; r = r->next) {
-    scc_log(LOG_V,"Patching room %s\n",r->sym->sym);
-    if(!scc_ld_room_patch(r)) return 5;
-  }
-
   // Compute our basename
   if(!out_file) {
       sprintf(default_name,"scummc%d",scc_ns->target->version);
       out_file = default_name;
   }
 
+  // reuse the unchanged rooms from the previous link
+  sprintf(state_name,"%s.ldstate",out_file);
+  if(incremental) {
+    char name[255];
+    int n = 0;
+
+    sprintf(name,"%s.001",out_file);
+    unchanged = scc_ld_read_state(scc_room,state_name,name,enckey,
+                                  &data_size,&slots);
+    if(unchanged >= 0) {
+      for(r = scc_room ; r ; r = r->next) n++;
+      scc_log(LOG_V,"Incremental link, %d of %d rooms unchanged.\n",
+              unchanged,n);
+    }
+  }
+
+  // the state is only valid for the data file it was written with
+  unlink(state_name);
+
+  // patch the rooms
+  if(!scc_ld_patch_rooms(scc_room,num_jobs)) return 5;
+
+  if(dedup) scc_ld_dedup(scc_room);
+
   // write the voice file
   if(scc_voice) {
     char name[255];
@@ -1472,7 +2175,7 @@ int main(int argc,char** argv) {
       scc_log(LOG_ERR,"Failed to write SOU file %s\n",name);
       return 6;
     }
-    scc_fd_close(fd);
+    if(scc_fd_close(fd)) return 6;
   }
 
   // dump rooms
@@ -1498,18 +2201,32 @@ int main(int argc,char** argv) {
 
     sprintf(name,"%s.001",out_file);
 
-    fd = new_scc_fd(name,O_WRONLY|O_CREAT|O_TRUNC,enckey);
+    if(unchanged >= 0)
+      fd = new_scc_fd(name,O_RDWR,enckey);
+    else
+      fd = new_scc_fd(name,O_WRONLY|O_CREAT|O_TRUNC,enckey);
     scc_log(LOG_V,"Outputting data file %s\n",name);
 
     if(!fd) {
       scc_log(LOG_ERR,"Failed to open file %s\n",name);
       return 5;
     }
-    if(!scc_ld_write_lecf(scc_room,fd)) {
-      scc_log(LOG_ERR,"Failed to write data file.\n");
+    if(unchanged >= 0) {
+      if(!scc_ld_update_lecf(scc_room,fd,&data_size,&slots)) {
+        scc_log(LOG_ERR,"Failed to update data file.\n");
+        return 6;
+      }
+    } else {
+      if(!scc_ld_write_lecf(scc_room,fd)) {
+        scc_log(LOG_ERR,"Failed to write data file.\n");
+        return 6;
+      }
+    }
+    if(scc_fd_close(fd)) return 6;
+    if(incremental && !scc_ld_get_file_id(name,&data_id)) {
+      scc_log(LOG_ERR,"Failed to stat %s: %s\n",name,strerror(errno));
       return 6;
     }
-    scc_fd_close(fd);
 
     sprintf(name,"%s.000",out_file);
     scc_log(LOG_V,"Outputting index file %s\n",name);
@@ -1522,7 +2239,12 @@ int main(int argc,char** argv) {
       scc_log(LOG_ERR,"Failed to write index file.\n");
       return 6;
     }
-    scc_fd_close(fd);
+    if(scc_fd_close(fd)) return 6;
+
+    if(incremental &&
+       !scc_ld_write_state(scc_room,state_name,enckey,&data_id,slots))
+      scc_log(LOG_WARN,"Failed to write the link state, the next link "
+              "will be a full one.\n");
 
   }
       
@@ -41,6 +41,10 @@ void scc_symbol_list_free(scc_symbol_t* s);
 void scc_symbol_free(scc_symbol_t* s) {
   if(s->sym) free(s->sym);
   if(s->childs) scc_symbol_list_free(s->childs);
+  if(s->childs_hash) {
+    free(s->childs_hash->bucket);
+    free(s->childs_hash);
+  }
   free(s);
 }
 
@@ -82,54 +86,220 @@ int scc_sym_is_only_global(int type) {
   return 0;
 }
 
+/// @name Symbol hash tables
+///
+/// Each scope (the global list and the childs of each symbol) have a
+/// hash table of its symbols by name. The global and room level symbols
+/// are also indexed by type and RID and by type and address.
+///
+/// Lists were searched from the head, and symbols are always added at
+/// the head. So when several symbols match, the one added last wins.
+//@{
+
+#define SCC_NS_KEY(type,val) ((unsigned)(type)*0x9E3779B1U ^ (unsigned)(val))
+
+static unsigned scc_ns_str_hash(const char* str) {
+  unsigned h = 5381;
+  while(*str)
+    h = (h*33) ^ (uint8_t)*str++;
+  return h;
+}
+
+static unsigned scc_ns_sym_key(scc_symbol_t* s, unsigned chain) {
+  switch(chain) {
+  case SCC_NS_HASH_RID:
+    return SCC_NS_KEY(s->type,s->rid);
+  case SCC_NS_HASH_ADDR:
+    return SCC_NS_KEY(s->type,s->addr);
+  }
+  return s->hash;
+}
+
+static void scc_ns_hash_grow(scc_ns_hash_t* h) {
+  unsigned i, size = h->size ? h->size*2 : 16;
+  scc_symbol_t **bucket = calloc(size,sizeof(scc_symbol_t*));
+  scc_symbol_t *s, *n;
+
+  for(i = 0 ; i < h->size ; i++)
+    for(s = h->bucket[i] ; s ; s = n) {
+      unsigned b = scc_ns_sym_key(s,h->chain) & (size-1);
+      n = s->hash_next[h->chain];
+      s->hash_next[h->chain] = bucket[b];
+      bucket[b] = s;
+    }
+
+  free(h->bucket);
+  h->bucket = bucket;
+  h->size = size;
+}
+
+static void scc_ns_hash_insert(scc_ns_hash_t* h, scc_symbol_t* s) {
+  unsigned b;
+
+  if(h->num >= h->size) scc_ns_hash_grow(h);
+
+  b = scc_ns_sym_key(s,h->chain) & (h->size-1);
+  s->hash_next[h->chain] = h->bucket[b];
+  h->bucket[b] = s;
+  h->num++;
+}
+
+static void scc_ns_hash_remove(scc_ns_hash_t* h, scc_symbol_t* s) {
+  scc_symbol_t** p;
+
+  if(!h->size) return;
+
+  for(p = &h->bucket[scc_ns_sym_key(s,h->chain) & (h->size-1)] ;
+      *p ; p = &(*p)->hash_next[h->chain]) {
+    if(*p != s) continue;
+    *p = s->hash_next[h->chain];
+    s->hash_next[h->chain] = NULL;
+    h->num--;
+    return;
+  }
+}
+
+// Find a symbol by name, type < 0 match any type
+static scc_symbol_t* scc_ns_hash_get(scc_ns_hash_t* h, char* sym,
+                                     unsigned hash, int type) {
+  scc_symbol_t *s, *r = NULL;
+
+  if(!h || !h->size) return NULL;
+
+  for(s = h->bucket[hash & (h->size-1)] ; s ;
+      s = s->hash_next[SCC_NS_HASH_NAME]) {
+    if(s->hash != hash || (type >= 0 && s->type != type) ||
+       (r && r->seq > s->seq) || strcmp(s->sym,sym)) continue;
+    r = s;
+  }
+  return r;
+}
+
+// Order in which the old lists were searched by type and id/address:
+// first the global symbols, then the rooms.
+static int scc_ns_sym_before(scc_symbol_t* a, scc_symbol_t* b) {
+  if(!b) return 1;
+  if(!a->parent || !b->parent) {
+    if(a->parent) return 0;
+    return b->parent || a->seq > b->seq;
+  }
+  if(a->parent != b->parent) return a->parent->seq > b->parent->seq;
+  return a->seq > b->seq;
+}
+
+// Find a global or room symbol by type and RID or address
+static scc_symbol_t* scc_ns_hash_get_at(scc_ns_hash_t* h, int type, int val) {
+  scc_symbol_t *s, *r = NULL;
+  int global = scc_sym_is_global(type);
+  int only_global = scc_sym_is_only_global(type);
+
+  if(!h->size) return NULL;
+
+  for(s = h->bucket[SCC_NS_KEY(type,val) & (h->size-1)] ; s ;
+      s = s->hash_next[h->chain]) {
+    if(s->type != type ||
+       (h->chain == SCC_NS_HASH_RID ? s->rid : s->addr) != val) continue;
+    if(s->parent ? only_global : !global) continue;
+    if(scc_ns_sym_before(s,r)) r = s;
+  }
+  return r;
+}
+
+// Only the global and room level symbols can be found by id/address
+static int scc_ns_is_indexed(scc_symbol_t* s) {
+  return s->seq && (!s->parent || s->parent->type == SCC_RES_ROOM);
+}
+
+// Add a symbol to a scope, parent is NULL for the global scope
+static void scc_ns_link_sym(scc_ns_t* ns, scc_symbol_t* parent,
+                            scc_symbol_t* s) {
+  scc_ns_hash_t* h;
+
+  if(parent) {
+    s->next = parent->childs;
+    parent->childs = s;
+    s->parent = parent;
+    if(!parent->childs_hash) {
+      parent->childs_hash = calloc(1,sizeof(scc_ns_hash_t));
+      parent->childs_hash->chain = SCC_NS_HASH_NAME;
+    }
+    h = parent->childs_hash;
+  } else {
+    s->next = ns->glob_sym;
+    ns->glob_sym = s;
+    h = &ns->glob_hash;
+  }
+
+  s->seq = ++ns->seq;
+  scc_ns_hash_insert(h,s);
+
+  if(!scc_ns_is_indexed(s)) return;
+  if(s->rid > 0) scc_ns_hash_insert(&ns->rid_hash,s);
+  if(s->addr >= 0) scc_ns_hash_insert(&ns->addr_hash,s);
+}
+
+// Remove a symbol from the hashes, the list is left to the caller
+static void scc_ns_unlink_sym(scc_ns_t* ns, scc_symbol_t* s) {
+  scc_ns_hash_remove(s->parent ? s->parent->childs_hash : &ns->glob_hash, s);
+
+  if(!scc_ns_is_indexed(s)) return;
+  if(s->rid > 0) scc_ns_hash_remove(&ns->rid_hash,s);
+  if(s->addr >= 0) scc_ns_hash_remove(&ns->addr_hash,s);
+}
+
+static scc_symbol_t* scc_ns_new_sym(char* sym, int type, int subtype) {
+  scc_symbol_t* s = calloc(1,sizeof(scc_symbol_t));
+  s->type = type;
+  s->subtype = subtype;
+  s->sym = strdup(sym);
+  s->hash = scc_ns_str_hash(sym);
+  return s;
+}
+
+//@}
+
 scc_ns_t* scc_ns_new(scc_target_t* target) {
   scc_ns_t* ns = calloc(1,sizeof(scc_ns_t));
   ns->target = target;
+  ns->glob_hash.chain = SCC_NS_HASH_NAME;
+  ns->rid_hash.chain = SCC_NS_HASH_RID;
+  ns->addr_hash.chain = SCC_NS_HASH_ADDR;
   return ns;
 }
 
 void scc_ns_free(scc_ns_t* ns) {
   scc_symbol_list_free(ns->glob_sym);
+  free(ns->glob_hash.bucket);
+  free(ns->rid_hash.bucket);
+  free(ns->addr_hash.bucket);
   free(ns);
 }
 
 scc_symbol_t* scc_ns_get_sym(scc_ns_t* ns, char* room, char* sym) {
   scc_symbol_t* r;
-  scc_symbol_t* cur;
+  // the symbol owning the scope we are looking in, NULL is global
+  scc_symbol_t* owner;
+  unsigned hash = scc_ns_str_hash(sym);
 
   if(room) {
-    for(r = ns->glob_sym ; r ; r = r->next) {
-      if(r->type != SCC_RES_ROOM) continue;
-      if(!strcmp(r->sym,room)) break;
-    }
+    r = scc_ns_hash_get(&ns->glob_hash,room,scc_ns_str_hash(room),
+                        SCC_RES_ROOM);
     if(!r) return NULL;
-    cur = r->childs;
+    return scc_ns_hash_get(r->childs_hash,sym,hash,-1);
   } else if(ns->cur) {
     if(ns->cur->childs)
-      cur = ns->cur->childs;
-    else if(ns->cur->parent)
-      cur = ns->cur->parent->childs;
+      owner = ns->cur;
     else
-      cur = ns->glob_sym;
-  } else {
-    cur = ns->glob_sym;
-  }
-    
-
-  while(cur) {
-    for(r = cur ; r ; r = r->next) {
-      if(strcmp(r->sym,sym)) continue;
-      return r;
-    }
-    // for full name we don't want to continue the search
-    if(room) break;
-    if(cur->parent) {
-      if(cur->parent->parent)
-	cur = cur->parent->parent->childs;
-      else
-	cur = ns->glob_sym;
-    } else
-      cur = NULL;
+      owner = ns->cur->parent;
+  } else
+    owner = NULL;
+
+  while(1) {
+    r = scc_ns_hash_get(owner ? owner->childs_hash : &ns->glob_hash,
+                        sym,hash,-1);
+    if(r) return r;
+    if(!owner) break;
+    owner = owner->parent;
   }
 
   return NULL;
@@ -138,6 +308,9 @@ scc_symbol_t* scc_ns_get_sym(scc_ns_t* ns, char* room, char* sym) {
 scc_symbol_t* scc_ns_get_sym_with_id(scc_ns_t* ns,int type, int id) {
   scc_symbol_t* r,*r2;
 
+  if(type != SCC_RES_LVAR && id > 0)
+    return scc_ns_hash_get_at(&ns->rid_hash,type,id);
+
   // room, verbs and variables are in the global ns
   if(scc_sym_is_global(type)) {
     for(r = ns->glob_sym ; r ; r = r->next) {
@@ -212,10 +385,7 @@ scc_symbol_t*  scc_ns_add_sym(scc_ns_t* ns, char* sym,
           status == 'E' ? "exported" : "imported",
           sym,type,subtype,addr);
 
-  rr = calloc(1,sizeof(scc_symbol_t));
-  rr->type = type;
-  rr->subtype = subtype;
-  rr->sym = strdup(sym);
+  rr = scc_ns_new_sym(sym,type,subtype);
   rr->addr = -1;
   rr->status = status;
 
@@ -226,14 +396,7 @@ scc_symbol_t*  scc_ns_add_sym(scc_ns_t* ns, char* sym,
     }
   }
 
-  if(ns->cur) {
-    rr->next = ns->cur->childs;
-    ns->cur->childs = rr;
-    rr->parent = ns->cur;
-  } else {
-    rr->next = ns->glob_sym;
-    ns->glob_sym = rr;
-  }
+  scc_ns_link_sym(ns,ns->cur,rr);
 
   return rr;
 }
@@ -272,10 +435,7 @@ scc_symbol_t* scc_ns_decl(scc_ns_t* ns, char* room, char* sym,
     }
   }
   
-  new = calloc(1,sizeof(scc_symbol_t));
-  new->type = type;
-  new->subtype = subtype;
-  new->sym = strdup(sym);
+  new = scc_ns_new_sym(sym,type,subtype);
 
   if(addr >= 0) {
     if(!scc_ns_set_sym_addr(ns,new,addr)) {
@@ -285,19 +445,8 @@ scc_symbol_t* scc_ns_decl(scc_ns_t* ns, char* room, char* sym,
   } else
       new->addr = addr;
 
-  if(room) {
-    new->next = rr->childs;
-    rr->childs = new;
-    new->parent = rr;
-  } else if(ns->cur) {
-    new->next = ns->cur->childs;
-    ns->cur->childs = new;
-    new->parent = ns->cur;
-  } else {
-    new->next = ns->glob_sym;
-    ns->glob_sym = new;
-  }
-    
+  scc_ns_link_sym(ns,room ? rr : ns->cur,new);
+
   return new;
   
 }
@@ -330,6 +479,7 @@ void scc_ns_clear(scc_ns_t* ns,int type) {
       continue;
     }
      
+    scc_ns_unlink_sym(ns,s);
     if(o) {
       o->next = s->next;
       scc_symbol_free(s);
@@ -365,11 +515,30 @@ int scc_ns_get_rid(scc_ns_t* ns, scc_symbol_t* s) {
 
   // bit variable have there own address space
   ns->rids[s->type]++;
-  s->rid = ns->rids[s->type];
+  scc_ns_set_sym_rid(ns,s,ns->rids[s->type]);
 
   return s->rid;
 }
 
+void scc_ns_set_sym_rid(scc_ns_t* ns, scc_symbol_t* s, int rid) {
+  if(s->rid == rid) return;
+
+  if(scc_ns_is_indexed(s) && s->rid > 0)
+    scc_ns_hash_remove(&ns->rid_hash,s);
+  s->rid = rid;
+  if(scc_ns_is_indexed(s) && s->rid > 0)
+    scc_ns_hash_insert(&ns->rid_hash,s);
+}
+
+// change the address of a symbol and keep the index up to date
+static void scc_ns_move_sym(scc_ns_t* ns, scc_symbol_t* s, int addr) {
+  if(scc_ns_is_indexed(s) && s->addr >= 0)
+    scc_ns_hash_remove(&ns->addr_hash,s);
+  s->addr = addr;
+  if(scc_ns_is_indexed(s) && s->addr >= 0)
+    scc_ns_hash_insert(&ns->addr_hash,s);
+}
+
 int scc_ns_set_sym_addr(scc_ns_t* ns, scc_symbol_t* s,int addr) {
   uint8_t* as = ns->as[s->type];
 
@@ -386,7 +555,7 @@ int scc_ns_set_sym_addr(scc_ns_t* ns, scc_symbol_t* s,int addr) {
   }
   as[addr/8] |= (1 << (addr%8));
 
-  s->addr = addr;
+  scc_ns_move_sym(ns,s,addr);
   return 1;
 }
 
@@ -400,7 +569,7 @@ int scc_ns_alloc_sym_addr(scc_ns_t* ns,scc_symbol_t* s,int* cur) {
     if(as[i/8] & (1 << (i%8))) continue;
     as[i/8] |= 1 << (i%8);
     cur[0]++;
-    s->addr = i;
+    scc_ns_move_sym(ns,s,i);
     return 1;
   }
   return 0;
@@ -435,7 +604,8 @@ int scc_ns_alloc_addr(scc_ns_t* ns) {
   return 1;
 }
 
-static int scc_symbol_get_addr_from(scc_symbol_t* s,scc_symbol_t* ref) {
+static int scc_symbol_get_addr_from(scc_ns_t* ns, scc_symbol_t* s,
+                                    scc_symbol_t* ref) {
   if(ref->addr < 0) {
     scc_log(LOG_ERR,"The symbol %s has no address in the src ns.\n",s->sym);
     return 0;
@@ -451,7 +621,7 @@ static int scc_symbol_get_addr_from(scc_symbol_t* s,scc_symbol_t* ref) {
     scc_log(LOG_ERR,"The symbol %s is not of the same type in src ns.\n",s->sym);
     return 0;
   }
-  s->addr = ref->addr;
+  scc_ns_move_sym(ns,s,ref->addr);
   return 1;
 }
 
@@ -465,7 +635,7 @@ int scc_ns_get_addr_from(scc_ns_t* ns,scc_ns_t* from) {
       scc_log(LOG_ERR,"Failed to find symbol %s in the scr ns.\n",r->sym);
       return 0;
     }
-    if(!scc_symbol_get_addr_from(r,ref)) return 0;
+    if(!scc_symbol_get_addr_from(ns,r,ref)) return 0;
     if(r->type == SCC_RES_ROOM) {
       for(s = r->childs ; s ; s = s->next) {
 	ref = scc_ns_get_sym(from,r->sym,s->sym);
@@ -474,7 +644,7 @@ int scc_ns_get_addr_from(scc_ns_t* ns,scc_ns_t* from) {
                   r->sym,s->sym);
 	  return 0;
 	}
-	if(!scc_symbol_get_addr_from(s,ref)) return 0;
+	if(!scc_symbol_get_addr_from(ns,s,ref)) return 0;
       }
     }
   }
@@ -516,6 +686,9 @@ int scc_ns_is_addr_alloc(scc_ns_t* ns,int type,int addr) {
 scc_symbol_t* scc_ns_get_sym_at(scc_ns_t* ns,int type,int addr) {
   scc_symbol_t* r,*r2;
 
+  if(type != SCC_RES_LVAR && addr >= 0)
+    return scc_ns_hash_get_at(&ns->addr_hash,type,addr);
+
   // room, verbs and variables are in the global ns
   if(scc_sym_is_global(type)) {
     for(r = ns->glob_sym ; r ; r = r->next) {
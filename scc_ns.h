@@ -23,11 +23,36 @@
  * @brief ScummC namespace
  */
 
+/// @name Symbol hash tables
+//@{
+/// Symbols of a scope by name
+#define SCC_NS_HASH_NAME 0
+/// Global and room symbols by type and RID
+#define SCC_NS_HASH_RID  1
+/// Global and room symbols by type and address
+#define SCC_NS_HASH_ADDR 2
+//@}
+
+typedef struct scc_ns_hash_st {
+  /// Which of the symbol hash chains is used
+  unsigned chain;
+  unsigned size, num;
+  scc_symbol_t** bucket;
+} scc_ns_hash_t;
+
 typedef struct scc_ns_st {
   /// Targeted VM version
   scc_target_t* target;
   /// Global symbol tree
   scc_symbol_t *glob_sym;
+  /// Global symbols by name
+  scc_ns_hash_t glob_hash;
+  /// Global and room symbols by type and RID
+  scc_ns_hash_t rid_hash;
+  /// Global and room symbols by type and address
+  scc_ns_hash_t addr_hash;
+  /// Insertion counter
+  unsigned seq;
   /// Current start point in the tree, NULL is global
   scc_symbol_t *cur;
   /// RID allocation
@@ -56,6 +81,8 @@ scc_symbol_t* scc_ns_decl(scc_ns_t* ns, char* room, char* sym,
 
 int scc_ns_get_rid(scc_ns_t* ns, scc_symbol_t* s);
 
+void scc_ns_set_sym_rid(scc_ns_t* ns, scc_symbol_t* s, int rid);
+
 int scc_ns_push(scc_ns_t* ns, scc_symbol_t* s);
 
 void scc_ns_clear(scc_ns_t* ns,int type);
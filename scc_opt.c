@@ -0,0 +1,547 @@
+/* ScummC
+ * Copyright (C) 2009  Alban Bedel
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/**
+ * @file scc_opt.c
+ * @ingroup scc
+ * @brief Peephole optimizer for the generated code
+ *
+ * The optimizer works on the instruction table recorded by the code
+ * generator. All the jumps are known from the relocation table, so
+ * instructions can be removed or rewritten and the jumps recomputed
+ * afterwards.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "scc_parse.h"
+#include "scc_ns.h"
+#include "scc_util.h"
+#include "scc_code.h"
+
+/// Instruction kinds
+#define OPT_NONE     0
+/// Unconditional jump
+#define OPT_JMP      1
+/// Conditional jump
+#define OPT_CJMP     2
+/// Begin override and its jump
+#define OPT_OVERRIDE 3
+/// Instruction jumping back to itself, ie. the wait ops
+#define OPT_SELF     4
+/// Script end
+#define OPT_RET      5
+
+// Assume that loops run this many times for the op estimation
+#define OPT_LOOP_WEIGHT 8
+
+typedef struct scc_opt_insn {
+  /// Offset in the original code
+  int off;
+  /// Length of the instruction
+  int len;
+  /// Instruction data, either in the original code or in buf
+  uint8_t* data;
+  /// Space for rewritten instructions
+  uint8_t buf[4];
+  /// Kind of instruction (OPT_*)
+  int kind;
+  /// Offset of the jump offset in the instruction or -1
+  int jmp;
+  /// Jump target as an instruction index
+  int target;
+  /// Number of jumps to this instruction
+  int label;
+  /// The instruction has some resource fix
+  char fix;
+  char dead;
+  char reach;
+} scc_opt_insn_t;
+
+typedef struct scc_opt {
+  scc_opt_insn_t* insn;
+  int num_insn;
+} scc_opt_t;
+
+// Find the first live instruction at or after i
+static int opt_live(scc_opt_t* o, int i) {
+  while(i < o->num_insn && o->insn[i].dead) i++;
+  return i;
+}
+
+static int opt_next(scc_opt_t* o, int i) {
+  return opt_live(o,i+1);
+}
+
+static int opt_find(scc_opt_t* o, int off) {
+  int a = 0, b = o->num_insn-1, m;
+
+  while(a <= b) {
+    m = (a+b)/2;
+    if(o->insn[m].off == off) return m;
+    if(o->insn[m].off < off) a = m+1;
+    else b = m-1;
+  }
+  return -1;
+}
+
+// Remove an instruction, its labels move to the next one
+static void opt_kill(scc_opt_t* o, int i) {
+  int n;
+
+  o->insn[i].dead = 1;
+  if(!o->insn[i].label) return;
+  n = opt_next(o,i);
+  if(n < o->num_insn) o->insn[n].label += o->insn[i].label;
+  o->insn[i].label = 0;
+}
+
+// Replace an instruction with some new code
+static void opt_set(scc_opt_insn_t* in, int len, int b0, int b1, int b2) {
+  in->buf[0] = b0;
+  in->buf[1] = b1;
+  in->buf[2] = b2;
+  in->data = in->buf;
+  in->len = len;
+  in->kind = OPT_NONE;
+  in->jmp = -1;
+  in->fix = 0;
+}
+
+static void opt_set_jump(scc_opt_t* o, int i, int op, int target) {
+  scc_opt_insn_t* in = &o->insn[i];
+
+  opt_set(in,3,op,0,0);
+  in->kind = op == SCC_OP_JMP ? OPT_JMP : OPT_CJMP;
+  in->jmp = 1;
+  in->target = target;
+  if(target < o->num_insn) o->insn[target].label++;
+}
+
+static int opt_is_push(scc_opt_insn_t* in, int* val) {
+  if(in->fix || in->kind != OPT_NONE) return 0;
+  if(in->len == 2 && in->data[0] == SCC_OP_PUSH_B) {
+    *val = in->data[1];
+    return 1;
+  }
+  if(in->len == 3 && in->data[0] == SCC_OP_PUSH) {
+    *val = SCC_GET_S16LE(in->data,1);
+    return 1;
+  }
+  return 0;
+}
+
+static int opt_set_push(scc_opt_insn_t* in, int val) {
+  if(val >= 0 && val <= 0xFF)
+    opt_set(in,2,SCC_OP_PUSH_B,val,0);
+  else if(val >= -0x8000 && val <= 0x7FFF)
+    opt_set(in,3,SCC_OP_PUSH,val & 0xFF,(val >> 8) & 0xFF);
+  else
+    return 0;
+  return 1;
+}
+
+static int opt_is_op(scc_opt_insn_t* in, int op) {
+  return in->len == 1 && in->kind == OPT_NONE && in->data[0] == op;
+}
+
+static int opt_fold(int op, int a, int b, int* r) {
+  switch(op) {
+  case SCC_OP_EQ:   *r = a == b; break;
+  case SCC_OP_NEQ:  *r = a != b; break;
+  case SCC_OP_G:    *r = a > b;  break;
+  case SCC_OP_L:    *r = a < b;  break;
+  case SCC_OP_LE:   *r = a <= b; break;
+  case SCC_OP_GE:   *r = a >= b; break;
+  case SCC_OP_ADD:  *r = a + b;  break;
+  case SCC_OP_SUB:  *r = a - b;  break;
+  case SCC_OP_MUL:  *r = a * b;  break;
+  case SCC_OP_DIV:
+    if(!b) return 0;
+    *r = a / b;
+    break;
+  case SCC_OP_LAND: *r = a && b; break;
+  case SCC_OP_LOR:  *r = a || b; break;
+  case SCC_OP_BAND: *r = a & b;  break;
+  case SCC_OP_BOR:  *r = a | b;  break;
+  default:
+    return 0;
+  }
+  return 1;
+}
+
+static int opt_invert_cmp(int op) {
+  switch(op) {
+  case SCC_OP_EQ:  return SCC_OP_NEQ;
+  case SCC_OP_NEQ: return SCC_OP_EQ;
+  case SCC_OP_G:   return SCC_OP_LE;
+  case SCC_OP_L:   return SCC_OP_GE;
+  case SCC_OP_LE:  return SCC_OP_G;
+  case SCC_OP_GE:  return SCC_OP_L;
+  }
+  return -1;
+}
+
+static int opt_invert_jump(int op) {
+  return op == SCC_OP_JZ ? SCC_OP_JNZ : SCC_OP_JZ;
+}
+
+static int opt_load(scc_opt_t* o, scc_code_t* code, uint8_t return_op) {
+  scc_opt_insn_t* in;
+  int i,n,f,off,dst;
+
+  o->insn = calloc(code->num_insn,sizeof(scc_opt_insn_t));
+  for(i = n = 0 ; i < code->num_insn ; i++) {
+    in = &o->insn[n++];
+    in->off = code->insn[i];
+    in->data = code->data + in->off;
+    in->jmp = -1;
+    // the jump after an override belong to it
+    if(in->data[0] == SCC_OP_OVERRIDE_BEGIN && i+1 < code->num_insn &&
+       code->data[code->insn[i+1]] == SCC_OP_JMP) {
+      in->kind = OPT_OVERRIDE;
+      i++;
+    }
+  }
+  o->num_insn = n;
+  for(i = 0 ; i < n ; i++)
+    o->insn[i].len = (i+1 < n ? o->insn[i+1].off : code->len) -
+      o->insn[i].off;
+
+  // dispatch the relocations
+  for(i = f = 0 ; f < code->num_fix ; f++) {
+    off = code->fix[f].off;
+    while(i+1 < n && o->insn[i+1].off <= off) i++;
+    in = &o->insn[i];
+    switch(code->fix[f].type) {
+    case SCC_FIX_JUMP:
+      if(in->jmp >= 0) return 0;
+      dst = off + 2 + SCC_GET_S16LE(code->data,off);
+      in->jmp = off - in->off;
+      if(dst == code->len)
+        in->target = n;
+      else if((in->target = opt_find(o,dst)) < 0) {
+        scc_log(LOG_DBG,"Jump at 0x%x doesn't land on an instruction.\n",off);
+        return 0;
+      }
+      break;
+    case SCC_FIX_BRANCH:
+      // unresolved branch, better leave this code alone
+      return 0;
+    default:
+      if(code->fix[f].type >= SCC_FIX_RES) in->fix = 1;
+    }
+  }
+
+  for(i = 0 ; i < n ; i++) {
+    in = &o->insn[i];
+    if(in->kind == OPT_OVERRIDE) continue;
+    if(in->jmp == 1 && in->len == 3 && in->data[0] == SCC_OP_JMP)
+      in->kind = OPT_JMP;
+    else if(in->jmp == 1 && in->len == 3 &&
+            (in->data[0] == SCC_OP_JZ || in->data[0] == SCC_OP_JNZ))
+      in->kind = OPT_CJMP;
+    else if(in->jmp >= 0)
+      in->kind = OPT_SELF;
+    else if(in->len == 1 && (in->data[0] == return_op ||
+                             in->data[0] == SCC_OP_SCR_RET ||
+                             in->data[0] == SCC_OP_VERB_RET))
+      in->kind = OPT_RET;
+  }
+
+  return 1;
+}
+
+static void opt_labels(scc_opt_t* o) {
+  int i,t;
+
+  for(i = 0 ; i < o->num_insn ; i++)
+    o->insn[i].label = 0;
+  for(i = opt_live(o,0) ; i < o->num_insn ; i = opt_next(o,i)) {
+    if(o->insn[i].jmp < 0) continue;
+    t = o->insn[i].target = opt_live(o,o->insn[i].target);
+    if(t < o->num_insn) o->insn[t].label++;
+  }
+}
+
+// Kill the instructions that can't be reached, return the
+// number of killed instructions.
+static int opt_reach(scc_opt_t* o) {
+  int* stack = malloc((o->num_insn+1)*sizeof(int));
+  int i,sp = 0,killed = 0;
+  scc_opt_insn_t* in;
+
+  for(i = 0 ; i < o->num_insn ; i++)
+    o->insn[i].reach = 0;
+
+  if((i = opt_live(o,0)) < o->num_insn) {
+    o->insn[i].reach = 1;
+    stack[sp++] = i;
+  }
+  while(sp > 0) {
+    in = &o->insn[stack[--sp]];
+    i = opt_next(o,in - o->insn);
+    if(i < o->num_insn && !o->insn[i].reach &&
+       in->kind != OPT_JMP && in->kind != OPT_RET) {
+      o->insn[i].reach = 1;
+      stack[sp++] = i;
+    }
+    if(in->jmp < 0) continue;
+    i = opt_live(o,in->target);
+    if(i < o->num_insn && !o->insn[i].reach) {
+      o->insn[i].reach = 1;
+      stack[sp++] = i;
+    }
+  }
+  free(stack);
+
+  for(i = 0 ; i < o->num_insn ; i++) {
+    if(o->insn[i].dead || o->insn[i].reach) continue;
+    opt_kill(o,i);
+    killed++;
+  }
+  return killed;
+}
+
+// Try the peephole patterns at instruction i,
+// return non-zero if something changed.
+static int opt_peephole(scc_opt_t* o, int i) {
+  scc_opt_insn_t *a = &o->insn[i], *b = NULL, *c = NULL;
+  int j,k,t,hops,va,vb,r;
+
+  j = opt_next(o,i);
+  k = j < o->num_insn ? opt_next(o,j) : o->num_insn;
+  if(j < o->num_insn && !o->insn[j].label) b = &o->insn[j];
+  if(b && k < o->num_insn && !o->insn[k].label) c = &o->insn[k];
+
+  if(a->kind == OPT_JMP || a->kind == OPT_CJMP || a->kind == OPT_OVERRIDE) {
+    // jump threading
+    t = a->target = opt_live(o,a->target);
+    for(hops = 0 ; hops < 16 && t < o->num_insn &&
+          o->insn[t].kind == OPT_JMP && o->insn[t].target != t ; hops++)
+      t = opt_live(o,o->insn[t].target);
+    if(t != a->target) {
+      a->target = t;
+      if(t < o->num_insn) o->insn[t].label++;
+      return 1;
+    }
+    // a jump to a return is a return
+    if(a->kind == OPT_JMP && t < o->num_insn &&
+       o->insn[t].kind == OPT_RET) {
+      opt_set(a,1,o->insn[t].data[0],0,0);
+      a->kind = OPT_RET;
+      return 1;
+    }
+    // jump to the next instruction
+    if(t == j && a->kind != OPT_OVERRIDE) {
+      if(a->kind == OPT_JMP)
+        opt_kill(o,i);
+      else // the condition must still be poped
+        opt_set(a,1,SCC_OP_POP,0,0);
+      return 1;
+    }
+    // jz l1 ; jmp l2 ; l1: -> jnz l2
+    if(a->kind == OPT_CJMP && b && b->kind == OPT_JMP && t == k) {
+      opt_set_jump(o,i,opt_invert_jump(a->data[0]),b->target);
+      opt_kill(o,j);
+      return 1;
+    }
+    return 0;
+  }
+
+  if(!b) return 0;
+
+  // not ; jz l -> jnz l
+  if(opt_is_op(a,SCC_OP_NOT) && b->kind == OPT_CJMP) {
+    opt_set_jump(o,i,opt_invert_jump(b->data[0]),b->target);
+    opt_kill(o,j);
+    return 1;
+  }
+
+  // eq ; not -> neq
+  if(a->len == 1 && a->kind == OPT_NONE &&
+     (r = opt_invert_cmp(a->data[0])) >= 0 && opt_is_op(b,SCC_OP_NOT)) {
+    opt_set(a,1,r,0,0);
+    opt_kill(o,j);
+    return 1;
+  }
+
+  // push ; pop
+  if(opt_is_op(b,SCC_OP_POP) &&
+     (opt_is_push(a,&va) || opt_is_op(a,SCC_OP_DUP) ||
+      (a->kind == OPT_NONE && a->len == 2 && a->data[0] == SCC_OP_VAR_READ_B) ||
+      (a->kind == OPT_NONE && a->len == 3 && a->data[0] == SCC_OP_VAR_READ))) {
+    opt_kill(o,i);
+    opt_kill(o,j);
+    return 1;
+  }
+
+  if(!opt_is_push(a,&va)) return 0;
+
+  // constant condition
+  if(b->kind == OPT_CJMP) {
+    if((b->data[0] == SCC_OP_JZ) == (va == 0))
+      opt_set_jump(o,i,SCC_OP_JMP,b->target);
+    else
+      opt_kill(o,i);
+    opt_kill(o,j);
+    return 1;
+  }
+
+  if(opt_is_op(b,SCC_OP_NOT)) {
+    opt_set_push(a,!va);
+    opt_kill(o,j);
+    return 1;
+  }
+
+  // constant folding
+  if(c && opt_is_push(b,&vb) && c->len == 1 && c->kind == OPT_NONE &&
+     opt_fold(c->data[0],va,vb,&r) && opt_set_push(a,r)) {
+    opt_kill(o,j);
+    opt_kill(o,k);
+    return 1;
+  }
+
+  return 0;
+}
+
+// Estimate the number of ops executed, each loop is assumed
+// to run OPT_LOOP_WEIGHT times.
+static int opt_count_ops(scc_opt_t* o) {
+  int* depth = calloc(o->num_insn+1,sizeof(int));
+  int i,j,w,ops = 0;
+
+  for(i = opt_live(o,0) ; i < o->num_insn ; i = opt_next(o,i)) {
+    scc_opt_insn_t* in = &o->insn[i];
+    if((in->kind != OPT_JMP && in->kind != OPT_CJMP) || in->target > i)
+      continue;
+    for(j = in->target ; j <= i ; j++) depth[j]++;
+  }
+
+  for(i = opt_live(o,0) ; i < o->num_insn ; i = opt_next(o,i)) {
+    for(w = 1, j = 0 ; j < depth[i] && j < 4 ; j++) w *= OPT_LOOP_WEIGHT;
+    ops += w;
+  }
+  free(depth);
+  return ops;
+}
+
+static void opt_store(scc_opt_t* o, scc_code_t* code) {
+  int* new_off = malloc((o->num_insn+1)*sizeof(int));
+  uint8_t* data;
+  scc_code_fix_t* fix;
+  int i,j,f,len,num_fix = 0,num_insn = 0,dst,pos;
+
+  for(i = len = 0 ; i < o->num_insn ; i++) {
+    new_off[i] = len;
+    if(!o->insn[i].dead) len += o->insn[i].len;
+  }
+  new_off[o->num_insn] = len;
+
+  data = malloc(len > 0 ? len : 1);
+  fix = malloc((code->num_fix + o->num_insn + 1)*sizeof(scc_code_fix_t));
+
+  for(i = j = f = 0 ; i < o->num_insn ; i++) {
+    scc_opt_insn_t* in = &o->insn[i];
+    int end = i+1 < o->num_insn ? o->insn[i+1].off : code->len;
+
+    // keep the resource fixes of the untouched instructions
+    for( ; f < code->num_fix && code->fix[f].off < end ; f++) {
+      if(in->dead || in->data == in->buf ||
+         code->fix[f].type < SCC_FIX_RES) continue;
+      fix[num_fix].off = new_off[i] + code->fix[f].off - in->off;
+      fix[num_fix].type = code->fix[f].type;
+      num_fix++;
+    }
+    if(in->dead) continue;
+
+    memcpy(data + new_off[i],in->data,in->len);
+    code->insn[num_insn++] = new_off[i];
+    if(in->kind == OPT_OVERRIDE)
+      code->insn[num_insn++] = new_off[i] + 1;
+    if(in->jmp < 0) continue;
+
+    // recompute the jump
+    pos = new_off[i] + in->jmp;
+    dst = new_off[opt_live(o,in->target)];
+    SCC_SET_S16LE(data,pos,dst - pos - 2);
+    // keep the fixes sorted
+    for(j = num_fix ; j > 0 && fix[j-1].off > pos ; j--)
+      fix[j] = fix[j-1];
+    fix[j].off = pos;
+    fix[j].type = SCC_FIX_JUMP;
+    num_fix++;
+  }
+
+  free(code->data);
+  free(code->fix);
+  code->data = data;
+  code->len = code->size = len;
+  code->fix = fix;
+  code->num_fix = num_fix;
+  code->fix_size = code->num_fix + o->num_insn + 1;
+  code->num_insn = num_insn;
+  free(new_off);
+}
+
+int scc_code_optimize(scc_code_t* code, uint8_t return_op,
+                      scc_code_stat_t* before, scc_code_stat_t* after) {
+  scc_opt_t opt;
+  int i,changed;
+
+  memset(&opt,0,sizeof(opt));
+  if(!opt_load(&opt,code,return_op)) {
+    free(opt.insn);
+    return 0;
+  }
+
+  if(before) {
+    before->size = code->len;
+    before->ops = opt_count_ops(&opt);
+  }
+
+  do {
+    changed = 0;
+    opt_labels(&opt);
+    for(i = opt_live(&opt,0) ; i < opt.num_insn ; ) {
+      if(opt_peephole(&opt,i)) {
+        changed = 1;
+        // retry at the same place
+        i = opt_live(&opt,i);
+      } else
+        i = opt_next(&opt,i);
+    }
+    if(opt_reach(&opt)) changed = 1;
+  } while(changed);
+
+  opt_store(&opt,code);
+
+  if(after) {
+    after->size = code->len;
+    after->ops = opt_count_ops(&opt);
+  }
+
+  free(opt.insn);
+  return 1;
+}
@@ -61,6 +61,7 @@
 //@}
 
 typedef struct scc_code_st scc_code_t;
+typedef struct scc_code_fix_st scc_code_fix_t;
 typedef struct scc_func_st scc_func_t;
 typedef struct scc_arg_st scc_arg_t;
 typedef struct scc_statement_st scc_statement_t;
@@ -121,12 +122,30 @@ typedef struct scc_verb_script_st scc_verb_script_t;
 #define SCC_OT_TERNARY 3
 //@}
 
-/// Code block
-struct scc_code_st {
-  scc_code_t* next;
+/// A relocation in a code buffer
+struct scc_code_fix_st {
+  /// Offset of the data to fix
+  int off;
+  /// Fix type, see SCC_FIX_*
+  int type;
+};
 
+/// Code buffer
+struct scc_code_st {
+  /// Bytecode
   uint8_t* data;
-  int fix,len;
+  /// Used and allocated size of the data
+  int len,size;
+
+  /// Relocation table, sorted by offset
+  scc_code_fix_t* fix;
+  /// Used and allocated size of the relocation table
+  int num_fix,fix_size;
+
+  /// Offset of each instruction
+  int* insn;
+  /// Used and allocated size of the instruction table
+  int num_insn,insn_size;
 };
 
 /// Function definition
@@ -248,6 +267,8 @@ struct scc_statement_st {
 #define SCC_FIX_NONE    0
 #define SCC_FIX_BRANCH  1
 #define SCC_FIX_RETURN  2
+/// 16 bit offset relative to its own end
+#define SCC_FIX_JUMP    3
 #define SCC_FIX_RES     0x100
 //@}
 
@@ -336,6 +357,19 @@ struct scc_symbol_st {
 
   /// Used by the linker
   char status;
+
+  /// @name Namespace indexes
+  /// Private to scc_ns.c
+  //@{
+  /// Hash of the name
+  unsigned hash;
+  /// Insertion order in the ns, 0 if the symbol is not in the ns yet
+  unsigned seq;
+  /// Hash chains, see SCC_NS_HASH_*
+  scc_symbol_t* hash_next[3];
+  /// Name hash of the childs
+  struct scc_ns_hash_st* childs_hash;
+  //@}
 };
 
 /// Symbol fix
@@ -77,6 +77,8 @@ typedef struct scc_parser {
   char do_deps;
   int num_deps;
   char** deps;
+  // parse tree of the current script
+  scc_arena_t* arena;
 } scc_parser_t;
 
 #define YYPARSE_PARAM v_sccp
@@ -104,10 +106,9 @@ static void scc_parser_find_res(scc_parser_t* p, char** file_ptr);
   if(a->type == SCC_ST_VAL &&                                 \
      b->type == SCC_ST_VAL) {                                 \
     a->val.i = ((int16_t)a->val.i) bop ((int16_t)b->val.i);   \
-    free(b);                                                  \
     d = a;                                                    \
   } else {                                                    \
-    d = calloc(1,sizeof(scc_statement_t));                    \
+    d = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));                    \
     d->type = SCC_ST_OP;                                      \
     d->val.o.type = SCC_OT_BINARY;                            \
     d->val.o.op = cop;                                        \
@@ -901,18 +902,20 @@ objectverbs: /* nothing */
 }
 | verbentrydecl '{' vardecl verbsblock '}'
 {
-  scc_verb_script_t* v,*l;
+  scc_verb_script_t* v;
   scc_script_t* scr;
 
-  for(v = $4 ; v ; l = v, v = v->next,free(l) ) {
+  for(v = $4 ; v ; v = v->next) {
     if(!sccp->do_deps && v->inst)
-      scr = scc_script_new(sccp->ns,v->inst,SCC_OP_VERB_RET,v->next ? 0 : 1);
+      scr = scc_script_new(sccp->ns,v->sym,v->inst,SCC_OP_VERB_RET,v->next ? 0 : 1);
     else
       scr = calloc(1,sizeof(scc_script_t));
     scr->sym = v->sym;
     if(!scc_roobj_obj_add_verb(sccp->obj,scr))
       SCC_ABORT(@1,"Failed to add verb %s.\n",v->sym ? v->sym->sym : "default");
-  }    
+  }
+  // the verbs code is generated, drop their parse tree
+  scc_arena_clear(sccp->arena);
   scc_ns_clear(sccp->ns,SCC_RES_LVAR);
   scc_ns_pop(sccp->ns);
 }
@@ -936,7 +939,7 @@ verbentrydecl: VERB '(' scriptargs ')'
 
 verbsblock: verbentry verbcode
 {
-  $$ = calloc(1,sizeof(scc_verb_script_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_verb_script_t));
   $$->sym = $1;
   $$->inst = $2;
 }
@@ -950,7 +953,7 @@ verbsblock: verbentry verbcode
                 $2 ? $2->sym : "default");
     if(!$1->next) break;
   }
-  $1->next = calloc(1,sizeof(scc_verb_script_t));
+  $1->next = scc_arena_alloc(sccp->arena,sizeof(scc_verb_script_t));
   $1 = $1->next;
   $1->sym = $2;
   $1->inst = $3;
@@ -1005,14 +1008,14 @@ scriptargs: /* */
   //if($1 == SCC_VAR_BIT)
   //  SCC_ABORT(@1,"Script argument can't be of bit type.\n");
 
-  $$ = malloc(sizeof(scc_scr_arg_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_scr_arg_t));
   $$->next = NULL;
   $$->type = $1 | $2;
   $$->sym = $3;
 }
 | scriptargs ',' TYPE typemod SYM
 {
-  scc_scr_arg_t *i,*a = malloc(sizeof(scc_scr_arg_t));
+  scc_scr_arg_t *i,*a = scc_arena_alloc(sccp->arena,sizeof(scc_scr_arg_t));
   a->next = NULL;
   a->type = $3 | $4;
   a->sym = $5;
@@ -1043,10 +1046,12 @@ scriptbody:  /* empty */
   if(sccp->do_deps)
     $$ = NULL;
   else {
-    $$ = scc_script_new(sccp->ns,$2,SCC_OP_SCR_RET,1);
+    $$ = scc_script_new(sccp->ns,sccp->ns->cur,$2,SCC_OP_SCR_RET,1);
     if(!$$)
       SCC_ABORT(@1,"Code generation failed.\n");
   }
+  // the code is generated, drop the parse tree
+  scc_arena_clear(sccp->arena);
 }
 ;
 
@@ -1111,7 +1116,7 @@ instruct: oneinstruct ';'
 
 oneinstruct: statements
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_ST;
   $$->pre = $1;
 }
@@ -1121,7 +1126,7 @@ oneinstruct: statements
   scc_loop_t* l = scc_loop_get($1,NULL);
   if(!l)
     SCC_ABORT(@1,"Invalid branch instruction.\n");
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_BRANCH;
   $$->subtype = $1;
 }
@@ -1131,7 +1136,7 @@ oneinstruct: statements
   scc_loop_t* l = scc_loop_get($1,$2);
   if(!l)
     SCC_ABORT(@1,"Invalid branch instruction.\n");
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_BRANCH;
   $$->subtype = $1;
   $$->sym = $2;
@@ -1139,7 +1144,7 @@ oneinstruct: statements
 
 | RETURN
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_BRANCH;
   $$->subtype = $1;
 }
@@ -1151,7 +1156,7 @@ oneinstruct: statements
     if(!l)
       SCC_ABORT(@1,"Invalid branch instruction.\n");
   }
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_BRANCH;
   $$->subtype = $1;
   $$->pre = $2;
@@ -1207,7 +1212,7 @@ loopblock: loophead body
 
 loophead: label FOR '(' opt_statements ';' statements ';' opt_statements ')'
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_FOR;
   $$->sym = $1;
   $$->pre = $4;
@@ -1218,7 +1223,7 @@ loophead: label FOR '(' opt_statements ';' statements ';' opt_statements ')'
 
 | label WHILE '(' statements ')'
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_WHILE;
   $$->sym = $1;
   $$->subtype = $2;
@@ -1229,7 +1234,7 @@ loophead: label FOR '(' opt_statements ';' statements ';' opt_statements ')'
 
 dohead: label DO
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_DO;
   $$->sym = $1;
   scc_loop_push($$->type,$$->sym);
@@ -1238,7 +1243,7 @@ dohead: label DO
 
 switchhead: label SWITCH '(' statements ')'
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_SWITCH;
   $$->sym = $1;
   $$->cond = $4;
@@ -1258,7 +1263,7 @@ label: /* nothing */
 
 cutsceneblock: CUTSCENE '(' cargs ')' body
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_CUTSCENE;
   $$->cond = $3;
   $$->body = $5;
@@ -1266,14 +1271,14 @@ cutsceneblock: CUTSCENE '(' cargs ')' body
 
 | TRY body
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_OVERRIDE;
   $$->body = $2;
 }
 
 | TRY body OVERRIDE body
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_OVERRIDE;
   $$->body = $2;
   $$->body2 = $4;
@@ -1282,7 +1287,7 @@ cutsceneblock: CUTSCENE '(' cargs ')' body
 
 switchblock: caseblock instructions
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_CASE;
   $$->cond = $1;
   $$->body = $2; 
@@ -1296,7 +1301,7 @@ switchblock: caseblock instructions
   if(!i->cond)
     SCC_ABORT(@2,"Case statements can't be added after a default.\n");
 
-  n = calloc(1,sizeof(scc_instruct_t));
+  n = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   n->type = SCC_INST_CASE;
   n->cond = $2;
   n->body = $3;
@@ -1333,7 +1338,7 @@ caseval: CASE statement ':'
 
 ifblock: IF '(' statements ')' body
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_IF;
   $$->subtype = $1;
   $$->cond = $3;
@@ -1342,7 +1347,7 @@ ifblock: IF '(' statements ')' body
 
 | IF '(' statements ')' body ELSE body
 {
-  $$ = calloc(1,sizeof(scc_instruct_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_instruct_t));
   $$->type = SCC_INST_IF;
   $$->subtype = $1;
   $$->cond = $3;
@@ -1363,7 +1368,7 @@ statements: statement
 
   // no chain yet, create it
   if($1->type != SCC_ST_CHAIN) {
-    $$ = calloc(1,sizeof(scc_statement_t));
+    $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
     $$->type = SCC_ST_CHAIN;
     // init the chain
     $$->val.l = $1;
@@ -1441,7 +1446,7 @@ statement: dval
       SCC_ABORT(@2,"Strings and lists can't be used inside a list.\n");
   }
 
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   $$->type = SCC_ST_LIST;
   $$->val.l = $2;
 }
@@ -1460,7 +1465,7 @@ statement: dval
   if($1->val.v.x && $3->type == SCC_ST_STR)
     SCC_ABORT(@1,"Strings can't be assigned to 2-dim arrays.\n");
 
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   $$->type = SCC_ST_OP;
   $$->val.o.type = SCC_OT_ASSIGN;
   $$->val.o.op = $2;
@@ -1471,7 +1476,7 @@ statement: dval
 
 | statement '?' statement ':' statement
 {
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   $$->type = SCC_ST_OP;
   $$->val.o.type = SCC_OT_TERNARY;
   $$->val.o.op = $2;
@@ -1502,14 +1507,14 @@ statement: dval
     SCC_ABORT(@1,"Internal error: isObjectOfClass not found.\n");
   
   // create the arguments
-  list = calloc(1,sizeof(scc_statement_t));
+  list = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   list->type = SCC_ST_LIST;
   list->val.l = $3;
   
   $1->next = list;
   
   // create the call
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   $$->type = SCC_ST_CALL;
   
   $$->val.c.func = f;
@@ -1589,7 +1594,7 @@ statement: dval
     $2->val.i = -$2->val.i;
     $$ = $2;
   } else { 
-    $$ = calloc(1,sizeof(scc_statement_t));
+    $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
     $$->type = SCC_ST_OP;
     $$->val.o.type = SCC_OT_UNARY;
     $$->val.o.op = $1;
@@ -1604,7 +1609,7 @@ statement: dval
     $2->val.i = ! $2->val.i;
     $$ = $2;
   } else { // we call not
-    $$ = calloc(1,sizeof(scc_statement_t));
+    $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
     $$->type = SCC_ST_OP;
     $$->val.o.type = SCC_OT_UNARY;
     $$->val.o.op = $1;
@@ -1618,7 +1623,7 @@ statement: dval
   if($2->type != SCC_ST_VAR)
     SCC_ABORT(@1,"Suffix operators can only be used on variables.\n");
 
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   $$->type = SCC_ST_OP;
   $$->val.o.type = SCC_OT_UNARY;
   $$->val.o.op = ($1 == INC ? PREINC : PREDEC);
@@ -1631,7 +1636,7 @@ statement: dval
   if($1->type != SCC_ST_VAR)
     SCC_ABORT(@1,"Suffix operators can only be used on variables.\n");
 
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   $$->type = SCC_ST_OP;
   $$->val.o.type = SCC_OT_UNARY;
   $$->val.o.op = ($2 == INC) ? POSTINC : POSTDEC;
@@ -1655,7 +1660,7 @@ var: SYM
   if(!v)
     SCC_ABORT(@1,"%s is not a declared resource.\n",$1);
 
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   if(scc_sym_is_var(v->type)) {
     $$->type = SCC_ST_VAR;
     $$->val.v.r = v;
@@ -1676,7 +1681,7 @@ var: SYM
   if(!v)
     SCC_ABORT(@1,"%s::%s is not a declared resource.\n",$1,$3);
 
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   if(scc_sym_is_var(v->type)) {
     $$->type = SCC_ST_VAR;
     $$->val.v.r = v;
@@ -1711,11 +1716,11 @@ call: SYM '(' cargs ')'
     if(!s->rid) scc_ns_get_rid(sccp->ns,s);
 
     // create the arguments
-    scr = calloc(1,sizeof(scc_statement_t));
+    scr = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
     scr->type = SCC_ST_RES;
     scr->val.r = s;
 
-    list = calloc(1,sizeof(scc_statement_t));
+    list = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
     list->type = SCC_ST_LIST;
     list->val.l = $3;
 
@@ -1725,7 +1730,7 @@ call: SYM '(' cargs ')'
     user_script = 1;
   }
 
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   $$->type = SCC_ST_CALL;
 
   $$->val.c.func = f;
@@ -1762,17 +1767,17 @@ call: SYM '(' cargs ')'
   if(!s->rid) scc_ns_get_rid(sccp->ns,s);
 
   // create the arguments
-  scr = calloc(1,sizeof(scc_statement_t));
+  scr = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   scr->type = SCC_ST_RES;
   scr->val.r = s;
   
-  list = calloc(1,sizeof(scc_statement_t));
+  list = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   list->type = SCC_ST_LIST;
   list->val.l = $5;
   
   scr->next = list;
 
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   $$->type = SCC_ST_CALL;
 
   $$->val.c.func = f;
@@ -1846,11 +1851,11 @@ isarg: SYM
   if(!sym->rid) scc_ns_get_rid(sccp->ns,sym);
   
   // the arg is the class id + 0x80
-  clsid = calloc(1,sizeof(scc_statement_t));
+  clsid = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   clsid->type = SCC_ST_RES;
   clsid->val.r = sym;
   
-  bit = calloc(1,sizeof(scc_statement_t));
+  bit = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   bit->type = SCC_ST_VAL;
   bit->val.i = 0x80;
   
@@ -1871,7 +1876,7 @@ isarg: SYM
   if(!sym->rid) scc_ns_get_rid(sccp->ns,sym);
   
   // the arg is simply the class id
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   $$->type = SCC_ST_RES;
   $$->val.r = sym;
 }
@@ -1879,14 +1884,14 @@ isarg: SYM
 
 dval: INTEGER
 {
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   $$->type = SCC_ST_VAL;
   $$->val.i = $1;
 }
 
 | string
 {
-  $$ = calloc(1,sizeof(scc_statement_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_statement_t));
   $$->type = SCC_ST_STR;
   $$->val.s = $1;
 };
@@ -1906,7 +1911,7 @@ string: str
 
 str: STRING
 {
-  $$ = calloc(1,sizeof(scc_str_t));
+  $$ = scc_arena_alloc(sccp->arena,sizeof(scc_str_t));
   $$->type = SCC_STR_CHAR;
   $$->str = $1;
 }
@@ -2043,9 +2048,14 @@ scc_source_t* scc_parser_parse(scc_parser_t* sccp,char* file,char do_deps) {
   sccp->local_scr = sccp->target->max_global_scr;
   sccp->cycl = 1;
   sccp->do_deps = do_deps;
+  sccp->arena->num_alloc = sccp->arena->num_block = 0;
 
   if(scc_parser_parse_internal(sccp)) return NULL;
 
+  scc_log(LOG_V,"%s: %u parse tree nodes in %u blocks\n",file,
+          sccp->arena->num_alloc,sccp->arena->num_block);
+  scc_arena_clear(sccp->arena);
+
   if(sccp->lex->error) {
     scc_log(LOG_ERR,"%s: %s\n",scc_lex_get_file(sccp->lex),sccp->lex->error);
     return NULL;
@@ -2076,6 +2086,7 @@ scc_parser_t* scc_parser_new(char** include, char** res_path,
   p->lex = scc_lex_new(scc_main_lexer,set_start_pos,set_end_pos,include);
   p->lex->userdata = p;
   p->res_path = res_path;
+  p->arena = scc_arena_new(0);
   return p;
 }
 
@@ -2097,6 +2108,7 @@ static scc_param_t scc_parse_params[] = {
   { "I", SCC_PARAM_STR_LIST, 0, 0, &scc_include },
   { "R", SCC_PARAM_STR_LIST, 0, 0, &scc_res_path },
   { "d", SCC_PARAM_FLAG, 0, 1, &scc_do_deps },
+  { "O", SCC_PARAM_FLAG, 0, 1, &scc_code_opt_level },
   { "v", SCC_PARAM_FLAG, LOG_MSG, LOG_V, &scc_log_level },
   { "vv", SCC_PARAM_FLAG, LOG_MSG, LOG_DBG, &scc_log_level },
   { "V", SCC_PARAM_INT, 6, 7, &scc_vm_version },
@@ -2126,6 +2138,9 @@ int main (int argc, char** argv) {
     src->next = srcs;
     srcs = src;
   }
+  // the parse trees are all gone now
+  scc_arena_free(sccp->arena);
+  sccp->arena = NULL;
 
   out = scc_output ? scc_output : "output.roobj";
   out_fd = new_scc_fd(out,O_WRONLY|O_CREAT|O_TRUNC,0);
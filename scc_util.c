@@ -123,6 +123,73 @@ scc_data_t* scc_data_load(char* path) {
   return data;
 }
 
+#define SCC_ARENA_ALIGN(x) (((x) + 7) & ~7)
+
+scc_arena_t* scc_arena_new(unsigned block_size) {
+  scc_arena_t* a = calloc(1,sizeof(scc_arena_t));
+  a->block_size = block_size > 0 ? block_size : 16*1024;
+  return a;
+}
+
+void* scc_arena_alloc(scc_arena_t* a, unsigned size) {
+  scc_arena_block_t* b = a->blocks;
+  void* ptr;
+
+  size = SCC_ARENA_ALIGN(size);
+  if(!b || b->used + size > b->size) {
+    unsigned bsize = size > a->block_size ? size : a->block_size;
+    b = malloc(sizeof(scc_arena_block_t) + bsize);
+    b->size = bsize;
+    b->used = 0;
+    // oversized blocks go after the current one to not waste it
+    if(bsize > a->block_size && a->blocks) {
+      b->next = a->blocks->next;
+      a->blocks->next = b;
+    } else {
+      b->next = a->blocks;
+      a->blocks = b;
+    }
+    a->num_block++;
+  }
+
+  ptr = b->data + b->used;
+  b->used += size;
+  a->num_alloc++;
+  memset(ptr,0,size);
+  return ptr;
+}
+
+void scc_arena_clear(scc_arena_t* a) {
+  scc_arena_block_t *b, *keep = NULL;
+
+  while(a->blocks) {
+    b = a->blocks;
+    a->blocks = b->next;
+    // keep a standard block for the next round
+    if(!keep && b->size == a->block_size)
+      keep = b;
+    else
+      free(b);
+  }
+
+  if(keep) {
+    keep->next = NULL;
+    keep->used = 0;
+    a->blocks = keep;
+  }
+}
+
+void scc_arena_free(scc_arena_t* a) {
+  scc_arena_block_t* b;
+
+  while(a->blocks) {
+    b = a->blocks->next;
+    free(a->blocks);
+    a->blocks = b;
+  }
+  free(a);
+}
+
 //
 // Windows glob implementation from SoX.
 //
@@ -196,6 +196,31 @@ int asprintf(char **strp, const char *fmt, ...);
 
 scc_data_t* scc_data_load(char* path);
 
+// Simple memory arena, everything allocated from it is released at once.
+typedef struct scc_arena_block_st scc_arena_block_t;
+struct scc_arena_block_st {
+  scc_arena_block_t* next;
+  unsigned size,used;
+  uint8_t data[0];
+};
+
+typedef struct scc_arena {
+  scc_arena_block_t* blocks;
+  unsigned block_size;
+  // stats
+  unsigned num_alloc,num_block;
+} scc_arena_t;
+
+scc_arena_t* scc_arena_new(unsigned block_size);
+
+// Return zeroed memory
+void* scc_arena_alloc(scc_arena_t* a, unsigned size);
+
+// Release all allocations but keep a block around for reuse
+void scc_arena_clear(scc_arena_t* a);
+
+void scc_arena_free(scc_arena_t* a);
+
 
 #ifdef IS_MINGW
 
@@ -34,6 +34,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/time.h>
+#include <time.h>
 
 #include <SDL.h>
 
@@ -188,8 +190,6 @@ static void scvm_vars_init(scvm_vars_t* var) {
   //             50 = MAC
   //             82 = Amiga
   var->videomode = 19;
-  // Heap size
-  var->heap_space = 1400;
   // Playing from HD
   var->fixed_disk = 1;
   // Input mode: 0 = keyboard
@@ -206,7 +206,7 @@ static void scvm_vars_init(scvm_vars_t* var) {
 }
 
 scvm_t *scvm_new(scvm_backend_t* be, char* path,char* basename,
-                 uint8_t key, int boot_param) {
+                 uint8_t key, int boot_param, unsigned num_thread) {
   scc_fd_t* fd;
   scvm_t* vm;
   int i,num,len = (path ? strlen(path) + 1 : 0) + strlen(basename);
@@ -282,7 +282,7 @@ scvm_t *scvm_new(scvm_backend_t* be, char* path,char* basename,
   scc_fd_r16le(fd);
   // rooms
   scvm_res_init(&vm->res[SCVM_RES_ROOM],"room",scc_fd_r16le(fd),
-                scvm_load_room,NULL);
+                scvm_load_room,scvm_nuke_room);
   // scripts
   scvm_res_init(&vm->res[SCVM_RES_SCRIPT],"script",scc_fd_r16le(fd),
                 scvm_load_script,free);
@@ -290,10 +290,10 @@ scvm_t *scvm_new(scvm_backend_t* be, char* path,char* basename,
   scvm_res_init(&vm->res[SCVM_RES_SOUND],"sound",scc_fd_r16le(fd),NULL,NULL);
   // charsets
   scvm_res_init(&vm->res[SCVM_RES_CHARSET],"charset",scc_fd_r16le(fd),
-                scvm_load_charset,NULL);
+                scvm_load_charset,scvm_nuke_charset);
   // costumes
   scvm_res_init(&vm->res[SCVM_RES_COSTUME],"costume",scc_fd_r16le(fd),
-                scvm_load_costume,NULL);
+                scvm_load_costume,scvm_nuke_costume);
   // objects
   scvm_res_init(&vm->res[SCVM_RES_OBJECT],"object",scc_fd_r16le(fd),NULL,NULL);
   vm->num_object = vm->res[SCVM_RES_OBJECT].num;
@@ -327,6 +327,7 @@ scvm_t *scvm_new(scvm_backend_t* be, char* path,char* basename,
   vm->basename = strdup(basename);
   vm->file_key = key;
   vm->file = calloc(vm->num_file,sizeof(scc_fd_t*));
+  vm->res_budget = SCVM_RES_BUDGET;
   vm->file[0] = fd;
   // all 0 ??
   for(i = 0 ; i < num ; i++)
@@ -425,14 +426,11 @@ scvm_t *scvm_new(scvm_backend_t* be, char* path,char* basename,
   vm->view = calloc(1,sizeof(scvm_view_t));
   vm->view->screen_width = 320;
   vm->view->screen_height = 200;
+  scc_cost_cache_init(&vm->view->cost_cache,SCVM_COST_CACHE_SIZE);
   
   // threads
   vm->state = SCVM_BOOT;
-  vm->num_thread = 16;
-  vm->current_thread = NULL;
-  vm->thread = calloc(vm->num_thread,sizeof(scvm_thread_t));
-  for(i = 0 ; i < vm->num_thread ; i++)
-    vm->thread[i].id = i;
+  scvm_init_threads(vm,num_thread);
   vm->optable = scvm_optable;
   vm->suboptable = scvm_suboptable;
   // stack
@@ -476,6 +474,13 @@ int scvm_add_breakpoint(scvm_t* vm, unsigned room_id,
   bp->room_id = room_id;
   bp->script_id = script_id;
   bp->pos = pos;
+
+  // flag the script if it is already running
+  for(id = 0 ; id < vm->num_thread ; id++)
+    if(vm->thread[id].state != SCVM_THREAD_STOPPED &&
+       vm->thread[id].script->id == script_id)
+      vm->thread[id].script->flags |= SCVM_SCRIPT_BREAKPOINT;
+
   return bp->id;
 }
 
@@ -504,7 +509,8 @@ void scvm_sleep(scvm_t* vm, unsigned delay) {
 }
 
 void scvm_flip(scvm_t* vm) {
-  vm->backend->flip(vm->backend->priv);
+  if(vm->view->num_dirty) vm->num_frame++;
+  vm->backend->flip(vm->backend->priv,vm->view->dirty,vm->view->num_dirty);
 }
 
 void scvm_uninit_video(scvm_t* vm) {
@@ -513,6 +519,7 @@ void scvm_uninit_video(scvm_t* vm) {
 
 void scvm_check_events(scvm_t* vm) {
   vm->backend->check_events(vm->backend->priv,vm);
+  scvm_input_feed(vm);
 }
 
 unsigned scvm_pause(scvm_t* vm) {
@@ -527,6 +534,7 @@ unsigned scvm_pause(scvm_t* vm) {
 }
 
 void scvm_press_key(scvm_t* vm, uint8_t key) {
+  if(!scvm_input_event(vm,SCVM_INPUT_KEY_DOWN,key,0)) return;
   if(vm->state == SCVM_PAUSE  ||
      (vm->var->pause_key != -1 && key == vm->var->pause_key))
     scvm_pause(vm);
@@ -535,21 +543,23 @@ void scvm_press_key(scvm_t* vm, uint8_t key) {
 }
 
 void scvm_release_key(scvm_t* vm, uint8_t key) {
+  if(!scvm_input_event(vm,SCVM_INPUT_KEY_UP,key,0)) return;
   vm->key_state[key>>3] &= ~(1<<(key&7));
 }
 
 void scvm_press_button(scvm_t* vm, int btn) {
-  if(btn > 3) return;
+  if(btn > 3 || !scvm_input_event(vm,SCVM_INPUT_BUTTON_DOWN,btn,0)) return;
   vm->btnpress = btn;
   vm->btn_state |= 1<<btn;
 }
 
 void scvm_release_button(scvm_t* vm, int btn) {
-  if(btn > 3) return;
+  if(btn > 3 || !scvm_input_event(vm,SCVM_INPUT_BUTTON_UP,btn,0)) return;
   vm->btn_state &= ~(1<<btn);
 }
 
 void scvm_set_mouse_position(scvm_t* vm, int x, int y) {
+    if(!scvm_input_event(vm,SCVM_INPUT_MOUSE,x,y)) return;
     if(x < 0)
         x = 0;
     else if(x >= vm->view->screen_width)
@@ -564,7 +574,7 @@ void scvm_set_mouse_position(scvm_t* vm, int x, int y) {
 
 static void scvm_switch_to_thread(scvm_t* vm,unsigned thid, unsigned next_state) {
   if(vm->current_thread)
-    vm->current_thread->state = SCVM_THREAD_PENDED;
+    scvm_thread_set_state(vm,vm->current_thread,SCVM_THREAD_PENDED);
   vm->thread[thid].parent = vm->current_thread;
   vm->thread[thid].next_state = next_state;
   vm->current_thread = &vm->thread[thid];
@@ -572,12 +582,12 @@ static void scvm_switch_to_thread(scvm_t* vm,unsigned thid, unsigned next_state)
 }
 
 int scvm_run_threads(scvm_t* vm,unsigned cycles) {
-  int i=0,r;
-  unsigned delta,now;
+  int r;
+  unsigned now;
   scvm_thread_t* parent;
   
   while(cycles > 0) {
-    scc_log(LOG_MSG,"VM run threads state: %d\n",vm->state);
+    scvm_trace(vm,"VM run threads state: %d\n",vm->state);
     switch(vm->state) {
     case SCVM_BOOT:
       if(!scvm_init_video(vm,640,480,8)) {
@@ -597,19 +607,7 @@ int scvm_run_threads(scvm_t* vm,unsigned cycles) {
       // Reschedule the delayed threads
       now = scvm_get_time(vm);
       if(now < vm->time) now = vm->time;
-      delta = now - vm->time;
-      for(i = 0 ; i < vm->num_thread ; i++) {
-        if(vm->thread[i].state != SCVM_THREAD_DELAYED) continue;
-        if(!(vm->thread[i].flags & SCVM_THREAD_DELAY))
-          vm->thread[i].flags |= SCVM_THREAD_DELAY;
-        else if(vm->thread[i].delay > delta)
-          vm->thread[i].delay -= delta;
-        else {
-          vm->thread[i].delay = 0;
-          vm->thread[i].flags &= ~SCVM_THREAD_DELAY;
-          vm->thread[i].state = SCVM_THREAD_RUNNING;
-        }
-      }
+      scvm_thread_wake_up(vm,now);
       // Update the timers
       vm->var->timer = 0;
       vm->var->timer1 += vm->var->timer_next;
@@ -636,41 +634,38 @@ int scvm_run_threads(scvm_t* vm,unsigned cycles) {
       vm->current_thread = vm->next_thread;
       vm->next_thread = NULL;
       vm->current_thread->parent = parent;
-      if(parent) parent->state = SCVM_THREAD_PENDED;
+      if(parent) scvm_thread_set_state(vm,parent,SCVM_THREAD_PENDED);
       vm->state = SCVM_RUNNING;
     case SCVM_RUNNING:
-      if(!vm->current_thread) {
-        for(i = 0 ; i < vm->num_thread ; i++)
-          if(vm->thread[i].state == SCVM_THREAD_RUNNING &&
-             vm->thread[i].cycle <= vm->cycle) break;
-        if(i >= vm->num_thread) {
-          vm->state = SCVM_FINISHED_SCRIPTS;
-          break;
-        }
-        vm->current_thread = &vm->thread[i];
+      if(!vm->current_thread &&
+         !(vm->current_thread = scvm_next_thread(vm))) {
+        vm->state = SCVM_FINISHED_SCRIPTS;
+        break;
       }
-      scc_log(LOG_MSG,"\n == VM enter thread %d / script %d @ 0x%x / room %d ==\n",
-              vm->current_thread->id,vm->current_thread->script->id,
-              vm->current_thread->code_ptr,
-              vm->room ? vm->room->id : -1);
+      scvm_trace(vm,"\n == VM enter thread %d / script %d @ 0x%x / room %d ==\n",
+                 vm->current_thread->id,vm->current_thread->script->id,
+                 vm->current_thread->code_ptr,
+                 vm->room ? vm->room->id : -1);
       r = scvm_thread_run(vm,vm->current_thread);
-      scc_log(LOG_MSG," == VM leave thread %d / script %d @ 0x%x / room %d ==\n\n",
-              vm->current_thread->id,vm->current_thread->script->id,
-              vm->current_thread->code_ptr,
-              vm->room ? vm->room->id : -1);
+      scvm_trace(vm," == VM leave thread %d / script %d @ 0x%x / room %d ==\n\n",
+                 vm->current_thread->id,vm->current_thread->script->id,
+                 vm->current_thread->code_ptr,
+                 vm->room ? vm->room->id : -1);
       if(r < 0) return r; // error
       if(r > 0) {         // switch state
+        scvm_thread_schedule(vm,vm->current_thread);
         vm->state = r;
         break;
       }
       // Done with this thread for this cycle
       if(vm->current_thread->cycle <= vm->cycle)
         vm->current_thread->cycle = vm->cycle+1;
+      scvm_thread_schedule(vm,vm->current_thread);
       // Continue a job
       if(vm->current_thread->next_state) {
         vm->state = vm->current_thread->next_state;
         parent = vm->current_thread->parent;
-        if(parent) parent->state = SCVM_THREAD_RUNNING;
+        if(parent) scvm_thread_set_state(vm,parent,SCVM_THREAD_RUNNING);
         vm->current_thread->next_state = 0;
         vm->current_thread->parent = NULL;
         vm->current_thread = parent;
@@ -681,7 +676,7 @@ int scvm_run_threads(scvm_t* vm,unsigned cycles) {
          vm->current_thread->parent->state == SCVM_THREAD_PENDED) {
         parent = vm->current_thread->parent;
         vm->current_thread->parent = NULL;
-        parent->state = SCVM_THREAD_RUNNING;
+        scvm_thread_set_state(vm,parent,SCVM_THREAD_RUNNING);
         vm->current_thread = parent;
         break;
       } else {
@@ -735,6 +730,7 @@ int scvm_run_threads(scvm_t* vm,unsigned cycles) {
         vm->var->camera_max_x = room->width - vm->var->camera_min_x;
         vm->var->room = room->id;
         vm->room = room;
+        scvm_prefetch_room(vm,room);
         vm->view->camera_x = vm->var->camera_min_x;
         vm->view->camera_x = vm->var->camera_min_x;
         vm->var->camera_pos_x = vm->view->camera_x;
@@ -983,9 +979,11 @@ int scvm_run_once(scvm_t* vm) {
   if(vm->view->flags & SCVM_VIEW_PALETTE_CHANGED) {
     scvm_update_palette(vm,vm->view->palette);
     vm->view->flags &= ~SCVM_VIEW_PALETTE_CHANGED;
+    vm->view->flags |= SCVM_VIEW_FLIP_ALL;
   }
 
   scvm_draw(vm,vm->view);
+  scvm_frame_hash(vm);
 
   end = scvm_get_time(vm);
   if(end < start) end = start;
@@ -1092,8 +1090,21 @@ static void sdl_scvm_sleep(scvm_backend_sdl_t* be, unsigned delay) {
   SDL_Delay(delay);
 }
 
-static void sdl_scvm_flip(scvm_backend_sdl_t* be) {
-  SDL_Flip(be->screen);
+static void sdl_scvm_flip(scvm_backend_sdl_t* be,
+                          scvm_rect_t* rect, unsigned num_rect) {
+  SDL_Rect sdl_rect[SCVM_VIEW_MAX_DIRTY];
+  int i;
+  if(num_rect > SCVM_VIEW_MAX_DIRTY) {
+    SDL_Flip(be->screen);
+    return;
+  }
+  for(i = 0 ; i < num_rect ; i++) {
+    sdl_rect[i].x = rect[i].x1;
+    sdl_rect[i].y = rect[i].y1;
+    sdl_rect[i].w = rect[i].x2 - rect[i].x1;
+    sdl_rect[i].h = rect[i].y2 - rect[i].y1;
+  }
+  SDL_UpdateRects(be->screen,num_rect,sdl_rect);
 }
 
 static unsigned sdl_scvm_get_time(scvm_backend_sdl_t* be) {
@@ -1159,12 +1170,43 @@ static char* basedir = NULL;
 static int file_key = 0;
 static int boot_param = 0;
 static int run_debugger = 0;
+static int trace = 0;
+static int num_thread = 64;
+static int heap_size = SCVM_RES_BUDGET/1024;
+static int full_redraw = 0;
+static int prefetch = 0;
+static char** prefetch_hints = NULL;
+static int headless = 0;
+static int render = 0;
+static int time_step = SCVM_HEADLESS_TIME_STEP;
+static int max_cycles = 0;
+static char* record_file = NULL;
+static char* replay_file = NULL;
+static char* frame_hash_file = NULL;
+static int seed = 0;
+static char* profile_file = NULL;
 
 static scc_param_t scc_parse_params[] = {
   { "dir", SCC_PARAM_STR, 0, 0, &basedir },
   { "key", SCC_PARAM_INT, 0, 0xFF, &file_key },
   { "boot", SCC_PARAM_INT, 0, 0xFFFF, &boot_param },
   { "dbg", SCC_PARAM_FLAG, 0, 1, &run_debugger },
+  { "trace", SCC_PARAM_FLAG, 0, 1, &trace },
+  { "threads", SCC_PARAM_INT, 1, 4096, &num_thread },
+  { "redraw", SCC_PARAM_FLAG, 0, 1, &full_redraw },
+  { "heap", SCC_PARAM_INT, 64, 1024*1024, &heap_size },
+  { "prefetch", SCC_PARAM_FLAG, 0, 1, &prefetch },
+  { "prefetch-hint", SCC_PARAM_STR_LIST, 0, 0, &prefetch_hints },
+  { "headless", SCC_PARAM_FLAG, 0, 1, &headless },
+  { "render", SCC_PARAM_FLAG, 0, 1, &render },
+  { "time-step", SCC_PARAM_INT, 1, 1000, &time_step },
+  { "cycles", SCC_PARAM_INT, 0, 0x7FFFFFFF, &max_cycles },
+  { "record", SCC_PARAM_STR, 0, 0, &record_file },
+  { "replay", SCC_PARAM_STR, 0, 0, &replay_file },
+  { "frame-hash", SCC_PARAM_STR, 0, 0, &frame_hash_file },
+  { "seed", SCC_PARAM_INT, 0, 0x7FFFFFFF, &seed },
+  { "profile", SCC_PARAM_STR, 0, 0, &profile_file },
+  { "v", SCC_PARAM_FLAG, LOG_MSG, LOG_V, &scc_log_level },
   { "help", SCC_PARAM_HELP, 0, 0, &scvm_help },
   { NULL, 0, 0, 0, NULL }
 };
@@ -1174,21 +1216,77 @@ int main(int argc,char** argv) {
   scvm_t* vm;
   scc_cl_arg_t* files;
   scvm_backend_t backend = { sdl_backend_init };
+  struct timeval start, end;
+  double elapsed;
+  int r = 0;
 
   files = scc_param_parse_argv(scc_parse_params,argc-1,&argv[1]);
   if(!files) scc_print_help(&scvm_help,1);
 
-  vm = scvm_new(&backend,basedir,files->val,file_key,boot_param);
+  if(headless)
+    backend.init = scvm_headless_backend_init;
+
+  vm = scvm_new(&backend,basedir,files->val,file_key,boot_param,
+                num_thread);
 
   if(!vm) {
     scc_log(LOG_ERR,"Failed to create VM.\n");
     return 1;
   }
   scc_log(LOG_MSG,"VM created.\n");
+  if(headless)
+    scvm_headless_setup(&backend,time_step,render || frame_hash_file);
 
+  if(replay_file && !scvm_input_replay(vm,replay_file,(unsigned*)&seed))
+    return 1;
+  if(record_file) {
+    if(!seed) seed = time(NULL);
+    if(!scvm_input_record(vm,record_file,seed))
+      return 1;
+  }
+  if(seed) srand(seed);
+  if(frame_hash_file && !scvm_frame_hash_open(vm,frame_hash_file))
+    return 1;
+  vm->trace = trace;
+  if(full_redraw)
+    vm->view->flags |= SCVM_VIEW_ALWAYS_REDRAW;
+  vm->res_budget = heap_size*1024;
+  if(prefetch && !scvm_prefetch_init(vm,prefetch_hints))
+    return 1;
+
+  if(profile_file)
+    scvm_profile_start(vm);
+
+  gettimeofday(&start,NULL);
   if(run_debugger)
     scvm_debugger(vm);
-  else
+  else if(max_cycles) {
+    while(r >= 0 && vm->cycle < max_cycles)
+      r = scvm_run_once(vm);
+  } else
     scvm_run(vm);
+  gettimeofday(&end,NULL);
+
+  scvm_input_close(vm);
+  if(profile_file) {
+    scvm_profile_stop(vm);
+    scvm_profile_report(vm,stdout,20);
+    scvm_profile_write_stacks(vm,profile_file);
+  }
+
+  scc_log(LOG_V,"VM stopped after %u cycles and %u ops.\n",
+          vm->cycle,vm->num_op);
+  scc_log(LOG_V,"Costume cache: %u hits, %u misses.\n",
+          vm->view->cost_cache.hits,vm->view->cost_cache.misses);
+  scc_cost_cache_clear(&vm->view->cost_cache);
+  scvm_prefetch_uninit(vm);
+  if(headless) {
+    elapsed = (end.tv_sec - start.tv_sec) +
+      (end.tv_usec - start.tv_usec) / 1000000.0;
+    if(elapsed <= 0) elapsed = 0.000001;
+    scc_log(LOG_MSG,"%.3f s: %.1f cycles/s, %.0f ops/s, %.1f frames/s\n",
+            elapsed,vm->cycle/elapsed,vm->num_op/elapsed,
+            vm->num_frame/elapsed);
+  }
   return 0;
 }
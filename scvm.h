@@ -58,6 +58,9 @@ typedef struct scvm_image {
   unsigned have_trans;
 } scvm_image_t;
 
+int scvm_load_image(unsigned width, unsigned height, unsigned num_zplane,
+                    scvm_image_t* img,scc_fd_t* fd);
+
 #define SCVM_CHAR_MAX_ARGS              2
 
 #define SCVM_CHAR_ESCAPE                0xFF
@@ -126,6 +129,8 @@ struct scvm_object {
   int* hotspot;
   scvm_image_t* image;
   unsigned parent_state;
+  // index of the parent in the room, 0 if there is none
+  unsigned parent_num;
   scvm_object_t* parent;
   unsigned actor_dir;
   unsigned* verb_entries;
@@ -187,6 +192,9 @@ void scvm_save_verb(scvm_t* vm, unsigned id, unsigned save_id);
 
 void scvm_restore_verb(scvm_t* vm, unsigned id, unsigned save_id);
 
+/// Must be called when the position, size or mode of a verb changed.
+void scvm_verb_moved(scvm_t* vm, scvm_verb_t* vrb);
+
 scvm_verb_t* scvm_get_verb_at(scvm_t* vm, unsigned x, unsigned y);
 
 typedef struct scvm_sentence {
@@ -200,6 +208,42 @@ typedef struct scvm_sentence {
 int scvm_do_sentence(scvm_t* vm, unsigned vrb, unsigned obj_a,
                      unsigned obj_b);
 
+/// Size of the hit test grid cells
+#define SCVM_GRID_CELL_SIZE 32
+
+typedef struct scvm_grid_cell {
+  unsigned num, size;
+  /// Items in this cell, sorted by index
+  unsigned* item;
+} scvm_grid_cell_t;
+
+typedef struct scvm_grid_range {
+  int x1,y1,x2,y2;
+} scvm_grid_range_t;
+
+/// Uniform grid over the item boxes, to find the items under a point
+typedef struct scvm_grid {
+  unsigned width, height;
+  scvm_grid_cell_t* cell;
+  unsigned num_item;
+  /// Cells covered by each item, empty if not present
+  scvm_grid_range_t* item;
+} scvm_grid_t;
+
+void scvm_grid_init(scvm_grid_t* grid, unsigned width, unsigned height,
+                    unsigned num_item);
+
+void scvm_grid_free(scvm_grid_t* grid);
+
+/// Add an item or update its box, the bounds are inclusive.
+void scvm_grid_set(scvm_grid_t* grid, unsigned id,
+                   int x1, int y1, int x2, int y2);
+
+void scvm_grid_remove(scvm_grid_t* grid, unsigned id);
+
+/// Get the items that might be at the given position.
+unsigned scvm_grid_get(scvm_grid_t* grid, int x, int y, unsigned** items);
+
 typedef struct scvm_cycle {
   unsigned id;
   unsigned delay;
@@ -213,7 +257,10 @@ typedef struct scvm_room {
   // graphics
   unsigned width,height;  
   unsigned num_zplane;
+  // zplanes composed with the objects for the current view
   uint8_t* zplane[SCVM_MAX_ZPLANE];
+  unsigned zplane_size, zplane_valid;
+  uint32_t zplane_key;
   scvm_image_t image;
   unsigned num_palette;
   scvm_palette_t* palette;
@@ -225,6 +272,7 @@ typedef struct scvm_room {
   // objects
   unsigned num_object;
   scvm_object_t** object;
+  scvm_grid_t object_grid;
   
   // scripts
   scvm_script_t* entry;
@@ -298,6 +346,31 @@ void scvm_step_actors(scvm_t* vm);
 #define SCVM_VIEW_PAN   2
 
 #define SCVM_VIEW_PALETTE_CHANGED (1<<16)
+/// Recompose the whole view on the next draw
+#define SCVM_VIEW_REDRAW          (1<<17)
+/// Push the whole view to the backend on the next flip
+#define SCVM_VIEW_FLIP_ALL        (1<<18)
+/// Recompose the whole view on every draw
+#define SCVM_VIEW_ALWAYS_REDRAW   (1<<19)
+
+/// Rectangle, x2 and y2 are excluded
+typedef struct scvm_rect {
+  int x1,y1,x2,y2;
+} scvm_rect_t;
+
+/// What the compositor remember about a drawn item
+typedef struct scvm_view_item {
+  /// Where it was drawn, in buffer coordinates
+  scvm_rect_t rect;
+  /// Hash of everything that change its look
+  uint32_t sig;
+  /// Hash of the parameters used to render the item
+  uint32_t key;
+} scvm_view_item_t;
+
+#define SCVM_VIEW_MAX_DIRTY 16
+/// Memory used to keep the decoded costume pictures
+#define SCVM_COST_CACHE_SIZE (1024*1024)
 
 typedef struct scvm_view {
   // room position on the screen
@@ -310,6 +383,21 @@ typedef struct scvm_view {
   unsigned flags;
   // palette used with the current room
   scvm_palette_t palette;
+
+  // state of the last draw, a full redraw is needed if it changed
+  uint8_t* buffer;
+  int stride;
+  unsigned width, height;
+  scvm_room_t* room;
+  int src_x, room_y, room_height;
+  // the items drawn in the last frame
+  unsigned num_object_item;
+  scvm_view_item_t *object_item, *verb_item, *actor_item;
+  // area of the buffer that changed in the last draw
+  unsigned num_dirty;
+  scvm_rect_t dirty[SCVM_VIEW_MAX_DIRTY];
+  // decoded costume pictures
+  scc_cost_cache_t cost_cache;
 } scvm_view_t;
 
 int scvm_view_draw(scvm_t* vm, scvm_view_t* view,
@@ -484,7 +572,8 @@ typedef struct scvm_backend {
                       unsigned height, unsigned bpp);
     void (*update_palette)(struct scvm_backend_priv* be, scvm_color_t* pal);
     void (*draw)(struct scvm_backend_priv* be, scvm_t* vm, scvm_view_t* view);
-    void (*flip)(struct scvm_backend_priv* be);
+    void (*flip)(struct scvm_backend_priv* be,
+                 scvm_rect_t* rect, unsigned num_rect);
     void (*uninit_video)(struct scvm_backend_priv* be);
     // input
     void (*check_events)(struct scvm_backend_priv* be, scvm_t* vm);
@@ -492,6 +581,17 @@ typedef struct scvm_backend {
     struct scvm_backend_priv* priv;
 } scvm_backend_t;
 
+/// Default clock step of the headless backend, 2 ticks of 1/60s
+#define SCVM_HEADLESS_TIME_STEP 33
+
+/// Backend without display nor input, its clock advance by a fixed
+/// step on each cycle and it never sleep.
+int scvm_headless_backend_init(scvm_backend_t* be);
+
+/// Set the clock step in ms and enable rendering in a memory buffer.
+void scvm_headless_setup(scvm_backend_t* be, unsigned time_step,
+                         int render);
+
 // Don't change the first 4 as they match the
 // v6 resouces opcodes.
 #define SCVM_RES_SCRIPT  0
@@ -502,6 +602,21 @@ typedef struct scvm_backend {
 #define SCVM_RES_OBJECT  5
 #define SCVM_RES_MAX     6
 
+typedef struct scvm_prefetch scvm_prefetch_t;
+typedef struct scvm_profile scvm_profile_t;
+
+// Input events, as stored in the input logs
+#define SCVM_INPUT_KEY_DOWN    1
+#define SCVM_INPUT_KEY_UP      2
+#define SCVM_INPUT_BUTTON_DOWN 3
+#define SCVM_INPUT_BUTTON_UP   4
+#define SCVM_INPUT_MOUSE       5
+
+typedef struct scvm_input_event {
+  unsigned type;
+  int a,b;
+} scvm_input_event_t;
+
 typedef int (*scvm_get_var_f)(struct scvm* vm,unsigned addr);
 typedef int (*scvm_set_var_f)(struct scvm* vm,unsigned addr, int val);
 
@@ -554,6 +669,11 @@ typedef int (*scvm_set_var_f)(struct scvm* vm,unsigned addr, int val);
 struct scvm {
   // Debuging data
   scvm_debug_t* dbg;
+  // Log every executed op, this use the slow interpreter
+  int trace;
+  // Time every executed op, this also use the slow interpreter
+  int profiling;
+  scvm_profile_t* profile;
 
   int boot_param;
 
@@ -572,6 +692,7 @@ struct scvm {
   // verb
   unsigned num_verb;
   scvm_verb_t *verb;
+  scvm_grid_t verb_grid;
   scvm_verb_t *current_verb;
   unsigned current_verb_id;
   // sentences
@@ -589,6 +710,13 @@ struct scvm {
   uint8_t file_key;
   scc_fd_t** file;
   scvm_res_type_t res[SCVM_RES_MAX];
+  // memory used by the loaded resources and its limit
+  unsigned res_size, res_budget;
+  unsigned res_hits, res_misses, res_evictions;
+  // background loader, NULL when disabled
+  scvm_prefetch_t* prefetch;
+  unsigned prefetch_requests, prefetch_hits, prefetch_waits;
+  unsigned prefetch_wasted;
 
   // object's persistant data
   unsigned num_object, num_local_object;
@@ -611,9 +739,21 @@ struct scvm {
   unsigned pause_state;
   unsigned num_thread;
   unsigned cycle;
+  // number of ops executed since the start
+  unsigned num_op;
+  // number of frames that updated the screen
+  unsigned num_frame;
   scvm_thread_t* current_thread;
   scvm_thread_t* next_thread;
   scvm_thread_t *thread;
+  /// Bitmaps of the runnable and free threads
+  uint32_t *thread_ready, *thread_free;
+  /// Threads waiting for a later cycle
+  scvm_thread_heap_t cycle_wait;
+  /// Delayed threads
+  scvm_thread_heap_t delayed;
+  /// Running threads indexed by script id
+  scvm_thread_t* script_thread[SCVM_SCRIPT_HASH_SIZE];
   scvm_op_t* optable;
   scvm_op_t* suboptable;
   unsigned time;
@@ -627,6 +767,13 @@ struct scvm {
   int keypress, btnpress;
   int key_state[256/8];
   int btn_state;
+  // input recording and replay
+  scc_fd_t *input_record, *input_replay;
+  unsigned input_record_cycle, input_replay_cycle;
+  scvm_input_event_t input_next;
+  int input_feeding;
+  // hash of the rendered frames
+  scc_fd_t* frame_hash;
 
   scvm_backend_t* backend;
 };
@@ -669,6 +816,10 @@ struct scvm {
 #define SCVM_ERR_BREAKPOINT         SCVM_NOT_ERR(1)
 #define SCVM_ERR_QUIT               SCVM_NOT_ERR(2)
 
+/// Log the execution details, only when tracing
+#define scvm_trace(vm,...) do {                   \
+    if((vm)->trace) scc_log(LOG_MSG,__VA_ARGS__); \
+  } while(0)
 
 const char* scvm_state_name(unsigned state);
 
@@ -697,5 +848,78 @@ void scvm_uninit_video(scvm_t* vm);
 
 int scvm_debugger(scvm_t* vm);
 
+/// Record the input events and the random seed in a file.
+int scvm_input_record(scvm_t* vm, char* path, unsigned seed);
+
+/// Replay the input events from a file, the live input is then
+/// ignored until the end of the log.
+int scvm_input_replay(scvm_t* vm, char* path, unsigned* seed);
+
+/// Called for every input event, return 0 if it must be ignored.
+int scvm_input_event(scvm_t* vm, unsigned type, int a, int b);
+
+/// Send the replayed events for the current cycle.
+void scvm_input_feed(scvm_t* vm);
+
+/// Write the hash of each rendered frame in a file.
+int scvm_frame_hash_open(scvm_t* vm, char* path);
+
+void scvm_frame_hash(scvm_t* vm);
+
+void scvm_input_close(scvm_t* vm);
+
+/// Start profiling, the previous data is dropped.
+void scvm_profile_start(scvm_t* vm);
+
+/// Stop profiling, the data is kept until the next start.
+void scvm_profile_stop(scvm_t* vm);
+
+/// Run an op and add its time to the profile.
+int scvm_profile_do_op(scvm_t* vm, scvm_thread_t* thread);
+
+/// Print the time spent in each op and script, most expensive first.
+void scvm_profile_report(scvm_t* vm, FILE* out, unsigned max_lines);
+
+/// Write the profile in the collapsed stack format of the
+/// flamegraph tools.
+int scvm_profile_write_stacks(scvm_t* vm, char* path);
+
+/// Start the loader thread. The hints are strings like "ROOM:r3,c5,s12"
+/// listing the resources (room, costume, script or charset (f)) to
+/// load when the room is entered.
+int scvm_prefetch_init(scvm_t* vm, char** hints);
+
+/// Stop the loader thread and release its resources. The scripts it
+/// loaded can't be used anymore afterwards.
+void scvm_prefetch_uninit(scvm_t* vm);
+
+/// Queue a resource for loading in the background.
+void scvm_prefetch(scvm_t* vm, unsigned type, unsigned num);
+
+/// Queue the resources that might be needed after entering a room.
+void scvm_prefetch_room(scvm_t* vm, scvm_room_t* room);
+
+/// Take a prefetched resource, waiting for it if it is beeing loaded.
+void* scvm_prefetch_get(scvm_t* vm, unsigned type, unsigned num,
+                        unsigned* size);
+
+/// Take an image decoded ahead at the current position of fd.
+int scvm_prefetch_get_image(scvm_t* vm, unsigned width, unsigned height,
+                            unsigned num_zplane, scvm_image_t* img,
+                            scc_fd_t* fd);
+
+/// Release the prefetched images that were not used.
+void scvm_prefetch_release(scvm_t* vm);
+
 unsigned scvm_pause(scvm_t* vm);
 
+void scvm_press_key(scvm_t* vm, uint8_t key);
+
+void scvm_release_key(scvm_t* vm, uint8_t key);
+
+void scvm_press_button(scvm_t* vm, int btn);
+
+void scvm_release_button(scvm_t* vm, int btn);
+
+void scvm_set_mouse_position(scvm_t* vm, int x, int y);
+
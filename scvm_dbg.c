@@ -437,6 +437,47 @@ static int cmd_show_object(scvm_t* vm, char* args) {
   return 1;
 }
 
+///////////// show res ///////////////////////
+
+static void cmd_show_res_usage(char* args) {
+  printf("Usage: show res\n");
+}
+
+static int cmd_show_res(scvm_t* vm, char* args) {
+  unsigned total = vm->res_hits + vm->res_misses;
+  int type,i;
+
+  printf("Resources:\n");
+  for(type = 0 ; type < SCVM_RES_MAX ; type++) {
+    scvm_res_type_t* res = &vm->res[type];
+    unsigned num = 0, locked = 0, size = 0;
+    if(!res->load) continue;
+    for(i = 0 ; i < res->num ; i++) {
+      if(!res->idx[i].data) continue;
+      num++;
+      size += res->idx[i].size;
+      if(res->idx[i].flags & SCVM_RES_LOCKED) locked++;
+    }
+    printf("  %-20s: %d/%d loaded, %d locked, %d KB\n",
+           res->name,num,res->num,locked,size/1024);
+  }
+  printf("  Memory              : %d/%d KB\n",
+         vm->res_size/1024,vm->res_budget/1024);
+  printf("  Hits                : %d (%d%%)\n",vm->res_hits,
+         total ? (unsigned)((uint64_t)vm->res_hits*100/total) : 100);
+  printf("  Misses              : %d\n",vm->res_misses);
+  printf("  Evictions           : %d\n",vm->res_evictions);
+  if(!vm->prefetch) return 1;
+  printf("Prefetch:\n");
+  printf("  Requests            : %d\n",vm->prefetch_requests);
+  printf("  Hits                : %d (%d%% of the misses)\n",
+         vm->prefetch_hits, vm->res_misses ?
+         (unsigned)((uint64_t)vm->prefetch_hits*100/vm->res_misses) : 0);
+  printf("  Waits               : %d\n",vm->prefetch_waits);
+  printf("  Wasted              : %d\n",vm->prefetch_wasted);
+  return 1;
+}
+
 ///////////// show room ///////////////////////
 
 static void cmd_show_room_usage(char* args) {
@@ -479,7 +520,7 @@ static int cmd_show_room(scvm_t* vm, char* args) {
 
 /////////////// show thread ///////////////////////////
 
-static void show_thread(scvm_thread_t* t) {
+static void show_thread(scvm_t* vm, scvm_thread_t* t) {
   printf("Thread %d\n",t->id);
   printf("  State               : %s\n",scvm_thread_state_name(t->state));
   if(t->parent)
@@ -494,7 +535,9 @@ static void show_thread(scvm_thread_t* t) {
     printf("  Flags               : %s\n",flags);
   }
   printf("  Cycle               : %d\n",t->cycle);
-  if(t->delay)
+  if(t->flags & SCVM_THREAD_DELAY)
+    printf("  Delay               : %d ms\n",t->wake - vm->time);
+  else if(t->delay)
     printf("  Delay               : %d ms\n",t->delay);
   if(t->script && (t->script->id & 0x0FFF0000) == 0x0ECD0000)
     printf("  Script              : %s\n",
@@ -514,7 +557,7 @@ static int cmd_show_thread(scvm_t* vm, char* args) {
   if(!args) {
     for(t = 0 ; t < vm->num_thread ; t++)
       if(vm->thread[t].state > SCVM_THREAD_STOPPED)
-        show_thread(&vm->thread[t]);
+        show_thread(vm,&vm->thread[t]);
     return 1;
   }
   while(1) {
@@ -524,7 +567,7 @@ static int cmd_show_thread(scvm_t* vm, char* args) {
     t = strtol(args,&end,0);
     if(end == args)
       return 0;
-    show_thread(&vm->thread[t]);
+    show_thread(vm,&vm->thread[t]);
     args = end;
   }
   return 1;
@@ -588,6 +631,77 @@ static int cmd_show_vm(scvm_t* vm, char* args) {
   return 1;
 }
 
+/////////////// profile start ///////////////////////////
+
+static void cmd_profile_start_usage(char* args) {
+  printf("Usage: profile start\n");
+}
+
+static int cmd_profile_start(scvm_t* vm, char* args) {
+  scvm_profile_start(vm);
+  printf("Profiling started.\n");
+  return 1;
+}
+
+/////////////// profile stop ///////////////////////////
+
+static void cmd_profile_stop_usage(char* args) {
+  printf("Usage: profile stop\n");
+}
+
+static int cmd_profile_stop(scvm_t* vm, char* args) {
+  scvm_profile_stop(vm);
+  printf("Profiling stopped.\n");
+  return 1;
+}
+
+/////////////// profile show ///////////////////////////
+
+static void cmd_profile_show_usage(char* args) {
+  printf("Usage: profile show [ lines ]\n");
+}
+
+static int cmd_profile_show(scvm_t* vm, char* args) {
+  char* end;
+  int lines = 20;
+  if(args) {
+    lines = strtol(args,&end,0);
+    if(end == args || lines < 0) {
+      cmd_profile_show_usage(args);
+      return 0;
+    }
+  }
+  scvm_profile_report(vm,stdout,lines);
+  return 1;
+}
+
+/////////////// profile write ///////////////////////////
+
+static void cmd_profile_write_usage(char* args) {
+  printf("Usage: profile write file\n");
+}
+
+static int cmd_profile_write(scvm_t* vm, char* args) {
+  if(!args) {
+    cmd_profile_write_usage(args);
+    return 0;
+  }
+  return scvm_profile_write_stacks(vm,args);
+}
+
+/////////////// profile xxx ///////////////////////////
+
+#define PROFILE_CMD(name) \
+  { #name, "profile" #name, cmd_profile_##name, cmd_profile_##name##_usage }
+
+static scvm_debug_cmd_t profile_cmd[] = {
+  PROFILE_CMD(show),
+  PROFILE_CMD(start),
+  PROFILE_CMD(stop),
+  PROFILE_CMD(write),
+  { NULL }
+};
+
 /////////////// show xxx ///////////////////////////
 
 #define SHOW_CMD(name) \
@@ -599,6 +713,7 @@ static scvm_debug_cmd_t show_cmd[] = {
   SHOW_CMD(avar),
   SHOW_CMD(costume),
   SHOW_CMD(object),
+  SHOW_CMD(res),
   SHOW_CMD(room),
   SHOW_CMD(thread),
   SHOW_CMD(var),
@@ -654,6 +769,7 @@ static int cmd_run(scvm_t* vm, char* args) {
 static scvm_debug_cmd_t debug_cmd[] = {
   DBG_CMD(breakpoint),
   DBG_CMD(help),
+  DBG_SUBCMD(profile),
   DBG_CMD(quit),
   DBG_CMD(run),
   DBG_SUBCMD(show),
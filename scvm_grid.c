@@ -0,0 +1,139 @@
+/* ScummC
+ * Copyright (C) 2009  Alban Bedel
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/**
+ * @file scvm_grid.c
+ * @ingroup scvm
+ * @brief Uniform grid used for the hit tests
+ *
+ * Each cell list the items whose box overlap it, sorted by index so
+ * the callers can keep the priority of the linear scans they replace.
+ * Items outside of the grid are put in the border cells, and the
+ * lookups are clamped the same way, so the cells always give a
+ * superset of the items under a point.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "scc_fd.h"
+#include "scc_util.h"
+#include "scc_cost.h"
+#include "scc_box.h"
+#include "scvm_res.h"
+#include "scvm_thread.h"
+#include "scvm.h"
+
+void scvm_grid_init(scvm_grid_t* grid, unsigned width, unsigned height,
+                    unsigned num_item) {
+  int i;
+  grid->width = (width + SCVM_GRID_CELL_SIZE-1) / SCVM_GRID_CELL_SIZE;
+  grid->height = (height + SCVM_GRID_CELL_SIZE-1) / SCVM_GRID_CELL_SIZE;
+  if(!grid->width) grid->width = 1;
+  if(!grid->height) grid->height = 1;
+  grid->cell = calloc(grid->width*grid->height,sizeof(scvm_grid_cell_t));
+  grid->num_item = num_item;
+  grid->item = malloc(num_item*sizeof(scvm_grid_range_t));
+  // mark all items as not present
+  for(i = 0 ; i < num_item ; i++) {
+    grid->item[i].x1 = grid->item[i].y1 = 0;
+    grid->item[i].x2 = grid->item[i].y2 = -1;
+  }
+}
+
+void scvm_grid_free(scvm_grid_t* grid) {
+  int i;
+  if(grid->cell)
+    for(i = 0 ; i < grid->width*grid->height ; i++)
+      free(grid->cell[i].item);
+  free(grid->cell);
+  free(grid->item);
+  memset(grid,0,sizeof(*grid));
+}
+
+static int scvm_grid_clamp(int v, unsigned size) {
+  v = v < 0 ? 0 : v / SCVM_GRID_CELL_SIZE;
+  return v >= size ? size-1 : v;
+}
+
+static void scvm_grid_cell_add(scvm_grid_cell_t* cell, unsigned id) {
+  int i;
+  if(cell->num >= cell->size) {
+    cell->size += 8;
+    cell->item = realloc(cell->item,cell->size*sizeof(unsigned));
+  }
+  for(i = cell->num ; i > 0 && cell->item[i-1] > id ; i--)
+    cell->item[i] = cell->item[i-1];
+  cell->item[i] = id;
+  cell->num++;
+}
+
+static void scvm_grid_cell_remove(scvm_grid_cell_t* cell, unsigned id) {
+  int i;
+  for(i = 0 ; i < cell->num ; i++)
+    if(cell->item[i] == id) {
+      cell->num--;
+      memmove(cell->item+i,cell->item+i+1,(cell->num-i)*sizeof(unsigned));
+      return;
+    }
+}
+
+void scvm_grid_remove(scvm_grid_t* grid, unsigned id) {
+  scvm_grid_range_t* r;
+  int x,y;
+  if(id >= grid->num_item) return;
+  r = &grid->item[id];
+  for(y = r->y1 ; y <= r->y2 ; y++)
+    for(x = r->x1 ; x <= r->x2 ; x++)
+      scvm_grid_cell_remove(&grid->cell[y*grid->width+x],id);
+  r->x1 = r->y1 = 0;
+  r->x2 = r->y2 = -1;
+}
+
+void scvm_grid_set(scvm_grid_t* grid, unsigned id,
+                   int x1, int y1, int x2, int y2) {
+  scvm_grid_range_t cells;
+  int x,y;
+
+  if(id >= grid->num_item) return;
+  cells.x1 = scvm_grid_clamp(x1,grid->width);
+  cells.y1 = scvm_grid_clamp(y1,grid->height);
+  cells.x2 = scvm_grid_clamp(x2,grid->width);
+  cells.y2 = scvm_grid_clamp(y2,grid->height);
+  if(!memcmp(&cells,&grid->item[id],sizeof(cells))) return;
+
+  scvm_grid_remove(grid,id);
+  for(y = cells.y1 ; y <= cells.y2 ; y++)
+    for(x = cells.x1 ; x <= cells.x2 ; x++)
+      scvm_grid_cell_add(&grid->cell[y*grid->width+x],id);
+  grid->item[id] = cells;
+}
+
+unsigned scvm_grid_get(scvm_grid_t* grid, int x, int y, unsigned** items) {
+  scvm_grid_cell_t* cell;
+  if(!grid->cell) return 0;
+  cell = &grid->cell[scvm_grid_clamp(y,grid->height)*grid->width +
+                     scvm_grid_clamp(x,grid->width)];
+  *items = cell->item;
+  return cell->num;
+}
@@ -0,0 +1,129 @@
+/* ScummC
+ * Copyright (C) 2009  Alban Bedel
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/**
+ * @file scvm_headless.c
+ * @ingroup scvm
+ * @brief SCVM backend without display
+ *
+ * This backend use a virtual clock that advance by a fixed step on
+ * each cycle and it never sleep. A run thus only depend on the game
+ * data and the VM, and it goes as fast as the CPU allows. The view
+ * can optionally be rendered in a memory buffer.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "scc_fd.h"
+#include "scc_util.h"
+#include "scc_cost.h"
+#include "scc_box.h"
+#include "scvm_res.h"
+#include "scvm_thread.h"
+#include "scvm.h"
+
+typedef struct scvm_backend_priv {
+  unsigned time, time_step;
+  int render;
+  unsigned width, height;
+  uint8_t* buffer;
+  scvm_color_t palette[256];
+} scvm_backend_headless_t;
+
+static int headless_scvm_init_video(scvm_backend_headless_t* be,
+                                    unsigned width, unsigned height,
+                                    unsigned bpp) {
+  if(bpp != 8) {
+    scc_log(LOG_ERR,"Headless backend only support 8 bpp.\n");
+    return 0;
+  }
+  if(!be->render) return 1;
+  be->buffer = realloc(be->buffer,width*height);
+  memset(be->buffer,0,width*height);
+  be->width = width;
+  be->height = height;
+  return 1;
+}
+
+static void headless_scvm_uninit_video(scvm_backend_headless_t* be) {
+  free(be->buffer);
+  be->buffer = NULL;
+}
+
+static void headless_scvm_update_palette(scvm_backend_headless_t* be,
+                                         scvm_color_t* pal) {
+  memcpy(be->palette,pal,sizeof(be->palette));
+}
+
+static void headless_scvm_draw(scvm_backend_headless_t* be, scvm_t* vm,
+                               scvm_view_t* view) {
+  if(!be->buffer) return;
+  scvm_view_draw(vm,view,be->buffer,be->width,be->width,be->height);
+}
+
+static void headless_scvm_sleep(scvm_backend_headless_t* be,
+                                unsigned delay) {
+}
+
+// Flip is called once at the end of every cycle
+static void headless_scvm_flip(scvm_backend_headless_t* be,
+                               scvm_rect_t* rect, unsigned num_rect) {
+  be->time += be->time_step;
+}
+
+static unsigned headless_scvm_get_time(scvm_backend_headless_t* be) {
+  return be->time;
+}
+
+static void headless_scvm_check_events(scvm_backend_headless_t* be,
+                                       scvm_t* vm) {
+}
+
+static void headless_backend_uninit(scvm_backend_t* be) {
+  if(be->priv) {
+    free(be->priv->buffer);
+    free(be->priv);
+  }
+}
+
+int scvm_headless_backend_init(scvm_backend_t* be) {
+  be->uninit = headless_backend_uninit;
+  be->get_time = headless_scvm_get_time;
+  be->update_palette = headless_scvm_update_palette;
+  be->init_video = headless_scvm_init_video;
+  be->draw = headless_scvm_draw;
+  be->sleep = headless_scvm_sleep;
+  be->flip = headless_scvm_flip;
+  be->uninit_video = headless_scvm_uninit_video;
+  be->check_events = headless_scvm_check_events;
+  be->priv = calloc(1,sizeof(scvm_backend_headless_t));
+  be->priv->time_step = SCVM_HEADLESS_TIME_STEP;
+  return 1;
+}
+
+void scvm_headless_setup(scvm_backend_t* be, unsigned time_step,
+                         int render) {
+  be->priv->time_step = time_step;
+  be->priv->render = render;
+}
@@ -79,11 +79,14 @@ int scvm_get_object_position(scvm_t* vm, unsigned id, int* x, int* y) {
     return 0;
 }
 
+// The object boxes never change once the room is loaded, so only
+// the candidates from the room grid need to be checked.
 scvm_object_t* scvm_get_object_at(scvm_t* vm, int x, int y) {
-    unsigned i;
+    unsigned i, num, *items;
     if(!vm->room) return NULL;
-    for(i = 0 ; i < vm->room->num_object ; i++) {
-        scvm_object_t* obj = vm->room->object[i];
+    num = scvm_grid_get(&vm->room->object_grid,x,y,&items);
+    for(i = 0 ; i < num ; i++) {
+        scvm_object_t* obj = vm->room->object[items[i]];
         if(!obj ||
 	   (obj->parent && obj->parent->pdata->state != obj->parent_state))
 	    continue;
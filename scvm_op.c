@@ -57,7 +57,7 @@ int scvm_push(scvm_t* vm,int val) {
     scc_log(LOG_ERR,"Stack overflow!\n");
     return SCVM_ERR_STACK_OVERFLOW;
   }
-  scc_log(LOG_MSG,"Push %d\n",val);
+  scvm_trace(vm,"Push %d\n",val);
   vm->stack[vm->stack_ptr] = val;
   vm->stack_ptr++;
   return 0;
@@ -69,7 +69,7 @@ int scvm_pop(scvm_t* vm,unsigned* val) {
     return SCVM_ERR_STACK_UNDERFLOW;
   }
   vm->stack_ptr--;
-  scc_log(LOG_MSG,"Pop %d\n",vm->stack[vm->stack_ptr]);
+  scvm_trace(vm,"Pop %d\n",vm->stack[vm->stack_ptr]);
   if(val) *val = vm->stack[vm->stack_ptr];
   return 0;
 }
@@ -105,12 +105,12 @@ int scvm_thread_read_var(scvm_t* vm, scvm_thread_t* thread,
     addr &= 0x7FFF;
     if(addr >= vm->num_bitvar) return SCVM_ERR_BAD_ADDR;
     *val = (vm->bitvar[addr>>3]>>(addr&7))&1;
-    scc_log(LOG_MSG,"Read bit var %d: %d\n",addr,*val);
+    scvm_trace(vm,"Read bit var %d: %d\n",addr,*val);
   } else if(addr & 0x4000) { // thread local variable
     addr &= 0x3FFF;
     if(!thread || addr >= thread->num_var) return SCVM_ERR_BAD_ADDR;
     *val = thread->var[addr];
-    scc_log(LOG_MSG,"Read local var %d: %d\n",addr,*val);
+    scvm_trace(vm,"Read local var %d: %d\n",addr,*val);
   } else { // global variable
     addr &= 0x3FFF;
     if(addr >= vm->num_var) return SCVM_ERR_BAD_ADDR;
@@ -118,7 +118,7 @@ int scvm_thread_read_var(scvm_t* vm, scvm_thread_t* thread,
       *val = vm->get_var[addr](vm,addr);
     else
       *val = vm->var_mem[addr];
-    scc_log(LOG_MSG,"Read global var %d: %d\n",addr,*val);
+    scvm_trace(vm,"Read global var %d: %d\n",addr,*val);
   }
   return 0;
 }
@@ -131,12 +131,12 @@ int scvm_thread_write_var(scvm_t* vm, scvm_thread_t* thread,
     if(addr >= vm->num_bitvar) return SCVM_ERR_BAD_ADDR;
     vm->bitvar[addr>>3] &= ~(1<<(addr&7));
     vm->bitvar[addr>>3] |= (val&1)<<(addr&7);
-    scc_log(LOG_MSG,"Write bit var %d: %d\n",addr,val);
+    scvm_trace(vm,"Write bit var %d: %d\n",addr,val);
   } else if(addr & 0x4000) { // thread local variable
     addr &= 0x3FFF;
     if(!thread || addr >= thread->num_var) return SCVM_ERR_BAD_ADDR;
     thread->var[addr] = val;
-    scc_log(LOG_MSG,"Write local var %d: %d\n",addr,val);
+    scvm_trace(vm,"Write local var %d: %d\n",addr,val);
   } else { // global variable
     addr &= 0x3FFF;
     if(addr >= vm->num_var) return SCVM_ERR_BAD_ADDR;
@@ -144,7 +144,7 @@ int scvm_thread_write_var(scvm_t* vm, scvm_thread_t* thread,
       vm->set_var[addr](vm,addr,val);
     else
       vm->var_mem[addr] = val;
-    scc_log(LOG_MSG,"Write global var %d: %d\n",addr,val);
+    scvm_trace(vm,"Write global var %d: %d\n",addr,val);
   }
   return 0;
 }
@@ -193,13 +193,13 @@ int scvm_read_array(scvm_t* vm, unsigned addr, unsigned x, unsigned y, int* val)
   default:
     return SCVM_ERR_ARRAY_TYPE;
   }
-  scc_log(LOG_MSG,"Read array %d[%d][%d]: %d\n",addr,x,y,*val);
+  scvm_trace(vm,"Read array %d[%d][%d]: %d\n",addr,x,y,*val);
   return 0;
 }
 
 int scvm_write_array(scvm_t* vm, unsigned addr, unsigned x, unsigned y, int val) {
   unsigned idx;
-  scc_log(LOG_MSG,"Write array %d[%d][%d]: %d\n",addr,x,y,val);
+  scvm_trace(vm,"Write array %d[%d][%d]: %d\n",addr,x,y,val);
   if(addr >= vm->num_array) return SCVM_ERR_BAD_ADDR;
   idx = x+y*vm->array[addr].line_size;
   if(idx >= vm->array[addr].size)
@@ -1059,12 +1059,19 @@ static int scvm_op_resource(scvm_t* vm, scvm_thread_t* thread) {
   if(op == 0x65) return 0; // ignore sounds for now
   
   if(op >= 0x64 && op <= 0x67) {
+    // let the loader thread do the job if there is one
+    if(vm->prefetch && res < vm->res[op-0x64].num) {
+      scvm_prefetch(vm,op-0x64,res);
+      return 0;
+    }
     if(!scvm_load_res(vm,op-0x64,res))
       return SCVM_ERR_BAD_RESOURCE;
     return 0;
   } else if(op >= 0x6C && op <= 0x6F) {
     if(!scvm_lock_res(vm,op-0x6C,res))
       return SCVM_ERR_BAD_RESOURCE;
+    // locked resources are going to be used soon
+    scvm_prefetch(vm,op-0x6C,res);
     return 0;
   } else if(op >= 0x70 && op <= 0x73) {
     if(!scvm_unlock_res(vm,op-0x70,res))
@@ -1074,6 +1081,10 @@ static int scvm_op_resource(scvm_t* vm, scvm_thread_t* thread) {
   
   switch(op) {    
   case 0x75: // load charset
+    if(vm->prefetch && res < vm->res[SCVM_RES_CHARSET].num) {
+      scvm_prefetch(vm,SCVM_RES_CHARSET,res);
+      return 0;
+    }
     if(!scvm_load_res(vm,SCVM_RES_CHARSET,res))
       return SCVM_ERR_BAD_RESOURCE;
     return 0;
@@ -1350,21 +1361,26 @@ static int scvm_op_set_verb_xy(scvm_t* vm, scvm_thread_t* thread) {
   if(vm->current_verb) {
     vm->current_verb->y = y;
     vm->current_verb->x = x;
+    scvm_verb_moved(vm,vm->current_verb);
   }
   return 0;
 }
 
 // 0x9E81
 static int scvm_op_set_verb_on(scvm_t* vm, scvm_thread_t* thread) {
-  if(vm->current_verb)
+  if(vm->current_verb) {
     vm->current_verb->mode = SCVM_VERB_SHOW;
+    scvm_verb_moved(vm,vm->current_verb);
+  }
   return 0;
 }
 
 // 0x9E82
 static int scvm_op_set_verb_off(scvm_t* vm, scvm_thread_t* thread) {
-  if(vm->current_verb)
+  if(vm->current_verb) {
     vm->current_verb->mode = SCVM_VERB_HIDE;
+    scvm_verb_moved(vm,vm->current_verb);
+  }
   return 0;
 }
 
@@ -1396,8 +1412,10 @@ static int scvm_op_set_verb_dim_color(scvm_t* vm, scvm_thread_t* thread) {
 
 // 0x9E86
 static int scvm_op_set_verb_dim(scvm_t* vm, scvm_thread_t* thread) {
-  if(vm->current_verb)
+  if(vm->current_verb) {
     vm->current_verb->mode = SCVM_VERB_DIM;
+    scvm_verb_moved(vm,vm->current_verb);
+  }
   return 0;
 }
 
@@ -1408,8 +1426,10 @@ static int scvm_op_set_verb_key(scvm_t* vm, scvm_thread_t* thread) {
 
 // 0x9E88
 static int scvm_op_set_verb_center(scvm_t* vm, scvm_thread_t* thread) {
-  if(vm->current_verb)
+  if(vm->current_verb) {
     vm->current_verb->flags |= SCVM_VERB_CENTER;
+    scvm_verb_moved(vm,vm->current_verb);
+  }
   return 0;
 }
 
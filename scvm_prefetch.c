@@ -0,0 +1,559 @@
+/* ScummC
+ * Copyright (C) 2009  Alban Bedel
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/**
+ * @file scvm_prefetch.c
+ * @ingroup scvm
+ * @brief SCVM background resource loading
+ *
+ * A loader thread decodes the resources that are likely to be needed
+ * soon, the main thread then only has to pick up the results.
+ * Scripts, costumes and charsets are fully loaded by the thread.
+ * Loading a room also fills the object table, so that is still done
+ * by the main thread, but the thread decode all the room and object
+ * images beforehand as that is what takes time.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "scc_fd.h"
+#include "scc_util.h"
+#include "scc_cost.h"
+#include "scc_char.h"
+#include "scc_box.h"
+
+#include "scvm_res.h"
+#include "scvm_thread.h"
+#include "scvm.h"
+
+#ifdef HAVE_PTHREAD
+
+#define SCVM_PREFETCH_MAX_JOB  16
+
+#define SCVM_PREFETCH_FREE     0
+#define SCVM_PREFETCH_QUEUED   1
+#define SCVM_PREFETCH_LOADING  2
+#define SCVM_PREFETCH_READY    3
+#define SCVM_PREFETCH_FAILED   4
+
+/// An image decoded ahead, identified by its position in the file
+typedef struct scvm_prefetch_image scvm_prefetch_image_t;
+struct scvm_prefetch_image {
+  scvm_prefetch_image_t* next;
+  off_t pos, end;
+  unsigned width, height, num_zplane;
+  scvm_image_t img;
+};
+
+typedef struct scvm_prefetch_job {
+  unsigned state;
+  unsigned type, num;
+  // age of the request
+  unsigned seq;
+  // the resource, or the image list for the rooms
+  void* data;
+  unsigned size;
+} scvm_prefetch_job_t;
+
+/// Resource to prefetch when a room is entered
+typedef struct scvm_prefetch_hint {
+  unsigned room;
+  unsigned type, num;
+} scvm_prefetch_hint_t;
+
+struct scvm_prefetch {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  // signaled when a job is queued
+  pthread_cond_t wake;
+  // signaled when a job is done
+  pthread_cond_t done;
+  // set to stop the loader thread
+  int quit;
+
+  unsigned seq;
+  scvm_prefetch_job_t job[SCVM_PREFETCH_MAX_JOB];
+
+  // data files opened by the loader thread, they are only closed
+  // when the VM is done as the loaded scripts may point into them.
+  scc_fd_t** file;
+
+  unsigned num_hint;
+  scvm_prefetch_hint_t* hint;
+
+  // images of the room beeing loaded by the main thread
+  scvm_prefetch_image_t* room_images;
+};
+
+static void scvm_prefetch_free_images(scvm_prefetch_image_t* list) {
+  scvm_prefetch_image_t* next;
+  int i;
+
+  for( ; list ; list = next) {
+    next = list->next;
+    free(list->img.data);
+    if(list->img.zplane) {
+      for(i = 1 ; i <= list->num_zplane ; i++)
+        free(list->img.zplane[i]);
+      free(list->img.zplane);
+    }
+    free(list);
+  }
+}
+
+// Called with the lock held
+static void scvm_prefetch_free_job(scvm_t* vm, scvm_prefetch_job_t* job) {
+  if(job->data) {
+    if(job->type == SCVM_RES_ROOM)
+      scvm_prefetch_free_images(job->data);
+    else
+      vm->res[job->type].nuke(job->data);
+  }
+  job->data = NULL;
+  job->state = SCVM_PREFETCH_FREE;
+}
+
+///////////////// Loader thread /////////////////////////
+
+static scc_fd_t* scvm_prefetch_open(scvm_t* vm, unsigned num) {
+  scvm_prefetch_t* pf = vm->prefetch;
+  if(!pf->file[num]) {
+    int l = strlen(vm->path) + strlen(vm->basename) + 32;
+    char name[l+1];
+    sprintf(name,"%s/%s.%03d",vm->path,vm->basename,num);
+    pf->file[num] = new_scc_fd(name,O_RDONLY,vm->file_key);
+    if(!pf->file[num])
+      scc_log(LOG_ERR,"Failed to open %s: %s\n",name,strerror(errno));
+    else
+      scc_fd_map(pf->file[num]);
+  }
+  return pf->file[num];
+}
+
+static void scvm_prefetch_add_image(scvm_prefetch_image_t** list,
+                                    scc_fd_t* fd, unsigned width,
+                                    unsigned height, unsigned num_zplane) {
+  scvm_prefetch_image_t* e;
+
+  if(!width || !height) return;
+
+  e = calloc(1,sizeof(scvm_prefetch_image_t));
+  e->pos = scc_fd_pos(fd);
+  e->width = width;
+  e->height = height;
+  e->num_zplane = num_zplane;
+  if(!scvm_load_image(width,height,num_zplane,&e->img,fd)) {
+    scvm_prefetch_free_images(e);
+    return;
+  }
+  e->end = scc_fd_pos(fd);
+  e->next = *list;
+  *list = e;
+}
+
+// Decode the room and object images, this walk the blocks
+// just like scvm_load_room() and scvm_load_obim() do.
+static scvm_prefetch_image_t* scvm_prefetch_room_images(scc_fd_t* fd) {
+  scvm_prefetch_image_t* list = NULL;
+  uint32_t type,size,block_size;
+  unsigned len = 8, width = 0, height = 0;
+  unsigned num_image,num_zplane,num_hotspot,w,h;
+  off_t next_block;
+  int i;
+
+  type = scc_fd_r32(fd);
+  size = scc_fd_r32be(fd);
+  if(type != MKID('R','O','O','M')) return NULL;
+
+  while(len < size) {
+    type = scc_fd_r32(fd);
+    block_size = scc_fd_r32be(fd);
+    if(block_size < 8) break;
+    next_block = scc_fd_pos(fd)-8+block_size;
+    len += block_size;
+    switch(type) {
+    case MKID('R','M','H','D'):
+      width = scc_fd_r16le(fd);
+      height = scc_fd_r16le(fd);
+      break;
+
+    case MKID('R','M','I','M'):
+      if(scc_fd_r32(fd) != MKID('R','M','I','H')) break;
+      scc_fd_r32be(fd);
+      num_zplane = scc_fd_r16le(fd);
+      if(scc_fd_r32(fd) != MKID('I','M','0','0')) break;
+      scc_fd_r32be(fd);
+      scvm_prefetch_add_image(&list,fd,width,height,num_zplane);
+      break;
+
+    case MKID('O','B','I','M'):
+      if(scc_fd_r32(fd) != MKID('I','M','H','D')) break;
+      scc_fd_r32be(fd);
+      scc_fd_r16le(fd); // id
+      num_image = scc_fd_r16le(fd);
+      num_zplane = scc_fd_r16le(fd);
+      scc_fd_seek(fd,3*2,SEEK_CUR); // unknown, x, y
+      w = scc_fd_r16le(fd);
+      h = scc_fd_r16le(fd);
+      num_hotspot = scc_fd_r16le(fd);
+      scc_fd_seek(fd,num_hotspot*2*2,SEEK_CUR);
+      for(i = 1 ; i <= num_image ; i++) {
+        if((scc_fd_r32le(fd) & 0xFFFF) != ('I'|'M'<<8)) break;
+        scc_fd_r32be(fd);
+        scvm_prefetch_add_image(&list,fd,w,h,num_zplane);
+      }
+      break;
+    }
+    scc_fd_seek(fd,next_block,SEEK_SET);
+  }
+  return list;
+}
+
+static void* scvm_prefetch_thread(void* arg) {
+  scvm_t* vm = arg;
+  scvm_prefetch_t* pf = vm->prefetch;
+  scvm_prefetch_job_t* job;
+  scvm_res_t* res;
+  scc_fd_t* fd;
+  void* data;
+  unsigned size;
+  int i;
+
+  pthread_mutex_lock(&pf->lock);
+  while(!pf->quit) {
+    // take the oldest request
+    job = NULL;
+    for(i = 0 ; i < SCVM_PREFETCH_MAX_JOB ; i++)
+      if(pf->job[i].state == SCVM_PREFETCH_QUEUED &&
+         (!job || pf->seq - pf->job[i].seq > pf->seq - job->seq))
+        job = &pf->job[i];
+    if(!job) {
+      pthread_cond_wait(&pf->wake,&pf->lock);
+      continue;
+    }
+    job->state = SCVM_PREFETCH_LOADING;
+    pthread_mutex_unlock(&pf->lock);
+
+    // The index is never modified after the VM creation
+    res = &vm->res[job->type].idx[job->num];
+    data = NULL;
+    size = 0;
+    if((fd = scvm_prefetch_open(vm,res->file)) &&
+       scc_fd_seek(fd,res->offset,SEEK_SET) == res->offset) {
+      if(job->type == SCVM_RES_ROOM)
+        data = scvm_prefetch_room_images(fd);
+      else {
+        scc_fd_r32(fd);
+        size = scc_fd_r32be(fd);
+        scc_fd_seek(fd,-8,SEEK_CUR);
+        data = vm->res[job->type].load(vm,fd,job->num);
+      }
+    }
+
+    pthread_mutex_lock(&pf->lock);
+    job->data = data;
+    job->size = size;
+    job->state = data ? SCVM_PREFETCH_READY : SCVM_PREFETCH_FAILED;
+    pthread_cond_broadcast(&pf->done);
+  }
+  pthread_mutex_unlock(&pf->lock);
+  return NULL;
+}
+
+///////////////// Main thread interface /////////////////////////
+
+static int scvm_prefetch_parse_hint(scvm_prefetch_t* pf, char* hint) {
+  char* ptr = hint, *end;
+  unsigned room, type, num;
+
+  room = strtol(ptr,&end,0);
+  if(end == ptr || end[0] != ':') goto bad_hint;
+
+  do {
+    ptr = end+1;
+    switch(ptr[0]) {
+    case 'c':
+      type = SCVM_RES_COSTUME;
+      ptr++;
+      break;
+    case 's':
+      type = SCVM_RES_SCRIPT;
+      ptr++;
+      break;
+    case 'f':
+      type = SCVM_RES_CHARSET;
+      ptr++;
+      break;
+    case 'r':
+      ptr++;
+    default:
+      type = SCVM_RES_ROOM;
+    }
+    num = strtol(ptr,&end,0);
+    if(end == ptr || (end[0] && end[0] != ',')) goto bad_hint;
+    pf->hint = realloc(pf->hint,(pf->num_hint+1)*sizeof(scvm_prefetch_hint_t));
+    pf->hint[pf->num_hint].room = room;
+    pf->hint[pf->num_hint].type = type;
+    pf->hint[pf->num_hint].num = num;
+    pf->num_hint++;
+  } while(end[0]);
+
+  return 1;
+
+bad_hint:
+  scc_log(LOG_ERR,"Invalid prefetch hint: %s\n",hint);
+  return 0;
+}
+
+int scvm_prefetch_init(scvm_t* vm, char** hints) {
+  scvm_prefetch_t* pf = calloc(1,sizeof(scvm_prefetch_t));
+  int i;
+
+  for(i = 0 ; hints && hints[i] ; i++)
+    if(!scvm_prefetch_parse_hint(pf,hints[i])) {
+      free(pf->hint);
+      free(pf);
+      return 0;
+    }
+
+  pf->file = calloc(vm->num_file,sizeof(scc_fd_t*));
+  pthread_mutex_init(&pf->lock,NULL);
+  pthread_cond_init(&pf->wake,NULL);
+  pthread_cond_init(&pf->done,NULL);
+  vm->prefetch = pf;
+
+  if(pthread_create(&pf->thread,NULL,scvm_prefetch_thread,vm)) {
+    scc_log(LOG_ERR,"Failed to start the loader thread: %s\n",
+            strerror(errno));
+    vm->prefetch = NULL;
+    free(pf->file);
+    free(pf->hint);
+    free(pf);
+    return 0;
+  }
+  return 1;
+}
+
+void scvm_prefetch_uninit(scvm_t* vm) {
+  scvm_prefetch_t* pf = vm->prefetch;
+  int i;
+
+  if(!pf) return;
+
+  // the current job is finished before the thread stops
+  pthread_mutex_lock(&pf->lock);
+  pf->quit = 1;
+  pthread_cond_signal(&pf->wake);
+  pthread_mutex_unlock(&pf->lock);
+  pthread_join(pf->thread,NULL);
+
+  for(i = 0 ; i < SCVM_PREFETCH_MAX_JOB ; i++)
+    scvm_prefetch_free_job(vm,&pf->job[i]);
+  scvm_prefetch_free_images(pf->room_images);
+  for(i = 0 ; i < vm->num_file ; i++)
+    if(pf->file[i]) scc_fd_close(pf->file[i]);
+  free(pf->file);
+  free(pf->hint);
+  pthread_mutex_destroy(&pf->lock);
+  pthread_cond_destroy(&pf->wake);
+  pthread_cond_destroy(&pf->done);
+  free(pf);
+  vm->prefetch = NULL;
+}
+
+void scvm_prefetch(scvm_t* vm, unsigned type, unsigned num) {
+  scvm_prefetch_t* pf = vm->prefetch;
+  scvm_prefetch_job_t* job = NULL;
+  int i;
+
+  if(!pf || type >= SCVM_RES_MAX || num >= vm->res[type].num ||
+     !vm->res[type].load || !vm->res[type].nuke ||
+     vm->res[type].idx[num].data)
+    return;
+
+  pthread_mutex_lock(&pf->lock);
+  for(i = 0 ; i < SCVM_PREFETCH_MAX_JOB ; i++) {
+    scvm_prefetch_job_t* j = &pf->job[i];
+    if(j->state != SCVM_PREFETCH_FREE && j->type == type && j->num == num)
+      break;
+    // use a free slot, or else drop the oldest unused result
+    if(j->state == SCVM_PREFETCH_FREE ||
+       ((j->state == SCVM_PREFETCH_READY ||
+         j->state == SCVM_PREFETCH_FAILED) &&
+        (!job || (job->state != SCVM_PREFETCH_FREE &&
+                  pf->seq - j->seq > pf->seq - job->seq))))
+      job = j;
+  }
+  if(i >= SCVM_PREFETCH_MAX_JOB && job) {
+    if(job->state != SCVM_PREFETCH_FREE) {
+      vm->prefetch_wasted++;
+      scvm_prefetch_free_job(vm,job);
+    }
+    job->type = type;
+    job->num = num;
+    job->seq = pf->seq++;
+    job->state = SCVM_PREFETCH_QUEUED;
+    vm->prefetch_requests++;
+    pthread_cond_signal(&pf->wake);
+  }
+  pthread_mutex_unlock(&pf->lock);
+}
+
+// Look for the exits in the room scripts, that is a constant
+// room number pushed right before a start room op.
+static void scvm_prefetch_scan_script(scvm_t* vm, scvm_script_t* scr) {
+  int i;
+
+  if(!scr) return;
+  for(i = 2 ; i+1 < scr->size ; i++) {
+    if(scr->code[i+1] != 0x7B) continue;
+    if(scr->code[i-1] == 0x00) // push byte
+      scvm_prefetch(vm,SCVM_RES_ROOM,scr->code[i]);
+    else if(scr->code[i-2] == 0x01) // push word
+      scvm_prefetch(vm,SCVM_RES_ROOM,SCC_GET_16LE(scr->code,i-1));
+  }
+}
+
+void scvm_prefetch_room(scvm_t* vm, scvm_room_t* room) {
+  scvm_prefetch_t* pf = vm->prefetch;
+  int i;
+
+  if(!pf) return;
+
+  for(i = 0 ; i < pf->num_hint ; i++)
+    if(pf->hint[i].room == room->id)
+      scvm_prefetch(vm,pf->hint[i].type,pf->hint[i].num);
+
+  scvm_prefetch_scan_script(vm,room->entry);
+  for(i = 0 ; i < room->num_script ; i++)
+    scvm_prefetch_scan_script(vm,room->script[i]);
+  for(i = 0 ; i < room->num_object ; i++)
+    if(room->object[i])
+      scvm_prefetch_scan_script(vm,room->object[i]->script);
+}
+
+void* scvm_prefetch_get(scvm_t* vm, unsigned type, unsigned num,
+                        unsigned* size) {
+  scvm_prefetch_t* pf = vm->prefetch;
+  scvm_prefetch_job_t* job = NULL;
+  void* data = NULL;
+  int i;
+
+  if(!pf) return NULL;
+
+  pthread_mutex_lock(&pf->lock);
+  for(i = 0 ; i < SCVM_PREFETCH_MAX_JOB ; i++)
+    if(pf->job[i].state != SCVM_PREFETCH_FREE &&
+       pf->job[i].type == type && pf->job[i].num == num) {
+      job = &pf->job[i];
+      break;
+    }
+  if(job) {
+    if(job->state == SCVM_PREFETCH_LOADING) {
+      vm->prefetch_waits++;
+      while(job->state == SCVM_PREFETCH_LOADING)
+        pthread_cond_wait(&pf->done,&pf->lock);
+    }
+    if(job->state == SCVM_PREFETCH_READY) {
+      vm->prefetch_hits++;
+      if(type == SCVM_RES_ROOM) {
+        scvm_prefetch_free_images(pf->room_images);
+        pf->room_images = job->data;
+      } else {
+        data = job->data;
+        *size = job->size;
+      }
+      job->data = NULL;
+    }
+    scvm_prefetch_free_job(vm,job);
+  }
+  pthread_mutex_unlock(&pf->lock);
+  return data;
+}
+
+int scvm_prefetch_get_image(scvm_t* vm, unsigned width, unsigned height,
+                            unsigned num_zplane, scvm_image_t* img,
+                            scc_fd_t* fd) {
+  scvm_prefetch_t* pf = vm->prefetch;
+  scvm_prefetch_image_t** e, *found;
+  off_t pos;
+
+  if(!pf || !pf->room_images) return 0;
+
+  pos = scc_fd_pos(fd);
+  for(e = &pf->room_images ; *e ; e = &(*e)->next)
+    if((*e)->pos == pos && (*e)->width == width &&
+       (*e)->height == height && (*e)->num_zplane == num_zplane)
+      break;
+  if(!*e) return 0;
+
+  found = *e;
+  *e = found->next;
+  *img = found->img;
+  scc_fd_seek(fd,found->end,SEEK_SET);
+  free(found);
+  return 1;
+}
+
+void scvm_prefetch_release(scvm_t* vm) {
+  if(!vm->prefetch) return;
+  scvm_prefetch_free_images(vm->prefetch->room_images);
+  vm->prefetch->room_images = NULL;
+}
+
+#else
+
+int scvm_prefetch_init(scvm_t* vm, char** hints) {
+  scc_log(LOG_ERR,"This build doesn't support prefetching.\n");
+  return 0;
+}
+
+void scvm_prefetch_uninit(scvm_t* vm) {}
+
+void scvm_prefetch(scvm_t* vm, unsigned type, unsigned num) {}
+
+void scvm_prefetch_room(scvm_t* vm, scvm_room_t* room) {}
+
+void* scvm_prefetch_get(scvm_t* vm, unsigned type, unsigned num,
+                        unsigned* size) {
+  return NULL;
+}
+
+int scvm_prefetch_get_image(scvm_t* vm, unsigned width, unsigned height,
+                            unsigned num_zplane, scvm_image_t* img,
+                            scc_fd_t* fd) {
+  return 0;
+}
+
+void scvm_prefetch_release(scvm_t* vm) {}
+
+#endif
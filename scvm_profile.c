@@ -0,0 +1,284 @@
+/* ScummC
+ * Copyright (C) 2009  Alban Bedel
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/**
+ * @file scvm_profile.c
+ * @ingroup scvm
+ * @brief SCVM script profiler
+ *
+ * While profiling the threads are run with the tracing interpreter
+ * and every op is timed. The samples are accumulated per stack, that
+ * is the scripts of the thread and its parents followed by the op.
+ * The per op and per script figures are summed up from the stacks
+ * when the report is made.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "scc_fd.h"
+#include "scc_util.h"
+#include "scc_cost.h"
+#include "scc_box.h"
+#include "scvm_res.h"
+#include "scvm_thread.h"
+#include "scvm.h"
+
+#define SCVM_PROFILE_HASH_SIZE 1024
+#define SCVM_PROFILE_MAX_DEPTH 16
+
+typedef struct scvm_profile_entry scvm_profile_entry_t;
+struct scvm_profile_entry {
+  scvm_profile_entry_t* next;
+  uint32_t hash;
+  unsigned op;
+  unsigned depth;
+  /// Room and script id of each frame, starting from the outermost one
+  uint64_t frame[SCVM_PROFILE_MAX_DEPTH];
+  uint64_t count, time;
+};
+
+struct scvm_profile {
+  uint64_t count, time;
+  unsigned num_entry;
+  scvm_profile_entry_t* hash[SCVM_PROFILE_HASH_SIZE];
+};
+
+/// Sum of the samples for a script or an op
+typedef struct scvm_profile_sum {
+  uint64_t id;
+  uint64_t count, time;
+} scvm_profile_sum_t;
+
+static uint64_t scvm_profile_now(void) {
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#else
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec*1000000000ULL + tv.tv_usec*1000ULL;
+#endif
+}
+
+// Local and object scripts are only meaningful with their room
+static uint64_t scvm_profile_frame(scvm_t* vm, scvm_thread_t* thread) {
+  uint64_t room = 0;
+  if(thread->script->id >= 200 && vm->room)
+    room = vm->room->id;
+  return (room << 32) | thread->script->id;
+}
+
+static void scvm_profile_clear(scvm_profile_t* prof) {
+  scvm_profile_entry_t* e, *next;
+  int i;
+  for(i = 0 ; i < SCVM_PROFILE_HASH_SIZE ; i++) {
+    for(e = prof->hash[i] ; e ; e = next) {
+      next = e->next;
+      free(e);
+    }
+    prof->hash[i] = NULL;
+  }
+  prof->num_entry = 0;
+  prof->count = prof->time = 0;
+}
+
+void scvm_profile_start(scvm_t* vm) {
+  if(!vm->profile)
+    vm->profile = calloc(1,sizeof(scvm_profile_t));
+  else
+    scvm_profile_clear(vm->profile);
+  vm->profiling = 1;
+}
+
+void scvm_profile_stop(scvm_t* vm) {
+  vm->profiling = 0;
+}
+
+int scvm_profile_do_op(scvm_t* vm, scvm_thread_t* thread) {
+  scvm_profile_t* prof = vm->profile;
+  scvm_profile_entry_t* e;
+  uint64_t frame[SCVM_PROFILE_MAX_DEPTH];
+  scvm_thread_t* t;
+  uint32_t hash;
+  uint64_t start;
+  int i,depth = 0,r;
+  unsigned op;
+
+  if(thread->code_ptr >= thread->script->size)
+    return scvm_thread_do_op(vm,thread,vm->optable);
+
+  // collect the stack before the op can change it
+  op = thread->script->code[thread->code_ptr];
+  for(t = thread ; t && depth < SCVM_PROFILE_MAX_DEPTH ; t = t->parent)
+    frame[depth++] = scvm_profile_frame(vm,t);
+
+  start = scvm_profile_now();
+  r = scvm_thread_do_op(vm,thread,vm->optable);
+  start = scvm_profile_now() - start;
+
+  hash = op;
+  for(i = 0 ; i < depth ; i++)
+    hash = hash*31 + (uint32_t)(frame[i] ^ (frame[i] >> 32));
+
+  for(e = prof->hash[hash % SCVM_PROFILE_HASH_SIZE] ; e ; e = e->next) {
+    if(e->hash != hash || e->op != op || e->depth != depth) continue;
+    for(i = 0 ; i < depth ; i++)
+      if(e->frame[i] != frame[depth-1-i]) break;
+    if(i == depth) break;
+  }
+  if(!e) {
+    e = calloc(1,sizeof(scvm_profile_entry_t));
+    e->hash = hash;
+    e->op = op;
+    e->depth = depth;
+    for(i = 0 ; i < depth ; i++)
+      e->frame[i] = frame[depth-1-i];
+    e->next = prof->hash[hash % SCVM_PROFILE_HASH_SIZE];
+    prof->hash[hash % SCVM_PROFILE_HASH_SIZE] = e;
+    prof->num_entry++;
+  }
+  e->count++;
+  e->time += start;
+  prof->count++;
+  prof->time += start;
+  return r;
+}
+
+static int scvm_profile_sum_cmp(const void* a, const void* b) {
+  const scvm_profile_sum_t* sa = a, *sb = b;
+  if(sa->time != sb->time) return sa->time < sb->time ? 1 : -1;
+  return sa->id < sb->id ? -1 : sa->id > sb->id;
+}
+
+static scvm_profile_sum_t* scvm_profile_add(scvm_profile_sum_t* sum,
+                                            unsigned* num, uint64_t id,
+                                            scvm_profile_entry_t* e) {
+  int i;
+  for(i = 0 ; i < *num ; i++)
+    if(sum[i].id == id) break;
+  if(i == *num) {
+    if(!(i & 15))
+      sum = realloc(sum,(i+16)*sizeof(scvm_profile_sum_t));
+    sum[i].id = id;
+    sum[i].count = sum[i].time = 0;
+    (*num)++;
+  }
+  sum[i].count += e->count;
+  sum[i].time += e->time;
+  return sum;
+}
+
+static const char* scvm_profile_op_name(scvm_t* vm, unsigned op) {
+  return vm->optable[op].name ? vm->optable[op].name : "unknown op";
+}
+
+static void scvm_profile_print_frame(FILE* out, uint64_t frame) {
+  unsigned room = frame >> 32, id = frame & 0xFFFFFFFF;
+  if(id < 200)
+    fprintf(out,"script %d",id);
+  else if(id == 0x0ECD0000)
+    fprintf(out,"room %d entry",room);
+  else if(id == 0x1ECD0000)
+    fprintf(out,"room %d exit",room);
+  else if(id & 0x10000)
+    fprintf(out,"room %d object %d",room,id & 0xFFFF);
+  else
+    fprintf(out,"room %d script %d",room,id);
+}
+
+void scvm_profile_report(scvm_t* vm, FILE* out, unsigned max_lines) {
+  scvm_profile_t* prof = vm->profile;
+  scvm_profile_sum_t* op_sum = NULL, *scr_sum = NULL;
+  unsigned num_op = 0, num_scr = 0;
+  scvm_profile_entry_t* e;
+  uint64_t total;
+  int i;
+
+  if(!prof) {
+    fprintf(out,"No profile data.\n");
+    return;
+  }
+
+  for(i = 0 ; i < SCVM_PROFILE_HASH_SIZE ; i++)
+    for(e = prof->hash[i] ; e ; e = e->next) {
+      op_sum = scvm_profile_add(op_sum,&num_op,e->op,e);
+      scr_sum = scvm_profile_add(scr_sum,&num_scr,e->frame[e->depth-1],e);
+    }
+  qsort(op_sum,num_op,sizeof(scvm_profile_sum_t),scvm_profile_sum_cmp);
+  qsort(scr_sum,num_scr,sizeof(scvm_profile_sum_t),scvm_profile_sum_cmp);
+  total = prof->time ? prof->time : 1;
+
+  fprintf(out,"Profile: %" PRIu64 " ops in %.3f ms, %d stacks\n",
+          prof->count,prof->time/1000000.0,prof->num_entry);
+
+  fprintf(out,"\n  %12s %10s %6s  %s\n","Count","Time (ms)","%","Op");
+  for(i = 0 ; i < num_op && (!max_lines || i < max_lines) ; i++)
+    fprintf(out,"  %12" PRIu64 " %10.3f %5.1f%%  %s (0x%02X)\n",
+            op_sum[i].count,op_sum[i].time/1000000.0,
+            op_sum[i].time*100.0/total,
+            scvm_profile_op_name(vm,op_sum[i].id),(unsigned)op_sum[i].id);
+
+  fprintf(out,"\n  %12s %10s %6s  %s\n","Count","Time (ms)","%","Script");
+  for(i = 0 ; i < num_scr && (!max_lines || i < max_lines) ; i++) {
+    fprintf(out,"  %12" PRIu64 " %10.3f %5.1f%%  ",
+            scr_sum[i].count,scr_sum[i].time/1000000.0,
+            scr_sum[i].time*100.0/total);
+    scvm_profile_print_frame(out,scr_sum[i].id);
+    fprintf(out,"\n");
+  }
+
+  free(op_sum);
+  free(scr_sum);
+}
+
+int scvm_profile_write_stacks(scvm_t* vm, char* path) {
+  scvm_profile_t* prof = vm->profile;
+  scvm_profile_entry_t* e;
+  FILE* out;
+  int i,j;
+
+  if(!prof) {
+    scc_log(LOG_ERR,"No profile data.\n");
+    return 0;
+  }
+  if(!(out = fopen(path,"w"))) {
+    scc_log(LOG_ERR,"Failed to open %s.\n",path);
+    return 0;
+  }
+  // The collapsed format used by the flamegraph tools, the
+  // frames are separated by ';' and the value is the time in ns.
+  for(i = 0 ; i < SCVM_PROFILE_HASH_SIZE ; i++)
+    for(e = prof->hash[i] ; e ; e = e->next) {
+      for(j = 0 ; j < e->depth ; j++) {
+        scvm_profile_print_frame(out,e->frame[j]);
+        fprintf(out,";");
+      }
+      fprintf(out,"%s %" PRIu64 "\n",scvm_profile_op_name(vm,e->op),e->time);
+    }
+  fclose(out);
+  return 1;
+}
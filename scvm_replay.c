@@ -0,0 +1,193 @@
+/* ScummC
+ * Copyright (C) 2009  Alban Bedel
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/**
+ * @file scvm_replay.c
+ * @ingroup scvm
+ * @brief SCVM input recording and replay
+ *
+ * The input log starts with a SCVI tag and the random seed, followed
+ * by the events. Each event is made of its type, the number of cycles
+ * since the previous event on 16 bits, and its arguments: one byte for
+ * the keys and buttons, the x and y position on 16 bits each for the
+ * mouse. Longer delays are stored with SKIP events.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "scc_fd.h"
+#include "scc_util.h"
+#include "scc_cost.h"
+#include "scc_box.h"
+#include "scvm_res.h"
+#include "scvm_thread.h"
+#include "scvm.h"
+
+#define SCVM_INPUT_SKIP 0
+
+static void scvm_input_write(scvm_t* vm, unsigned type, int a, int b) {
+  scc_fd_t* fd = vm->input_record;
+  unsigned delta = vm->cycle - vm->input_record_cycle;
+
+  while(delta >= 0xFFFF) {
+    scc_fd_w8(fd,SCVM_INPUT_SKIP);
+    scc_fd_w16le(fd,0xFFFF);
+    delta -= 0xFFFF;
+  }
+  scc_fd_w8(fd,type);
+  scc_fd_w16le(fd,delta);
+  if(type == SCVM_INPUT_MOUSE) {
+    scc_fd_w16le(fd,a);
+    scc_fd_w16le(fd,b);
+  } else
+    scc_fd_w8(fd,a);
+  vm->input_record_cycle = vm->cycle;
+}
+
+// Read the next event, the replay stop at the end of the log
+static void scvm_input_read(scvm_t* vm) {
+  scc_fd_t* fd = vm->input_replay;
+  uint8_t head[3];
+
+  while(1) {
+    if(scc_fd_read(fd,head,3) != 3) {
+      scc_log(LOG_MSG,"Replay finished at cycle %u.\n",vm->cycle);
+      scc_fd_close(fd);
+      vm->input_replay = NULL;
+      return;
+    }
+    vm->input_replay_cycle += SCC_GET_16LE(head,1);
+    if(head[0] != SCVM_INPUT_SKIP) break;
+  }
+  vm->input_next.type = head[0];
+  if(head[0] == SCVM_INPUT_MOUSE) {
+    vm->input_next.a = (int16_t)scc_fd_r16le(fd);
+    vm->input_next.b = (int16_t)scc_fd_r16le(fd);
+  } else
+    vm->input_next.a = scc_fd_r8(fd);
+}
+
+int scvm_input_record(scvm_t* vm, char* path, unsigned seed) {
+  if(!(vm->input_record = new_scc_fd(path,O_WRONLY|O_CREAT|O_TRUNC,0))) {
+    scc_log(LOG_ERR,"Failed to open %s: %s\n",path,strerror(errno));
+    return 0;
+  }
+  scc_fd_w32(vm->input_record,MKID('S','C','V','I'));
+  scc_fd_w32le(vm->input_record,seed);
+  vm->input_record_cycle = vm->cycle;
+  return 1;
+}
+
+int scvm_input_replay(scvm_t* vm, char* path, unsigned* seed) {
+  if(!(vm->input_replay = new_scc_fd(path,O_RDONLY,0))) {
+    scc_log(LOG_ERR,"Failed to open %s: %s\n",path,strerror(errno));
+    return 0;
+  }
+  if(scc_fd_r32(vm->input_replay) != MKID('S','C','V','I')) {
+    scc_log(LOG_ERR,"%s is not an input log.\n",path);
+    scc_fd_close(vm->input_replay);
+    vm->input_replay = NULL;
+    return 0;
+  }
+  *seed = scc_fd_r32le(vm->input_replay);
+  vm->input_replay_cycle = vm->cycle;
+  scvm_input_read(vm);
+  return 1;
+}
+
+int scvm_input_event(scvm_t* vm, unsigned type, int a, int b) {
+  // ignore the live input while replaying
+  if(vm->input_replay && !vm->input_feeding) return 0;
+  if(vm->input_record) scvm_input_write(vm,type,a,b);
+  return 1;
+}
+
+void scvm_input_feed(scvm_t* vm) {
+  if(!vm->input_replay) return;
+
+  vm->input_feeding = 1;
+  while(vm->input_replay && vm->input_replay_cycle <= vm->cycle) {
+    switch(vm->input_next.type) {
+    case SCVM_INPUT_KEY_DOWN:
+      scvm_press_key(vm,vm->input_next.a);
+      break;
+    case SCVM_INPUT_KEY_UP:
+      scvm_release_key(vm,vm->input_next.a);
+      break;
+    case SCVM_INPUT_BUTTON_DOWN:
+      scvm_press_button(vm,vm->input_next.a);
+      break;
+    case SCVM_INPUT_BUTTON_UP:
+      scvm_release_button(vm,vm->input_next.a);
+      break;
+    case SCVM_INPUT_MOUSE:
+      scvm_set_mouse_position(vm,vm->input_next.a,vm->input_next.b);
+      break;
+    default:
+      scc_log(LOG_WARN,"Invalid input event type: %d\n",
+              vm->input_next.type);
+    }
+    scvm_input_read(vm);
+  }
+  vm->input_feeding = 0;
+}
+
+int scvm_frame_hash_open(scvm_t* vm, char* path) {
+  if(!(vm->frame_hash = new_scc_fd(path,O_WRONLY|O_CREAT|O_TRUNC,0))) {
+    scc_log(LOG_ERR,"Failed to open %s: %s\n",path,strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+void scvm_frame_hash(scvm_t* vm) {
+  scvm_view_t* view = vm->view;
+  // FNV-1a
+  uint32_t hash = 2166136261U;
+  uint8_t* ptr;
+  int x,y;
+
+  if(!vm->frame_hash || !view->buffer) return;
+
+  ptr = (uint8_t*)view->palette;
+  for(x = 0 ; x < sizeof(view->palette) ; x++)
+    hash = (hash ^ ptr[x]) * 16777619U;
+  for(y = 0 ; y < view->height ; y++) {
+    ptr = view->buffer + y*view->stride;
+    for(x = 0 ; x < view->width ; x++)
+      hash = (hash ^ ptr[x]) * 16777619U;
+  }
+  scc_fd_printf(vm->frame_hash,"%u %08x\n",vm->cycle,hash);
+}
+
+void scvm_input_close(scvm_t* vm) {
+  if(vm->input_record) scc_fd_close(vm->input_record);
+  if(vm->input_replay) scc_fd_close(vm->input_replay);
+  if(vm->frame_hash) scc_fd_close(vm->frame_hash);
+  vm->input_record = vm->input_replay = vm->frame_hash = NULL;
+}
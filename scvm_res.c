@@ -57,6 +57,8 @@ scc_fd_t* scvm_open_file(scvm_t* vm,unsigned num) {
     vm->file[num] = new_scc_fd(name,O_RDONLY,vm->file_key);
     if(!vm->file[num])
       scc_log(LOG_ERR,"Failed to open %s: %s\n",name,strerror(errno));
+    else
+      scc_fd_map(vm->file[num]);
   }
   return vm->file[num];
 }
@@ -84,7 +86,6 @@ scc_fd_t* scvm_open_res_file(scvm_t* vm,unsigned res_type,unsigned res_id) {
   offset = res->idx[res_id].offset;
   if(scc_fd_seek(fd,offset,SEEK_SET) != offset) {
     scc_log(LOG_ERR,"Failed to seek to %d in %s.\n",offset,fd->filename);
-    scvm_close_file(vm,res->idx[res_id].file);
     return NULL;
   }
 
@@ -167,7 +168,146 @@ int scvm_unlock_res(scvm_t* vm, unsigned type, unsigned num) {
 }
 
 
+// Set the VM variables reporting the memory usage
+static void scvm_res_update_vars(scvm_t* vm) {
+  unsigned total = vm->res_hits + vm->res_misses;
+  vm->var->heap_space = vm->res_size < vm->res_budget ?
+    (vm->res_budget - vm->res_size) / 1024 : 0;
+  vm->var->memory_performance = total ?
+    (uint64_t)vm->res_hits * 100 / total : 100;
+}
+
+// Memory used by a loaded resource. The resources mostly keep
+// their data as found in the file, so the block size is used as a base.
+static unsigned scvm_res_size(scvm_t* vm, unsigned type, void* data,
+                              unsigned block_size) {
+  unsigned size = block_size;
+  int i;
+
+  switch(type) {
+  case SCVM_RES_ROOM: {
+    scvm_room_t* room = data;
+    // the decoded image and zplanes
+    size += room->width*room->height*(1+room->num_zplane);
+  } break;
+  case SCVM_RES_SCRIPT: {
+    scvm_script_t* scr = data;
+    size = sizeof(scvm_script_t) + scr->size*(sizeof(scvm_insn_t)+1);
+  } break;
+  case SCVM_RES_CHARSET: {
+    scc_charmap_t* chset = data;
+    size = sizeof(scc_charmap_t);
+    for(i = 0 ; i < SCC_MAX_CHAR ; i++)
+      size += chset->chars[i].w*chset->chars[i].h;
+  } break;
+  case SCVM_RES_COSTUME:
+    size += sizeof(scc_cost_t);
+    break;
+  }
+  return size;
+}
+
+static int scvm_script_in_use(scvm_t* vm, scvm_script_t* scr) {
+  int i;
+  if(!scr) return 0;
+  for(i = 0 ; i < vm->num_thread ; i++)
+    if(vm->thread[i].state != SCVM_THREAD_STOPPED &&
+       vm->thread[i].script == scr)
+      return 1;
+  return 0;
+}
+
+// Check if anything still point to a resource
+static int scvm_res_in_use(scvm_t* vm, unsigned type, void* data) {
+  int i;
+
+  switch(type) {
+  case SCVM_RES_ROOM: {
+    scvm_room_t* room = data;
+    if(room == vm->room || room == vm->view->room ||
+       scvm_script_in_use(vm,room->entry) ||
+       scvm_script_in_use(vm,room->exit))
+      return 1;
+    for(i = 0 ; i < room->num_script ; i++)
+      if(scvm_script_in_use(vm,room->script[i]))
+        return 1;
+  } break;
+  case SCVM_RES_SCRIPT:
+    return scvm_script_in_use(vm,data);
+  case SCVM_RES_CHARSET:
+    return data == vm->current_charset;
+  case SCVM_RES_COSTUME:
+    for(i = 0 ; i < vm->num_actor ; i++)
+      if(vm->actor[i].costdec.cost == data)
+        return 1;
+    break;
+  }
+  return 0;
+}
+
+/// A resource that can be released
+typedef struct scvm_res_candidate {
+  unsigned age;
+  unsigned type, num;
+} scvm_res_candidate_t;
+
+// Oldest first, then in the index order
+static int scvm_res_candidate_cmp(const void* a, const void* b) {
+  const scvm_res_candidate_t* ca = a, *cb = b;
+  if(ca->age != cb->age) return ca->age < cb->age ? 1 : -1;
+  if(ca->type != cb->type) return ca->type < cb->type ? -1 : 1;
+  return ca->num < cb->num ? -1 : ca->num > cb->num;
+}
+
+void scvm_res_evict(scvm_t* vm) {
+  scvm_res_candidate_t* lru = NULL;
+  unsigned num_lru = 0, lru_size = 0;
+  int type,i;
+
+  if(vm->res_size <= vm->res_budget) {
+    scvm_res_update_vars(vm);
+    return;
+  }
+
+  // collect the loaded resources once and release the least
+  // recently used ones until we are back in the budget
+  for(type = 0 ; type < SCVM_RES_MAX ; type++) {
+    scvm_res_type_t* res = &vm->res[type];
+    if(!res->nuke) continue;
+    for(i = 0 ; i < res->num ; i++) {
+      scvm_res_t* r = &res->idx[i];
+      if(!r->data || (r->flags & SCVM_RES_LOCKED) ||
+         r->last_use == vm->cycle)
+        continue;
+      if(num_lru >= lru_size) {
+        lru_size += 64;
+        lru = realloc(lru,lru_size*sizeof(scvm_res_candidate_t));
+      }
+      lru[num_lru].age = vm->cycle - r->last_use;
+      lru[num_lru].type = type;
+      lru[num_lru].num = i;
+      num_lru++;
+    }
+  }
+  qsort(lru,num_lru,sizeof(scvm_res_candidate_t),scvm_res_candidate_cmp);
+
+  for(i = 0 ; i < num_lru && vm->res_size > vm->res_budget ; i++) {
+    scvm_res_type_t* res = &vm->res[lru[i].type];
+    scvm_res_t* r = &res->idx[lru[i].num];
+    if(scvm_res_in_use(vm,lru[i].type,r->data)) continue;
+    scc_log(LOG_V,"Releasing %s %d (%u bytes)\n",res->name,
+            lru[i].num,r->size);
+    res->nuke(r->data);
+    r->data = NULL;
+    vm->res_size -= r->size;
+    vm->res_evictions++;
+  }
+  free(lru);
+  scvm_res_update_vars(vm);
+}
+
 void* scvm_load_res(scvm_t* vm, unsigned type, unsigned num) {
+  scvm_res_t* r;
   // check type and num
   if(type >= SCVM_RES_MAX) {
     scc_log(LOG_ERR,"Invalid resource type: %d\n",type);
@@ -177,25 +317,76 @@ void* scvm_load_res(scvm_t* vm, unsigned type, unsigned num) {
     scc_log(LOG_ERR,"Invalid %s number: %d\n",vm->res[type].name,num);
     return NULL;
   }
-  if(!vm->res[type].load && !vm->res[type].idx[num].data) {
+  r = &vm->res[type].idx[num];
+  if(!vm->res[type].load && !r->data) {
     scc_log(LOG_ERR,"The %s loader is missing. Implement it!\n",
             vm->res[type].name);
     return NULL;
   }
-  // load if needed
-  if(!vm->res[type].idx[num].data) {
+  r->last_use = vm->cycle;
+  if(r->data) {
+    vm->res_hits++;
+    scvm_res_update_vars(vm);
+    return r->data;
+  }
+  // load it
+  {
     scc_fd_t* fd = scvm_open_res_file(vm,type,num);
+    unsigned block_size;
     if(!fd) return NULL;
-   vm->res[type].idx[num].data = vm->res[type].load(vm,fd,num);
-    if(!vm->res[type].idx[num].data)
+    // peek at the block size
+    scc_fd_r32(fd);
+    block_size = scc_fd_r32be(fd);
+    scc_fd_seek(fd,-8,SEEK_CUR);
+    vm->res_misses++;
+    if(!(r->data = scvm_prefetch_get(vm,type,num,&block_size)))
+      r->data = vm->res[type].load(vm,fd,num);
+    if(type == SCVM_RES_ROOM)
+      scvm_prefetch_release(vm);
+    if(!r->data) {
       scc_log(LOG_ERR,"Failed to load %s %d\n",vm->res[type].name,num);
+      return NULL;
+    }
+    r->size = scvm_res_size(vm,type,r->data,block_size);
+    vm->res_size += r->size;
   }
-  return vm->res[type].idx[num].data;
+  scvm_res_evict(vm);
+  return r->data;
+}
+
+// Create a script from the next size bytes of the file. If the file
+// is mapped the code is used in place, otherwise it is copied after
+// the struct. The decoded instruction array is allocated right after
+// the struct, so in both case a simple free() release the script.
+static scvm_script_t* scvm_read_script(scc_fd_t* fd, unsigned id,
+                                       unsigned size) {
+  scvm_script_t* scrp;
+  uint8_t* code = scc_fd_view(fd,size);
+  unsigned insn_size = size*sizeof(scvm_insn_t);
+
+  if(code) {
+    scrp = malloc(sizeof(scvm_script_t)+insn_size);
+    scrp->insn = (scvm_insn_t*)(scrp+1);
+    scrp->code = code;
+  } else {
+    scrp = malloc(sizeof(scvm_script_t)+insn_size+size);
+    scrp->insn = (scvm_insn_t*)(scrp+1);
+    scrp->code = (uint8_t*)(scrp->insn+size);
+    if(size > 0 && scc_fd_read(fd,scrp->code,size) != size) {
+      scc_log(LOG_ERR,"Error loading script %d: %s\n",id,strerror(errno));
+      free(scrp);
+      return NULL;
+    }
+  }
+  memset(scrp->insn,0,insn_size);
+  scrp->id = id;
+  scrp->flags = 0;
+  scrp->size = size;
+  return scrp;
 }
 
 void* scvm_load_script(scvm_t* vm,scc_fd_t* fd, unsigned num) {
   uint32_t type,len;
-  scvm_script_t* scrp;
   
   type = scc_fd_r32(fd);
   len = scc_fd_r32be(fd);
@@ -204,22 +395,7 @@ void* scvm_load_script(scvm_t* vm,scc_fd_t* fd, unsigned num) {
             UNMKID(type),len);
     return NULL;
   }
-  scrp = malloc(sizeof(scvm_script_t)+len-8);
-  scrp->id = num;
-  scrp->size = len-8;
-  if(scrp->size > 0) {
-    int total = 0, r;
-    while(total < scrp->size) {
-      r = scc_fd_read(fd,scrp->code+total,scrp->size-total);
-      if(r < 0) {
-        scc_log(LOG_ERR,"Error loading script %d: %s\n",num,strerror(errno));
-        free(scrp);
-        return NULL;
-      }
-      total += r;
-    }
-  }
-  return scrp;
+  return scvm_read_script(fd,num,len-8);
 }
 
 int scvm_load_image(unsigned width, unsigned height, unsigned num_zplane,
@@ -230,14 +406,20 @@ int scvm_load_image(unsigned width, unsigned height, unsigned num_zplane,
   if(type != MKID('S','M','A','P') ||
      size < 8+(width/8)*4) return 0;
   else {
-    uint8_t smap[size-8];
-    if(scc_fd_read(fd,smap,size-8) != size-8)
-      return 0;
+    uint8_t* smap = scc_fd_view(fd,size-8), *buf = NULL;
+    if(!smap) {
+      smap = buf = malloc(size-8);
+      if(scc_fd_read(fd,smap,size-8) != size-8) {
+        free(buf);
+        return 0;
+      }
+    }
     img->data = calloc(1,width*height);
-    if(!(i = scc_decode_image(img->data,width,
-                              width,height,
-                              smap,size-8,-1)))
-      return 0;
+    i = scc_decode_image(img->data,width,
+                         width,height,
+                         smap,size-8,-1);
+    free(buf);
+    if(!i) return 0;
     img->have_trans = i-1;
   }
   if(!num_zplane) return 1;
@@ -250,14 +432,21 @@ int scvm_load_image(unsigned width, unsigned height, unsigned num_zplane,
     if(type != MKID('Z','P',buf[0],buf[1]) ||
        size < 8+(width/8)*4) return 0;
     else {
-      uint8_t zmap[size-8];
+      uint8_t* zmap = scc_fd_view(fd,size-8), *zbuf = NULL;
       uint8_t zbit[width/8*height];
       int j;
-      if(scc_fd_read(fd,zmap,size-8) != size-8)
-        return 0;
-      if(!scc_decode_zbuf(zbit,width/8,
+      if(!zmap) {
+        zmap = zbuf = malloc(size-8);
+        if(scc_fd_read(fd,zmap,size-8) != size-8) {
+          free(zbuf);
+          return 0;
+        }
+      }
+      j = scc_decode_zbuf(zbit,width/8,
                           width,height,
-                          zmap,size-8,0))
+                          zmap,size-8,0);
+      free(zbuf);
+      if(!j)
         return 0;
       img->zplane[i] = malloc(width*height);
       for(j = 0 ; j < width*height ; j++)
@@ -268,6 +457,15 @@ int scvm_load_image(unsigned width, unsigned height, unsigned num_zplane,
   return 1;
 }
 
+// Use the image decoded by the loader thread if there is one
+static int scvm_read_image(scvm_t* vm, unsigned width, unsigned height,
+                           unsigned num_zplane, scvm_image_t* img,
+                           scc_fd_t* fd) {
+  if(scvm_prefetch_get_image(vm,width,height,num_zplane,img,fd))
+    return 1;
+  return scvm_load_image(width,height,num_zplane,img,fd);
+}
+
 scvm_object_t* scvm_load_obim(scvm_t* vm, scc_fd_t* fd) {
   uint32_t type = scc_fd_r32(fd);
   uint32_t size = scc_fd_r32be(fd);
@@ -316,7 +514,7 @@ scvm_object_t* scvm_load_obim(scvm_t* vm, scc_fd_t* fd) {
     size = scc_fd_r32be(fd);
     if((type & 0xFFFF) != ('I'|'M'<<8) ||
        size < 8) return 0;
-    if(!scvm_load_image(obj->width,obj->height,obj->num_zplane,
+    if(!scvm_read_image(vm,obj->width,obj->height,obj->num_zplane,
                         &obj->image[i],fd)) return NULL;
   }
   
@@ -354,9 +552,8 @@ scvm_object_t* scvm_load_obcd(scvm_t* vm, scc_fd_t* fd) {
   } else
     scc_fd_seek(fd,8,SEEK_CUR);
   obj->parent_state = scc_fd_r8(fd);
-  // hack, the real pointer get resolved when all
-  // object are loaded.
-  obj->parent = (scvm_object_t*)((intptr_t)scc_fd_r8(fd));
+  // the pointer get resolved when all object are loaded
+  obj->parent_num = scc_fd_r8(fd);
   scc_fd_r32(fd); // unknown
   obj->actor_dir = scc_fd_r8(fd);
 
@@ -385,13 +582,9 @@ scvm_object_t* scvm_load_obcd(scvm_t* vm, scc_fd_t* fd) {
           entries[2*num_entries+1] - 8 - 3*num_entries - 1;
       }
     }
-    if(size > 0) {
-      obj->script = malloc(sizeof(scvm_script_t)+size);
-      if(scc_fd_read(fd,obj->script->code,size) != size)
-        return 0;
-      obj->script->id = obj->id | 0x10000;
-      obj->script->size = size;
-    }
+    if(size > 0 &&
+       !(obj->script = scvm_read_script(fd,obj->id | 0x10000,size)))
+      return 0;
     
     type = scc_fd_r32(fd);
     size = scc_fd_r32be(fd);
@@ -427,7 +620,6 @@ void* scvm_load_object(scvm_t* vm, int room_id, int obj_id, unsigned wich) {
   if(type != MKID('R','O','O','M')|| size < 16) {
     scc_log(LOG_ERR,"Bad ROOM block %d: %c%c%c%c %d\n",room_id,
             UNMKID(type),size);
-    scvm_close_res_file(vm,SCVM_RES_ROOM,room_id);
     return NULL;
   }
   while(wich && len < size) {
@@ -557,7 +749,7 @@ void* scvm_load_room(scvm_t* vm,scc_fd_t* fd, unsigned num) {
       sub_block_size = scc_fd_r32be(fd);
       if(type != MKID('I','M','0','0') ||
          sub_block_size < 8+8) goto bad_block;
-      if(!scvm_load_image(room->width,room->height,room->num_zplane,
+      if(!scvm_read_image(vm,room->width,room->height,room->num_zplane,
                           &room->image,fd))
         goto bad_block;
       break;
@@ -600,10 +792,7 @@ void* scvm_load_room(scvm_t* vm,scc_fd_t* fd, unsigned num) {
         break;
       }
       block_size -= 8;
-      room->exit = malloc(sizeof(scvm_script_t)+block_size);
-      room->exit->id = 0x1ECD0000;
-      room->exit->size = block_size;
-      if(scc_fd_read(fd,room->exit->code,block_size) != block_size)
+      if(!(room->exit = scvm_read_script(fd,0x1ECD0000,block_size)))
         goto bad_block;
       break;
 
@@ -613,10 +802,7 @@ void* scvm_load_room(scvm_t* vm,scc_fd_t* fd, unsigned num) {
         break;
       }
       block_size -= 8;
-      room->entry = malloc(sizeof(scvm_script_t)+block_size);
-      room->entry->id = 0x0ECD0000;
-      room->entry->size = block_size;
-      if(scc_fd_read(fd,room->entry->code,block_size) != block_size)
+      if(!(room->entry = scvm_read_script(fd,0x0ECD0000,block_size)))
         goto bad_block;
       break;
 
@@ -642,10 +828,7 @@ void* scvm_load_room(scvm_t* vm,scc_fd_t* fd, unsigned num) {
       if(i < 200 || i-200 >= room->num_script)
         goto bad_block;
       i -= 200;
-      room->script[i] = malloc(sizeof(scvm_script_t)+block_size);
-      room->script[i]->id = i+200;
-      room->script[i]->size = block_size;
-      if(scc_fd_read(fd,room->script[i]->code,block_size) != block_size)
+      if(!(room->script[i] = scvm_read_script(fd,i+200,block_size)))
         goto bad_block;
       num_lscr++;
       break;
@@ -686,10 +869,12 @@ void* scvm_load_room(scvm_t* vm,scc_fd_t* fd, unsigned num) {
 
   // Resolve the object parent
   for(i=0 ; i < num_obim ; i++) {
-    uint8_t num = (uint8_t)((uintptr_t)objlist[i]->parent);
+    unsigned num = objlist[i]->parent_num;
+    objlist[i]->parent = NULL;
     if(!num) continue;
     if(num > num_obim) {
-      scc_log(LOG_WARN,"Object %d has an invalid parent.\n",obj->id);
+      scc_log(LOG_WARN,"Object %d has an invalid parent.\n",
+              objlist[i]->id);
       continue;
     }
     objlist[i]->parent = objlist[num-1];
@@ -697,8 +882,14 @@ void* scvm_load_room(scvm_t* vm,scc_fd_t* fd, unsigned num) {
   if(num_obcd > num_obim) num_obim = num_obcd;
   room->num_object = num_obim;
   room->object = malloc(num_obim*sizeof(scvm_object_t*));
-  for(i=0 ; i < num_obim ; i++)
+  scvm_grid_init(&room->object_grid,room->width,room->height,num_obim);
+  for(i=0 ; i < num_obim ; i++) {
     room->object[i] = objlist[i];
+    if(objlist[i] && objlist[i]->width && objlist[i]->height)
+      scvm_grid_set(&room->object_grid,i,objlist[i]->x,objlist[i]->y,
+                    objlist[i]->x + objlist[i]->width - 1,
+                    objlist[i]->y + objlist[i]->height - 1);
+  }
   
   return room;
   
@@ -709,6 +900,32 @@ bad_block:
   return NULL;
 }
 
+// Release a room, the objects are kept in the object table.
+void scvm_nuke_room(void* data) {
+  scvm_room_t* room = data;
+  int i;
+
+  free(room->image.data);
+  if(room->image.zplane)
+    for(i = 1 ; i <= room->num_zplane ; i++)
+      free(room->image.zplane[i]);
+  free(room->image.zplane);
+  for(i = 0 ; i < SCVM_MAX_ZPLANE ; i++)
+    free(room->zplane[i]);
+  free(room->palette);
+  free(room->cycle);
+  free(room->object);
+  scvm_grid_free(&room->object_grid);
+  free(room->entry);
+  free(room->exit);
+  for(i = 0 ; i < room->num_script ; i++)
+    free(room->script[i]);
+  free(room->script);
+  free(room->box);
+  free(room->boxm);
+  free(room);
+}
+
 void* scvm_load_costume(scvm_t* vm,scc_fd_t* fd, unsigned num) {
   uint32_t size,fmt;
   scc_cost_t* cost;
@@ -726,6 +943,10 @@ void* scvm_load_costume(scvm_t* vm,scc_fd_t* fd, unsigned num) {
 }
 
 
+void scvm_nuke_costume(void* data) {
+  scc_cost_free(data);
+}
+
 void* scvm_load_charset(scvm_t* vm,scc_fd_t* fd, unsigned num) {
   uint32_t size,fmt;
   scc_charmap_t* ch;
@@ -742,3 +963,7 @@ void* scvm_load_charset(scvm_t* vm,scc_fd_t* fd, unsigned num) {
   if(ch) ch->id = num;
   return ch;
 }
+
+void scvm_nuke_charset(void* data) {
+  scc_charmap_free(data);
+}
@@ -27,6 +27,9 @@ typedef struct scvm scvm_t;
 
 #define SCVM_RES_LOCKED 1
 
+/// Default memory budget for the loaded resources
+#define SCVM_RES_BUDGET (8*1024*1024)
+
 typedef struct scvm_res {
   // datafile / room where the resource is
   unsigned file, room;
@@ -34,6 +37,10 @@ typedef struct scvm_res {
   unsigned long offset;
   // locked
   unsigned flags;
+  // memory used once loaded
+  unsigned size;
+  // cycle of the last use, for the LRU eviction
+  unsigned last_use;
   void* data;
 } scvm_res_t;
 
@@ -51,7 +58,10 @@ typedef struct scvm_res_type {
 } scvm_res_type_t;
 
 
+/// Open a data file, they are memory mapped when possible.
 scc_fd_t* scvm_open_file(scvm_t* vm,unsigned num);
+/// Loaded resources can point into a mapped file, so it must
+/// only be closed once they are all released.
 void scvm_close_file(scvm_t* vm,unsigned num);
 
 void scvm_res_init(scvm_res_type_t* res, char* name, unsigned num,
@@ -65,6 +75,17 @@ int scvm_unlock_res(scvm_t* vm, unsigned type, unsigned num);
 
 void* scvm_load_res(scvm_t* vm, unsigned type, unsigned num);
 
+/// Release the least recently used resources until the memory
+/// budget is met. Locked resources, the ones in use and the ones
+/// used during the current cycle are kept.
+void scvm_res_evict(scvm_t* vm);
+
+void scvm_nuke_room(void* data);
+
+void scvm_nuke_costume(void* data);
+
+void scvm_nuke_charset(void* data);
+
 void* scvm_load_script(scvm_t* vm,scc_fd_t* fd, unsigned num);
 
 void* scvm_load_room(scvm_t* vm,scc_fd_t* fd, unsigned num);
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <inttypes.h>
 #include <errno.h>
 #include <sys/types.h>
@@ -156,31 +157,200 @@ int scvm_thread_end_override(scvm_t* vm, scvm_thread_t* thread) {
   return 0;
 }
 
+// The runnable threads are kept in a bitmap so that they are still
+// run in the slot order. The threads waiting for a later cycle and the
+// delayed threads are kept in two min-heaps keyed on thread->wake.
+
+#define SCVM_BITMAP_SIZE(n) (((n)+31)/32)
+#define SCVM_BITMAP_SET(map,i) ((map)[(i)/32] |= 1U << ((i)%32))
+#define SCVM_BITMAP_CLEAR(map,i) ((map)[(i)/32] &= ~(1U << ((i)%32)))
+
+static int scvm_bitmap_first(uint32_t* map, unsigned size) {
+  unsigned i;
+  for(i = 0 ; i < SCVM_BITMAP_SIZE(size) ; i++)
+    if(map[i]) return i*32 + ffs(map[i]) - 1;
+  return -1;
+}
+
+static void scvm_thread_heap_set(scvm_thread_heap_t* heap, unsigned pos,
+                                 scvm_thread_t* thread) {
+  heap->thread[pos] = thread;
+  thread->sched_pos = pos;
+}
+
+static void scvm_thread_heap_up(scvm_thread_heap_t* heap, unsigned pos) {
+  scvm_thread_t* thread = heap->thread[pos];
+  while(pos > 0) {
+    unsigned parent = (pos-1)/2;
+    if(heap->thread[parent]->wake <= thread->wake) break;
+    scvm_thread_heap_set(heap,pos,heap->thread[parent]);
+    pos = parent;
+  }
+  scvm_thread_heap_set(heap,pos,thread);
+}
+
+static void scvm_thread_heap_down(scvm_thread_heap_t* heap, unsigned pos) {
+  scvm_thread_t* thread = heap->thread[pos];
+  while(1) {
+    unsigned child = 2*pos+1;
+    if(child >= heap->num) break;
+    if(child+1 < heap->num &&
+       heap->thread[child+1]->wake < heap->thread[child]->wake)
+      child++;
+    if(thread->wake <= heap->thread[child]->wake) break;
+    scvm_thread_heap_set(heap,pos,heap->thread[child]);
+    pos = child;
+  }
+  scvm_thread_heap_set(heap,pos,thread);
+}
+
+static void scvm_thread_heap_push(scvm_thread_heap_t* heap,
+                                  scvm_thread_t* thread) {
+  scvm_thread_heap_set(heap,heap->num,thread);
+  heap->num++;
+  scvm_thread_heap_up(heap,heap->num-1);
+}
+
+static void scvm_thread_heap_remove(scvm_thread_heap_t* heap,
+                                    scvm_thread_t* thread) {
+  scvm_thread_t* last;
+  heap->num--;
+  if(thread->sched_pos >= heap->num) return;
+  last = heap->thread[heap->num];
+  scvm_thread_heap_set(heap,thread->sched_pos,last);
+  scvm_thread_heap_up(heap,last->sched_pos);
+  scvm_thread_heap_down(heap,last->sched_pos);
+}
+
+void scvm_init_threads(scvm_t* vm, unsigned num_thread) {
+  int i;
+  vm->num_thread = num_thread;
+  vm->current_thread = NULL;
+  vm->thread = calloc(num_thread,sizeof(scvm_thread_t));
+  vm->thread_ready = calloc(SCVM_BITMAP_SIZE(num_thread),sizeof(uint32_t));
+  vm->thread_free = calloc(SCVM_BITMAP_SIZE(num_thread),sizeof(uint32_t));
+  vm->cycle_wait.thread = calloc(num_thread,sizeof(scvm_thread_t*));
+  vm->delayed.thread = calloc(num_thread,sizeof(scvm_thread_t*));
+  for(i = 0 ; i < num_thread ; i++) {
+    vm->thread[i].id = i;
+    SCVM_BITMAP_SET(vm->thread_free,i);
+  }
+}
+
+static void scvm_thread_unschedule(scvm_t* vm, scvm_thread_t* thread) {
+  switch(thread->sched) {
+  case SCVM_SCHED_READY:
+    SCVM_BITMAP_CLEAR(vm->thread_ready,thread->id);
+    break;
+  case SCVM_SCHED_CYCLE:
+  case SCVM_SCHED_DELAY_START:
+    scvm_thread_heap_remove(&vm->cycle_wait,thread);
+    break;
+  case SCVM_SCHED_DELAY:
+    scvm_thread_heap_remove(&vm->delayed,thread);
+    break;
+  }
+  thread->sched = SCVM_SCHED_NONE;
+}
+
+// Put the thread in the queue matching its state and cycle
+void scvm_thread_schedule(scvm_t* vm, scvm_thread_t* thread) {
+  switch(thread->state) {
+  case SCVM_THREAD_RUNNING:
+    if(thread->cycle <= vm->cycle) {
+      if(thread->sched == SCVM_SCHED_READY) return;
+      scvm_thread_unschedule(vm,thread);
+      SCVM_BITMAP_SET(vm->thread_ready,thread->id);
+      thread->sched = SCVM_SCHED_READY;
+    } else {
+      if(thread->sched == SCVM_SCHED_CYCLE &&
+         thread->wake == thread->cycle) return;
+      scvm_thread_unschedule(vm,thread);
+      thread->wake = thread->cycle;
+      scvm_thread_heap_push(&vm->cycle_wait,thread);
+      thread->sched = SCVM_SCHED_CYCLE;
+    }
+    break;
+  case SCVM_THREAD_DELAYED:
+    if(thread->sched == SCVM_SCHED_DELAY_START ||
+       thread->sched == SCVM_SCHED_DELAY) return;
+    scvm_thread_unschedule(vm,thread);
+    thread->wake = vm->cycle+1;
+    scvm_thread_heap_push(&vm->cycle_wait,thread);
+    thread->sched = SCVM_SCHED_DELAY_START;
+    break;
+  default:
+    scvm_thread_unschedule(vm,thread);
+  }
+}
+
+void scvm_thread_set_state(scvm_t* vm, scvm_thread_t* thread, unsigned state) {
+  thread->state = state;
+  scvm_thread_schedule(vm,thread);
+}
+
+// Called at the start of each cycle, after the cycle counter was updated
+void scvm_thread_wake_up(scvm_t* vm, unsigned now) {
+  scvm_thread_t* thread;
+
+  while(vm->delayed.num > 0 && vm->delayed.thread[0]->wake <= now) {
+    thread = vm->delayed.thread[0];
+    scvm_thread_unschedule(vm,thread);
+    thread->delay = 0;
+    thread->flags &= ~SCVM_THREAD_DELAY;
+    scvm_thread_set_state(vm,thread,SCVM_THREAD_RUNNING);
+  }
+
+  while(vm->cycle_wait.num > 0 && vm->cycle_wait.thread[0]->wake <= vm->cycle) {
+    thread = vm->cycle_wait.thread[0];
+    scvm_thread_unschedule(vm,thread);
+    if(thread->state == SCVM_THREAD_DELAYED) {
+      // Start the countdown
+      thread->flags |= SCVM_THREAD_DELAY;
+      thread->wake = now + thread->delay;
+      scvm_thread_heap_push(&vm->delayed,thread);
+      thread->sched = SCVM_SCHED_DELAY;
+    } else
+      scvm_thread_schedule(vm,thread);
+  }
+}
+
+scvm_thread_t* scvm_next_thread(scvm_t* vm) {
+  int i = scvm_bitmap_first(vm->thread_ready,vm->num_thread);
+  return i < 0 ? NULL : &vm->thread[i];
+}
+
 int scvm_stop_thread(scvm_t* vm, scvm_thread_t* thread) {
-  thread->state = SCVM_THREAD_STOPPED;
+  scvm_thread_t** p;
+  if(thread->state == SCVM_THREAD_STOPPED) return 0;
+  scvm_thread_set_state(vm,thread,SCVM_THREAD_STOPPED);
+  for(p = &vm->script_thread[SCVM_SCRIPT_HASH(thread->script->id)] ;
+      *p ; p = &(*p)->script_next)
+    if(*p == thread) {
+      *p = thread->script_next;
+      break;
+    }
+  thread->script_next = NULL;
+  SCVM_BITMAP_SET(vm->thread_free,thread->id);
   return 0;
 }
 
 int scvm_is_script_running(scvm_t* vm, unsigned id) {
-  int i;
-  for(i = 0 ; i < vm->num_thread ; i++) {
-    if(vm->thread[i].state == SCVM_THREAD_STOPPED ||
-       !vm->thread[i].script ||
-       vm->thread[i].script->id != id)
-      continue;
-    return 1;
-  }
+  scvm_thread_t* thread;
+  for(thread = vm->script_thread[SCVM_SCRIPT_HASH(id)] ; thread ;
+      thread = thread->script_next)
+    if(thread->script->id == id) return 1;
   return 0;
 }
 
 int scvm_stop_script(scvm_t* vm, unsigned id) {
-  int i,n=0;
-  for(i = 0 ; i < vm->num_thread ; i++) {
-    if(vm->thread[i].state == SCVM_THREAD_STOPPED ||
-       !vm->thread[i].script ||
-       vm->thread[i].script->id != id)
-      continue;
-    scvm_stop_thread(vm,&vm->thread[i]);
+  scvm_thread_t *thread, *next;
+  int n = 0;
+  for(thread = vm->script_thread[SCVM_SCRIPT_HASH(id)] ; thread ;
+      thread = next) {
+    next = thread->script_next;
+    if(thread->script->id != id) continue;
+    scvm_stop_thread(vm,thread);
     n++;
   }
   return n;
@@ -188,19 +358,20 @@ int scvm_stop_script(scvm_t* vm, unsigned id) {
 
 int scvm_start_thread(scvm_t* vm, scvm_script_t* scr, unsigned code_ptr,
                       unsigned flags, unsigned* args) {
-  int i;
+  int i,h;
   scvm_thread_t* thread;
   
   // find a free thread
-  for(i = 0 ; i < vm->num_thread ; i++)
-    if(vm->thread[i].state == SCVM_THREAD_STOPPED) break;
-  if(i >= vm->num_thread) {
+  if((i = scvm_bitmap_first(vm->thread_free,vm->num_thread)) < 0) {
     scc_log(LOG_ERR,"No threads left to start script %d\n",scr->id);
     return -1; // fixme
   }
   thread = &vm->thread[i];
-  
-  thread->state = SCVM_THREAD_RUNNING;
+  SCVM_BITMAP_CLEAR(vm->thread_free,i);
+
+  if(vm->dbg)
+    scvm_thread_check_breakpoint(vm,scr);
+
   thread->flags = flags;
   thread->script = scr;
   thread->code_ptr = code_ptr;
@@ -216,6 +387,10 @@ int scvm_start_thread(scvm_t* vm, scvm_script_t* scr, unsigned code_ptr,
     for(j = 0 ; j < args[0] && j < 16 ; j++)
       thread->var[j] = args[j+1];
   }
+  h = SCVM_SCRIPT_HASH(scr->id);
+  thread->script_next = vm->script_thread[h];
+  vm->script_thread[h] = thread;
+  scvm_thread_set_state(vm,thread,SCVM_THREAD_RUNNING);
   return thread->id;
 }
 
@@ -239,13 +414,43 @@ int scvm_start_script(scvm_t* vm, unsigned flags, unsigned num, unsigned* args)
   return scvm_start_thread(vm,scr,0,flags,args);
 }
 
+// Look if a breakpoint is set in the script
+void scvm_thread_check_breakpoint(scvm_t* vm, scvm_script_t* scr) {
+  int i;
+  if(!vm->dbg) return;
+  for(i = 0 ; i < vm->dbg->num_breakpoint ; i++)
+    if(vm->dbg->breakpoint[i].script_id == scr->id) {
+      scr->flags |= SCVM_SCRIPT_BREAKPOINT;
+      return;
+    }
+}
+
+static int scvm_thread_breakpoint(scvm_t* vm, scvm_thread_t* thread) {
+  scvm_breakpoint_t* bp = vm->dbg->breakpoint;
+  while(bp - vm->dbg->breakpoint < vm->dbg->num_breakpoint) {
+    if((!bp->room_id || (vm->room && bp->room_id == vm->room->id)) &&
+       bp->script_id == thread->script->id &&
+       bp->pos == thread->code_ptr) {
+      if(thread->flags & SCVM_THREAD_AT_BREAKPOINT) {
+        thread->flags &= ~SCVM_THREAD_AT_BREAKPOINT;
+        break;
+      } else {
+        thread->flags |= SCVM_THREAD_AT_BREAKPOINT;
+        return SCVM_ERR_BREAKPOINT;
+      }
+    }
+    bp++;
+  }
+  return 0;
+}
+
 int scvm_thread_do_op(scvm_t* vm, scvm_thread_t* thread, scvm_op_t* optable) {
   int r;
   uint8_t op;
   
   if((r=scvm_thread_r8(thread,&op))) return r;
   
-  scc_log(LOG_MSG,"Do op %s (0x%x)\n",optable[op].name,op);
+  scvm_trace(vm,"Do op %s (0x%x)\n",optable[op].name,op);
 
   if(!optable[op].op) {
     scc_log(LOG_WARN,"Op %s (0x%x) is missing\n",optable[op].name,op);
@@ -254,8 +459,10 @@ int scvm_thread_do_op(scvm_t* vm, scvm_thread_t* thread, scvm_op_t* optable) {
   return optable[op].op(vm,thread);
 }
 
-
-int scvm_thread_run(scvm_t* vm, scvm_thread_t* thread) {
+// The tracing interpreter, everything goes through the op table
+// and the breakpoints are checked before each op. It is also used
+// for profiling as every op can then be timed.
+static int scvm_thread_run_trace(scvm_t* vm, scvm_thread_t* thread) {
   int i,r=0;
   while(thread->state == SCVM_THREAD_RUNNING &&
         thread->cycle <= vm->cycle) {
@@ -268,30 +475,420 @@ int scvm_thread_run(scvm_t* vm, scvm_thread_t* thread) {
           thread->cycle <= vm->cycle && i < 64 ; i++) {
       thread->op_start = thread->code_ptr;
       // Check for breakpoints
-      if(vm->dbg) {
-        scvm_breakpoint_t* bp = vm->dbg->breakpoint;
-        while(bp - vm->dbg->breakpoint < vm->dbg->num_breakpoint) {
-          if((!bp->room_id || (vm->room && bp->room_id == vm->room->id)) &&
-             bp->script_id == thread->script->id &&
-             bp->pos == thread->code_ptr) {
-            if(thread->flags & SCVM_THREAD_AT_BREAKPOINT) {
-              thread->flags &= ~SCVM_THREAD_AT_BREAKPOINT;
-              break;
-            } else {
-              thread->flags |= SCVM_THREAD_AT_BREAKPOINT;
-              return SCVM_ERR_BREAKPOINT;
-            }
-          }
-          bp++;
-        }
-      }
-      if((r = scvm_thread_do_op(vm,thread,vm->optable)))
+      if(vm->dbg && (r = scvm_thread_breakpoint(vm,thread)))
         return r;
+      vm->num_op++;
+      if(vm->profiling)
+        r = scvm_profile_do_op(vm,thread);
+      else
+        r = scvm_thread_do_op(vm,thread,vm->optable);
+      if(r) return r;
     }
   }
   return r;
 }
 
+// The fast interpreter. Each instruction is decoded the first time
+// it is run and the result is kept in the script insn array at the
+// instruction offset, so code_ptr keep its meaning. The simple stack,
+// variable and jump ops get their operands pre-decoded and are done
+// inline, the next op is then dispatched right away as they can't
+// change the thread state. All other ops go through the op table.
+
+#define SCVM_OP_PUSH_B      0x00
+#define SCVM_OP_PUSH_W      0x01
+#define SCVM_OP_VAR_READ_B  0x02
+#define SCVM_OP_VAR_READ_W  0x03
+#define SCVM_OP_DUP         0x0C
+#define SCVM_OP_NOT         0x0D
+#define SCVM_OP_EQ          0x0E
+#define SCVM_OP_NEQ         0x0F
+#define SCVM_OP_GT          0x10
+#define SCVM_OP_LT          0x11
+#define SCVM_OP_LE          0x12
+#define SCVM_OP_GE          0x13
+#define SCVM_OP_ADD         0x14
+#define SCVM_OP_SUB         0x15
+#define SCVM_OP_MUL         0x16
+#define SCVM_OP_LAND        0x18
+#define SCVM_OP_LOR         0x19
+#define SCVM_OP_POP         0x1A
+#define SCVM_OP_VAR_WRITE_B 0x42
+#define SCVM_OP_VAR_WRITE_W 0x43
+#define SCVM_OP_VAR_INC_B   0x4E
+#define SCVM_OP_VAR_INC_W   0x4F
+#define SCVM_OP_VAR_DEC_B   0x56
+#define SCVM_OP_VAR_DEC_W   0x57
+#define SCVM_OP_JNZ         0x5C
+#define SCVM_OP_JZ          0x5D
+#define SCVM_OP_JMP         0x73
+#define SCVM_OP_BAND        0xD6
+#define SCVM_OP_BOR         0xD7
+
+/// @name Decoded instruction kinds
+//@{
+#define SCVM_INSN_NONE       0
+#define SCVM_INSN_OP         1
+#define SCVM_INSN_PUSH       2
+#define SCVM_INSN_VAR_READ   3
+#define SCVM_INSN_DUP        4
+#define SCVM_INSN_NOT        5
+#define SCVM_INSN_EQ         6
+#define SCVM_INSN_NEQ        7
+#define SCVM_INSN_GT         8
+#define SCVM_INSN_LT         9
+#define SCVM_INSN_LE        10
+#define SCVM_INSN_GE        11
+#define SCVM_INSN_ADD       12
+#define SCVM_INSN_SUB       13
+#define SCVM_INSN_MUL       14
+#define SCVM_INSN_LAND      15
+#define SCVM_INSN_LOR       16
+#define SCVM_INSN_BAND      17
+#define SCVM_INSN_BOR       18
+#define SCVM_INSN_POP       19
+#define SCVM_INSN_VAR_WRITE 20
+#define SCVM_INSN_VAR_INC   21
+#define SCVM_INSN_VAR_DEC   22
+#define SCVM_INSN_JNZ       23
+#define SCVM_INSN_JZ        24
+#define SCVM_INSN_JMP       25
+#define SCVM_INSN_LOCAL_READ   26
+#define SCVM_INSN_GLOBAL_READ  27
+#define SCVM_INSN_LOCAL_WRITE  28
+#define SCVM_INSN_GLOBAL_WRITE 29
+#define SCVM_INSN_MAX       30
+//@}
+
+static void scvm_script_decode(scvm_t* vm, scvm_script_t* scr,
+                               unsigned pos) {
+  static const uint8_t simple[0x100] = {
+    [SCVM_OP_DUP] = SCVM_INSN_DUP,
+    [SCVM_OP_NOT] = SCVM_INSN_NOT,
+    [SCVM_OP_EQ] = SCVM_INSN_EQ,
+    [SCVM_OP_NEQ] = SCVM_INSN_NEQ,
+    [SCVM_OP_GT] = SCVM_INSN_GT,
+    [SCVM_OP_LT] = SCVM_INSN_LT,
+    [SCVM_OP_LE] = SCVM_INSN_LE,
+    [SCVM_OP_GE] = SCVM_INSN_GE,
+    [SCVM_OP_ADD] = SCVM_INSN_ADD,
+    [SCVM_OP_SUB] = SCVM_INSN_SUB,
+    [SCVM_OP_MUL] = SCVM_INSN_MUL,
+    [SCVM_OP_LAND] = SCVM_INSN_LAND,
+    [SCVM_OP_LOR] = SCVM_INSN_LOR,
+    [SCVM_OP_BAND] = SCVM_INSN_BAND,
+    [SCVM_OP_BOR] = SCVM_INSN_BOR,
+    [SCVM_OP_POP] = SCVM_INSN_POP,
+  };
+  scvm_insn_t* insn = &scr->insn[pos];
+  uint8_t* code = scr->code + pos;
+  unsigned left = scr->size - pos - 1;
+  uint8_t kind = SCVM_INSN_OP;
+  int arg = 0, len = 1;
+
+  switch(code[0]) {
+  case SCVM_OP_PUSH_B:
+  case SCVM_OP_VAR_READ_B:
+  case SCVM_OP_VAR_WRITE_B:
+  case SCVM_OP_VAR_INC_B:
+  case SCVM_OP_VAR_DEC_B:
+    if(left < 1) break;
+    arg = code[1];
+    len = 2;
+    break;
+  case SCVM_OP_PUSH_W:
+  case SCVM_OP_VAR_READ_W:
+  case SCVM_OP_VAR_WRITE_W:
+  case SCVM_OP_VAR_INC_W:
+  case SCVM_OP_VAR_DEC_W:
+    if(left < 2) break;
+    arg = SCC_GET_16LE(code,1);
+    if(code[0] == SCVM_OP_PUSH_W) arg = (int16_t)arg;
+    len = 3;
+    break;
+  case SCVM_OP_JNZ:
+  case SCVM_OP_JZ:
+  case SCVM_OP_JMP:
+    if(left < 2) break;
+    arg = pos + 3 + (int16_t)SCC_GET_16LE(code,1);
+    // leave the bad jumps to the op to get the proper error
+    if(arg < 0 || arg >= scr->size) break;
+    len = 3;
+    break;
+  default:
+    if(simple[code[0]])
+      kind = simple[code[0]];
+    break;
+  }
+
+  if(len > 1) {
+    switch(code[0]) {
+    case SCVM_OP_PUSH_B:
+    case SCVM_OP_PUSH_W:
+      kind = SCVM_INSN_PUSH;
+      break;
+    case SCVM_OP_VAR_READ_B:
+    case SCVM_OP_VAR_READ_W:
+      kind = SCVM_INSN_VAR_READ;
+      if((arg & 0xC000) == 0x4000) {
+        kind = SCVM_INSN_LOCAL_READ;
+        arg &= 0x3FFF;
+      } else if(!(arg & 0xC000) && arg < vm->num_var &&
+                (arg >= 0x100 || !vm->get_var[arg]))
+        kind = SCVM_INSN_GLOBAL_READ;
+      break;
+    case SCVM_OP_VAR_WRITE_B:
+    case SCVM_OP_VAR_WRITE_W:
+      kind = SCVM_INSN_VAR_WRITE;
+      if((arg & 0xC000) == 0x4000) {
+        kind = SCVM_INSN_LOCAL_WRITE;
+        arg &= 0x3FFF;
+      } else if(!(arg & 0xC000) && arg < vm->num_var &&
+                (arg >= 0x100 || !vm->set_var[arg]))
+        kind = SCVM_INSN_GLOBAL_WRITE;
+      break;
+    case SCVM_OP_VAR_INC_B:
+    case SCVM_OP_VAR_INC_W:
+      kind = SCVM_INSN_VAR_INC;
+      break;
+    case SCVM_OP_VAR_DEC_B:
+    case SCVM_OP_VAR_DEC_W:
+      kind = SCVM_INSN_VAR_DEC;
+      break;
+    case SCVM_OP_JNZ:
+      kind = SCVM_INSN_JNZ;
+      break;
+    case SCVM_OP_JZ:
+      kind = SCVM_INSN_JZ;
+      break;
+    case SCVM_OP_JMP:
+      kind = SCVM_INSN_JMP;
+      break;
+    }
+  }
+
+  insn->arg = arg;
+  insn->len = len;
+  insn->kind = kind;
+}
+
+#ifdef HAVE_COMPUTED_GOTO
+#define SCVM_INSN(name)    insn_##name
+#define SCVM_INSN_DEFAULT  insn_OP
+#define SCVM_DISPATCH()    goto *dispatch[insn->kind];
+#else
+#define SCVM_INSN(name)    case SCVM_INSN_##name
+#define SCVM_INSN_DEFAULT  default
+#define SCVM_DISPATCH()    switch(insn->kind)
+#endif
+
+#define SCVM_FAST_BIN_OP(name,op)                               \
+  SCVM_INSN(name):                                              \
+    if(vm->stack_ptr < 2) return scvm_vpop(vm,&val,&val,NULL);  \
+    vm->stack_ptr--;                                            \
+    vm->stack[vm->stack_ptr-1] =                                \
+      (vm->stack[vm->stack_ptr-1] op vm->stack[vm->stack_ptr]); \
+    thread->code_ptr++;                                         \
+    goto next
+
+static int scvm_thread_run_fast(scvm_t* vm, scvm_thread_t* thread) {
+#ifdef HAVE_COMPUTED_GOTO
+  static void* dispatch[SCVM_INSN_MAX] = {
+    [SCVM_INSN_OP] = &&insn_OP,
+    [SCVM_INSN_PUSH] = &&insn_PUSH,
+    [SCVM_INSN_VAR_READ] = &&insn_VAR_READ,
+    [SCVM_INSN_DUP] = &&insn_DUP,
+    [SCVM_INSN_NOT] = &&insn_NOT,
+    [SCVM_INSN_EQ] = &&insn_EQ,
+    [SCVM_INSN_NEQ] = &&insn_NEQ,
+    [SCVM_INSN_GT] = &&insn_GT,
+    [SCVM_INSN_LT] = &&insn_LT,
+    [SCVM_INSN_LE] = &&insn_LE,
+    [SCVM_INSN_GE] = &&insn_GE,
+    [SCVM_INSN_ADD] = &&insn_ADD,
+    [SCVM_INSN_SUB] = &&insn_SUB,
+    [SCVM_INSN_MUL] = &&insn_MUL,
+    [SCVM_INSN_LAND] = &&insn_LAND,
+    [SCVM_INSN_LOR] = &&insn_LOR,
+    [SCVM_INSN_BAND] = &&insn_BAND,
+    [SCVM_INSN_BOR] = &&insn_BOR,
+    [SCVM_INSN_POP] = &&insn_POP,
+    [SCVM_INSN_VAR_WRITE] = &&insn_VAR_WRITE,
+    [SCVM_INSN_VAR_INC] = &&insn_VAR_INC,
+    [SCVM_INSN_VAR_DEC] = &&insn_VAR_DEC,
+    [SCVM_INSN_JNZ] = &&insn_JNZ,
+    [SCVM_INSN_JZ] = &&insn_JZ,
+    [SCVM_INSN_JMP] = &&insn_JMP,
+    [SCVM_INSN_LOCAL_READ] = &&insn_LOCAL_READ,
+    [SCVM_INSN_GLOBAL_READ] = &&insn_GLOBAL_READ,
+    [SCVM_INSN_LOCAL_WRITE] = &&insn_LOCAL_WRITE,
+    [SCVM_INSN_GLOBAL_WRITE] = &&insn_GLOBAL_WRITE,
+  };
+#endif
+  scvm_script_t* scr;
+  scvm_insn_t* insn;
+  unsigned count;
+  uint8_t op;
+  int r, val;
+
+  while(thread->state == SCVM_THREAD_RUNNING &&
+        thread->cycle <= vm->cycle) {
+    // Check if the debugger want to break
+    if(vm->dbg && vm->dbg->check_interrupt && vm->dbg->check_interrupt(vm))
+      return SCVM_ERR_INTERRUPTED;
+    // The script can change after each non inline op
+    scr = thread->script;
+    // We check the interupts only every 64 ops
+    count = 64;
+  next:
+    if(!count--) continue;
+    thread->op_start = thread->code_ptr;
+    if(scr->flags & SCVM_SCRIPT_BREAKPOINT && vm->dbg &&
+       (r = scvm_thread_breakpoint(vm,thread)))
+      return r;
+    if(thread->code_ptr >= scr->size) return SCVM_ERR_SCRIPT_BOUND;
+    insn = &scr->insn[thread->code_ptr];
+    if(!insn->kind)
+      scvm_script_decode(vm,scr,thread->code_ptr);
+    vm->num_op++;
+
+    SCVM_DISPATCH() {
+
+    SCVM_INSN(PUSH):
+      thread->code_ptr += insn->len;
+      val = insn->arg;
+      goto push;
+
+    SCVM_INSN(VAR_READ):
+      thread->code_ptr += insn->len;
+      if((r = scvm_thread_read_svar(vm,thread,insn->arg,&val))) return r;
+      goto push;
+
+    SCVM_INSN(LOCAL_READ):
+      if(insn->arg >= thread->num_var) goto generic_op;
+      thread->code_ptr += insn->len;
+      val = thread->var[insn->arg];
+      goto push;
+
+    SCVM_INSN(GLOBAL_READ):
+      thread->code_ptr += insn->len;
+      val = vm->var_mem[insn->arg];
+      goto push;
+
+    SCVM_INSN(DUP):
+      thread->code_ptr++;
+      if(vm->stack_ptr < 1) return scvm_pop(vm,NULL);
+      val = vm->stack[vm->stack_ptr-1];
+    push:
+      if(vm->stack_ptr + 1 >= vm->stack_size) return scvm_push(vm,val);
+      vm->stack[vm->stack_ptr++] = val;
+      goto next;
+
+    SCVM_INSN(NOT):
+      thread->code_ptr++;
+      if(vm->stack_ptr < 1) return scvm_pop(vm,NULL);
+      vm->stack[vm->stack_ptr-1] = !vm->stack[vm->stack_ptr-1];
+      goto next;
+
+    SCVM_FAST_BIN_OP(EQ,==);
+    SCVM_FAST_BIN_OP(NEQ,!=);
+    SCVM_FAST_BIN_OP(GT,>);
+    SCVM_FAST_BIN_OP(LT,<);
+    SCVM_FAST_BIN_OP(LE,<=);
+    SCVM_FAST_BIN_OP(GE,>=);
+    SCVM_FAST_BIN_OP(ADD,+);
+    SCVM_FAST_BIN_OP(SUB,-);
+    SCVM_FAST_BIN_OP(MUL,*);
+    SCVM_FAST_BIN_OP(LAND,&&);
+    SCVM_FAST_BIN_OP(LOR,||);
+    SCVM_FAST_BIN_OP(BAND,&);
+    SCVM_FAST_BIN_OP(BOR,|);
+
+    SCVM_INSN(POP):
+      thread->code_ptr++;
+      if(vm->stack_ptr < 1) return scvm_pop(vm,NULL);
+      vm->stack_ptr--;
+      goto next;
+
+    SCVM_INSN(VAR_WRITE):
+      thread->code_ptr += insn->len;
+      if(vm->stack_ptr < 1) return scvm_pop(vm,NULL);
+      vm->stack_ptr--;
+      if((r = scvm_thread_write_var(vm,thread,insn->arg,
+                                    vm->stack[vm->stack_ptr])))
+        return r;
+      goto next;
+
+    SCVM_INSN(LOCAL_WRITE):
+      if(insn->arg >= thread->num_var) goto generic_op;
+      thread->code_ptr += insn->len;
+      if(vm->stack_ptr < 1) return scvm_pop(vm,NULL);
+      thread->var[insn->arg] = vm->stack[--vm->stack_ptr];
+      goto next;
+
+    SCVM_INSN(GLOBAL_WRITE):
+      thread->code_ptr += insn->len;
+      if(vm->stack_ptr < 1) return scvm_pop(vm,NULL);
+      vm->var_mem[insn->arg] = vm->stack[--vm->stack_ptr];
+      goto next;
+
+    SCVM_INSN(VAR_INC):
+      thread->code_ptr += insn->len;
+      if((r = scvm_thread_read_svar(vm,thread,insn->arg,&val)) ||
+         (r = scvm_thread_write_var(vm,thread,insn->arg,val+1)))
+        return r;
+      goto next;
+
+    SCVM_INSN(VAR_DEC):
+      thread->code_ptr += insn->len;
+      if((r = scvm_thread_read_svar(vm,thread,insn->arg,&val)) ||
+         (r = scvm_thread_write_var(vm,thread,insn->arg,val-1)))
+        return r;
+      goto next;
+
+    SCVM_INSN(JNZ):
+      if(vm->stack_ptr < 1) return scvm_pop(vm,NULL);
+      vm->stack_ptr--;
+      thread->code_ptr = vm->stack[vm->stack_ptr] ?
+        insn->arg : thread->code_ptr + insn->len;
+      goto next;
+
+    SCVM_INSN(JZ):
+      if(vm->stack_ptr < 1) return scvm_pop(vm,NULL);
+      vm->stack_ptr--;
+      thread->code_ptr = vm->stack[vm->stack_ptr] ?
+        thread->code_ptr + insn->len : insn->arg;
+      goto next;
+
+    SCVM_INSN(JMP):
+      thread->code_ptr = insn->arg;
+      goto next;
+
+    SCVM_INSN_DEFAULT:
+    generic_op:
+      op = scr->code[thread->code_ptr++];
+      if(!vm->optable[op].op) {
+        scc_log(LOG_WARN,"Op %s (0x%x) is missing\n",vm->optable[op].name,op);
+        return SCVM_ERR_NO_OP; // not implemented/existing
+      }
+      if((r = vm->optable[op].op(vm,thread))) return r;
+      // the op might have changed the thread state or its script
+      if(thread->state != SCVM_THREAD_RUNNING ||
+         thread->cycle > vm->cycle)
+        return 0;
+      scr = thread->script;
+      goto next;
+    }
+  }
+  return 0;
+}
+
+int scvm_thread_run(scvm_t* vm, scvm_thread_t* thread) {
+  if(vm->trace || vm->profiling)
+    return scvm_thread_run_trace(vm,thread);
+  return scvm_thread_run_fast(vm,thread);
+}
+
 // Debug helper
 int scvm_find_op(scvm_op_t* optable,char* name) {
   int i;
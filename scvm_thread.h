@@ -23,12 +23,29 @@
  * @brief SCVM thread implementation.
  */
 
+/// Instruction decoded by the interpreter, the kinds are private
+typedef struct scvm_insn {
+  uint8_t kind;
+  uint8_t len;
+  int arg;
+} scvm_insn_t;
+
 typedef struct scvm_script {
   unsigned id;
+  unsigned flags;
   unsigned size;
-  unsigned char code[0];
+  /// Either point in the mapped data file or after the insn array
+  unsigned char* code;
+  /// Decoded instructions, indexed by their offset in the code
+  scvm_insn_t* insn;
 } scvm_script_t;
 
+/// @name Script flags
+//@{
+/// A breakpoint is set somewhere in the script
+#define SCVM_SCRIPT_BREAKPOINT 1
+//@}
+
 /// @name Thread states
 //@{
 #define SCVM_THREAD_STOPPED 0
@@ -47,8 +64,24 @@ typedef struct scvm_script {
 #define SCVM_THREAD_AT_BREAKPOINT (2<<16)
 //@}
 
+/// @name Scheduler queues
+//@{
+#define SCVM_SCHED_NONE        0
+#define SCVM_SCHED_READY       1
+/// Running, but waiting for a later cycle
+#define SCVM_SCHED_CYCLE       2
+/// Delayed, the countdown start on the next cycle
+#define SCVM_SCHED_DELAY_START 3
+#define SCVM_SCHED_DELAY       4
+//@}
+
 #define SCVM_MAX_OVERRIDE 8
 
+/// Size of the script id -> thread index, must be a power of 2
+#define SCVM_SCRIPT_HASH_SIZE 64
+#define SCVM_SCRIPT_HASH(id) \
+  (((id) ^ ((id) >> 16)) & (SCVM_SCRIPT_HASH_SIZE-1))
+
 struct scvm_array;
 typedef struct scvm_thread scvm_thread_t;
 
@@ -62,10 +95,18 @@ struct scvm_thread {
   scvm_thread_t* parent;
   unsigned flags;
   unsigned cycle;
-  /// Delay left in ms
+  /// Delay in ms
   unsigned delay;
+  /// Scheduler queue the thread is in
+  unsigned sched;
+  /// Position in the scheduler heap
+  unsigned sched_pos;
+  /// Cycle or time at which the thread should be woken up
+  unsigned wake;
   /// Script beeing run
   scvm_script_t* script;
+  /// Next thread in the script id index
+  scvm_thread_t* script_next;
   /// Position in the code
   unsigned code_ptr;
   /// Code_ptr is saved here when a new op is started
@@ -78,6 +119,12 @@ struct scvm_thread {
   unsigned override[SCVM_MAX_OVERRIDE];
 };
 
+/// Min-heap of threads keyed on their wake up cycle or time
+typedef struct scvm_thread_heap {
+  unsigned num;
+  scvm_thread_t** thread;
+} scvm_thread_heap_t;
+
 typedef int (*scvm_op_f)(struct scvm* vm, scvm_thread_t* thread);
 
 typedef struct scvm_op {
@@ -105,11 +152,23 @@ int scvm_thread_begin_override(scvm_t* vm, scvm_thread_t* thread);
 
 int scvm_thread_end_override(scvm_t* vm, scvm_thread_t* thread);
 
+void scvm_init_threads(scvm_t* vm, unsigned num_thread);
+
+void scvm_thread_schedule(scvm_t* vm, scvm_thread_t* thread);
+
+void scvm_thread_set_state(scvm_t* vm, scvm_thread_t* thread, unsigned state);
+
+void scvm_thread_wake_up(scvm_t* vm, unsigned now);
+
+scvm_thread_t* scvm_next_thread(scvm_t* vm);
+
 int scvm_start_thread(scvm_t* vm, scvm_script_t* scr, unsigned code_ptr,
                       unsigned flags, unsigned* args);
 
 int scvm_stop_thread(scvm_t* vm, scvm_thread_t* thread);
 
+void scvm_thread_check_breakpoint(scvm_t* vm, scvm_script_t* scr);
+
 int scvm_thread_do_op(scvm_t* vm, scvm_thread_t* thread, scvm_op_t* optable);
 
 int scvm_thread_run(scvm_t* vm, scvm_thread_t* thread);
@@ -120,6 +179,12 @@ int scvm_stop_script(scvm_t* vm, unsigned id);
 
 int scvm_is_script_running(scvm_t* vm, unsigned id);
 
+int scvm_push(scvm_t* vm, int val);
+
+int scvm_pop(scvm_t* vm, unsigned* val);
+
+int scvm_vpop(scvm_t* vm, ...);
+
 int scvm_thread_read_var(scvm_t* vm, scvm_thread_t* thread,
                          uint16_t addr, unsigned* val);
 
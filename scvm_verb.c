@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -71,13 +72,32 @@ scvm_verb_t* scvm_new_verb(scvm_t* vm, unsigned id) {
             }
         if(!vrb) return NULL;
     }
-    return scvm_verb_init(vrb,id,
-                          vm->current_charset ? vm->current_charset->id : 0);
+    scvm_verb_init(vrb,id,vm->current_charset ? vm->current_charset->id : 0);
+    scvm_verb_moved(vm,vrb);
+    return vrb;
+}
+
+void scvm_verb_moved(scvm_t* vm, scvm_verb_t* vrb) {
+    int x1 = vrb->x;
+
+    if(!vm->verb_grid.cell)
+        scvm_grid_init(&vm->verb_grid,vm->view->screen_width,
+                       vm->view->screen_height,vm->num_verb);
+
+    if(!vrb->mode || vrb->save_id) {
+        scvm_grid_remove(&vm->verb_grid,vrb - vm->verb);
+        return;
+    }
+    if(vrb->flags & SCVM_VERB_CENTER)
+        x1 -= vrb->width/2;
+    scvm_grid_set(&vm->verb_grid,vrb - vm->verb,x1,vrb->y,
+                  x1 + vrb->width - 1, vrb->y + vrb->height - 1);
 }
 
 void scvm_kill_verb(scvm_t* vm, unsigned id, unsigned save_id) {
     scvm_verb_t* vrb = scvm_get_verb(vm,id,save_id);
     if(!vrb) return;
+    scvm_grid_remove(&vm->verb_grid,vrb - vm->verb);
     if(vrb->name) free(vrb->name);
     if(vrb->img.data) free(vrb->img.data);
     memset(vrb,0,sizeof(*vrb));
@@ -100,6 +120,7 @@ int scvm_set_verb_image(scvm_t* vm, unsigned id,
     memcpy(vrb->img.data,obj->image[1].data,obj->width*obj->height);
     vrb->img.have_trans = obj->image[1].have_trans;
     vrb->flags |= SCVM_VERB_HAS_IMG;
+    scvm_verb_moved(vm,vrb);
 
     return 0;
 }
@@ -137,6 +158,7 @@ scvm_image_t* scvm_get_verb_image(scvm_t* vm, scvm_verb_t* vrb) {
         vrb->width = txt_w;
         vrb->height = txt_h;
         vrb->img.data = realloc(vrb->img.data,vrb->width*vrb->height);
+        scvm_verb_moved(vm,vrb);
     }
 
     memset(vrb->img.data,vrb->back_color,vrb->width*vrb->height);
@@ -150,6 +172,7 @@ void scvm_save_verb(scvm_t* vm, unsigned id, unsigned save_id) {
     scvm_verb_t* vrb = scvm_get_verb(vm,id,0);
     if(!vrb) return;
     vrb->save_id = save_id;
+    scvm_verb_moved(vm,vrb);
 }
 
 void scvm_restore_verb(scvm_t* vm, unsigned id, unsigned save_id) {
@@ -157,18 +180,22 @@ void scvm_restore_verb(scvm_t* vm, unsigned id, unsigned save_id) {
     if(!vrb) return;
     scvm_kill_verb(vm,id,0);
     vrb->save_id = 0;
+    scvm_verb_moved(vm,vrb);
 }
 
+// The grid cells are sorted, the last verbs have the priority
 scvm_verb_t* scvm_get_verb_at(scvm_t* vm, unsigned x, unsigned y) {
-    unsigned i, vrb_x;
-    for(i = vm->num_verb-1 ; i != -1 ; i--) {
-        scvm_verb_t* vrb = &vm->verb[i];
+    unsigned i, vrb_x, *items;
+    i = scvm_grid_get(&vm->verb_grid,x > INT_MAX ? -1 : x,
+                      y > INT_MAX ? -1 : y,&items);
+    for(i-- ; i != -1 ; i--) {
+        scvm_verb_t* vrb = &vm->verb[items[i]];
         if(!vrb->mode || vrb->save_id) continue;
         vrb_x = vrb->x;
         if(vrb->flags & SCVM_VERB_CENTER)
             vrb_x -= vrb->width/2;
-        if(x >= vrb_x && x <= vrb->x + vrb->width &&
-           y >= vrb->y && y <= vrb->y + vrb->height)
+        if(x >= vrb_x && x < vrb_x + vrb->width &&
+           y >= vrb->y && y < vrb->y + vrb->height)
             return vrb;
     }
     return NULL;
@@ -35,6 +35,12 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include "scc_fd.h"
 #include "scc_util.h"
 #include "scc_param.h"
@@ -45,66 +51,170 @@
 #include "scvm.h"
 
 
-static void scale_copy(uint8_t* dst, int dst_stride,
-                       unsigned clip_width, unsigned clip_height,
+// Compute the source index of the destination pixels in [start,end).
+// This is the same error term walk as the old per pixel blitter used,
+// so the output of the scaling stays the same.
+static void scale_map(int* map, int start, int end,
+                      int dst_len, int src_len) {
+  int s = 0, d = 0, err = 0, skip = 0;
+
+  while(d < end) {
+    if(!skip && d >= start)
+      map[d-start] = s;
+    err += dst_len;
+    if(err<<1 >= src_len) {
+      err -= src_len;
+      d++;
+      skip = 0;
+      if(err<<1 >= src_len) {
+        err -= dst_len;
+        continue;
+      }
+    } else
+      skip = 1;
+    s++;
+  }
+}
+
+// Build a destination line from a source row. With an integer
+// factor each source pixel is simply repeated, otherwise the map is used.
+static void scale_line(uint8_t* dst, uint8_t* src, int* map,
+                       int factor, int start, int len) {
+  int i,run;
+  uint8_t c;
+
+  if(!map) {
+    src += start/factor;
+    run = factor - start%factor;
+    while(len > 0) {
+      if(run > len) run = len;
+      c = *src++;
+      for(i = 0 ; i < run ; i++)
+        dst[i] = c;
+      dst += run;
+      len -= run;
+      run = factor;
+    }
+    return;
+  }
+
+  for(i = 0 ; i < len ; i++)
+    dst[i] = src[map[i]];
+}
+
+// Copy a line skipping the pixels with the transparent color.
+static void masked_copy(uint8_t* dst, uint8_t* src, int len, uint8_t trans) {
+#if defined(__SSE2__)
+  __m128i t = _mm_set1_epi8(trans);
+  for( ; len >= 16 ; len -= 16, src += 16, dst += 16) {
+    __m128i s = _mm_loadu_si128((__m128i*)src);
+    __m128i d = _mm_loadu_si128((__m128i*)dst);
+    __m128i m = _mm_cmpeq_epi8(s,t);
+    _mm_storeu_si128((__m128i*)dst,
+                     _mm_or_si128(_mm_and_si128(m,d),
+                                  _mm_andnot_si128(m,s)));
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  uint8x16_t t = vdupq_n_u8(trans);
+  for( ; len >= 16 ; len -= 16, src += 16, dst += 16) {
+    uint8x16_t s = vld1q_u8(src);
+    uint8x16_t m = vceqq_u8(s,t);
+    vst1q_u8(dst,vbslq_u8(m,vld1q_u8(dst),s));
+  }
+#endif
+  for( ; len > 0 ; len--, src++, dst++)
+    if(*src != trans) *dst = *src;
+}
+
+// Copy a scaled image, only the pixels inside the clip rect are written.
+// The clipping and the x mapping are computed once per blit, then each
+// visible row is either copied directly (1:1) or built in a line
+// buffer that is reused as long as the source row doesn't change.
+static void scale_copy(uint8_t* dst, int dst_stride, scvm_rect_t* clip,
                        int x, int y,
                        int dst_width, int dst_height,
                        uint8_t* src, int src_stride,
                        int src_width, int src_height,
                        int trans) {
-  int sx = 0,sy = 0,dx = 0,dy = 0,xerr = 0,yerr = 0,skip = 0;
-
-  dst += dst_stride*y;
-  dst += x;
-
-  while(dy < dst_height && dy+y < clip_height) {
-    if(!skip && dy+y >= 0) {
-      dx = sx = 0;
-      while(dx < dst_width) {
-        if(!skip && dx+x >= 0 && dx+x < clip_width &&
-           (trans < 0 || trans != src[sx]))
-          dst[dx] = src[sx];
-        xerr += dst_width;
-        if(xerr<<1 >= src_width) {
-          xerr -= src_width;
-          dx++;
-          skip = 0;
-          if(xerr<<1 >= src_width) {
-            xerr -= dst_width;
-            continue;
+  int sy = 0,dy = 0,yerr = 0,skip = 0;
+  int x1 = clip->x1 - x, x2 = clip->x2 - x;
+  int y1 = clip->y1 - y, y2 = clip->y2 - y;
+  int len, factor = 0, line_y = -1;
+  uint8_t* row;
+
+  if(x1 < 0) x1 = 0;
+  if(x2 > dst_width) x2 = dst_width;
+  if(y1 < 0) y1 = 0;
+  if(y2 > dst_height) y2 = dst_height;
+  if(x1 >= x2 || y1 >= y2) return;
+  len = x2-x1;
+
+  if(trans > 0xFF) trans = -1;
+  if(dst_width != src_width && src_width > 0 &&
+     dst_width % src_width == 0)
+    factor = dst_width / src_width;
+
+  {
+    int map_buf[dst_width == src_width || factor ? 1 : len];
+    uint8_t line[len];
+    int* map = NULL;
+
+    if(dst_width != src_width && !factor) {
+      map = map_buf;
+      scale_map(map,x1,x2,dst_width,src_width);
+    }
+
+    dst += dst_stride*y + x + x1;
+
+    while(dy < y2) {
+      if(!skip && dy >= y1) {
+        if(dst_width == src_width)
+          row = src + x1;
+        else {
+          if(sy != line_y) {
+            scale_line(line,src,map,factor,x1,len);
+            line_y = sy;
           }
-        } else
-          skip = 1;
-        sx++;
+          row = line;
+        }
+        if(trans < 0)
+          memcpy(dst,row,len);
+        else
+          masked_copy(dst,row,len,trans);
       }
-    }
-    yerr += dst_height;
-    if(yerr<<1 >= src_height) {
-      yerr -= src_height;
-      dy++;
-      dst += dst_stride;
-      skip = 0;
+      yerr += dst_height;
       if(yerr<<1 >= src_height) {
-        yerr -= dst_height;
-        continue;
-      }
-    } else
-      skip = 1;
-    sy++;
-    src += src_stride;
+        yerr -= src_height;
+        dy++;
+        dst += dst_stride;
+        skip = 0;
+        if(yerr<<1 >= src_height) {
+          yerr -= dst_height;
+          continue;
+        }
+      } else
+        skip = 1;
+      sy++;
+      src += src_stride;
+    }
   }
 }
 
+// Compose the room and object zplanes, the buffer is only
+// allocated if none is given.
 uint8_t* make_zplane(scvm_t* vm, scvm_view_t* view,
                      unsigned view_width, unsigned view_height,
                      unsigned dst_width, unsigned dst_height,
                      unsigned src_width, unsigned src_height,
-                     unsigned src_x, unsigned zid) {
-  uint8_t* zplane = malloc(dst_width*dst_height);
+                     unsigned src_x, unsigned zid, uint8_t* zplane) {
+  scvm_rect_t clip = { 0, 0, dst_width, dst_height };
   unsigned o,obj_w,obj_h;
 
+  if(!zplane)
+    zplane = malloc(dst_width*dst_height);
+
   if(vm->room->image.zplane[zid])
-      scale_copy(zplane,dst_width,dst_width,dst_height,
+      scale_copy(zplane,dst_width,&clip,
                  0,0,dst_width,dst_height,
                  vm->room->image.zplane[zid] + src_x,vm->room->width,
                  src_width, src_height,-1);
@@ -128,7 +238,7 @@ uint8_t* make_zplane(scvm_t* vm, scvm_view_t* view,
        obj->y + obj_h < 0)
       continue;
 
-    scale_copy(zplane,dst_width,dst_width,dst_height,
+    scale_copy(zplane,dst_width,&clip,
                (obj->x-src_x)*view_width/view->screen_width,
                obj->y*view_height/view->screen_height,
                obj_w*view_width/view->screen_width,
@@ -139,6 +249,107 @@ uint8_t* make_zplane(scvm_t* vm, scvm_view_t* view,
   return zplane;
 }
 
+/////////////// Damage tracking ///////////////////////////
+
+static int rect_empty(scvm_rect_t* r) {
+  return r->x1 >= r->x2 || r->y1 >= r->y2;
+}
+
+static int rect_intersect(scvm_rect_t* dst, scvm_rect_t* a, scvm_rect_t* b) {
+  dst->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+  dst->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+  dst->x2 = a->x2 < b->x2 ? a->x2 : b->x2;
+  dst->y2 = a->y2 < b->y2 ? a->y2 : b->y2;
+  return !rect_empty(dst);
+}
+
+static void rect_union(scvm_rect_t* dst, scvm_rect_t* r) {
+  if(r->x1 < dst->x1) dst->x1 = r->x1;
+  if(r->y1 < dst->y1) dst->y1 = r->y1;
+  if(r->x2 > dst->x2) dst->x2 = r->x2;
+  if(r->y2 > dst->y2) dst->y2 = r->y2;
+}
+
+static int rect_touch(scvm_rect_t* a, scvm_rect_t* b) {
+  return a->x1 <= b->x2 && b->x1 <= a->x2 &&
+         a->y1 <= b->y2 && b->y1 <= a->y2;
+}
+
+// Add an area to recompose, touching rects are merged and
+// if the list is full everything is merged in a single rect.
+static void scvm_view_damage(scvm_view_t* view, scvm_rect_t* rect) {
+  scvm_rect_t r = *rect;
+  int i;
+
+  if(r.x1 < 0) r.x1 = 0;
+  if(r.y1 < 0) r.y1 = 0;
+  if(r.x2 > view->width) r.x2 = view->width;
+  if(r.y2 > view->height) r.y2 = view->height;
+  if(rect_empty(&r)) return;
+
+  i = 0;
+  while(i < view->num_dirty) {
+    if(!rect_touch(&view->dirty[i],&r)) {
+      i++;
+      continue;
+    }
+    rect_union(&r,&view->dirty[i]);
+    view->num_dirty--;
+    view->dirty[i] = view->dirty[view->num_dirty];
+    i = 0;
+  }
+
+  if(view->num_dirty >= SCVM_VIEW_MAX_DIRTY) {
+    for(i = 0 ; i < view->num_dirty ; i++)
+      rect_union(&r,&view->dirty[i]);
+    view->num_dirty = 0;
+  }
+  view->dirty[view->num_dirty] = r;
+  view->num_dirty++;
+}
+
+// Compare an item with its last draw and damage both areas if it changed
+static void scvm_view_update_item(scvm_view_t* view, scvm_view_item_t* item,
+                                  scvm_rect_t* rect, uint32_t sig) {
+  if(item->sig == sig &&
+     !memcmp(&item->rect,rect,sizeof(scvm_rect_t)))
+    return;
+  scvm_view_damage(view,&item->rect);
+  scvm_view_damage(view,rect);
+  item->rect = *rect;
+  item->sig = sig;
+}
+
+static uint32_t scvm_view_hash(uint32_t hash, void* data, unsigned size) {
+  uint8_t* p = data;
+  while(size > 0) {
+    hash = (hash ^ *p) * 16777619;
+    p++, size--;
+  }
+  return hash;
+}
+
+#define SCVM_VIEW_HASH_INIT 2166136261U
+
+// Clear the part of the rect that isn't covered by the room
+static void scvm_view_clear(uint8_t* buffer, int stride,
+                            scvm_rect_t* r, scvm_rect_t* room) {
+  int y;
+  for(y = r->y1 ; y < r->y2 ; y++) {
+    uint8_t* line = buffer + y*stride;
+    if(y < room->y1 || y >= room->y2 ||
+       room->x1 >= room->x2) {
+      memset(line + r->x1,0,r->x2-r->x1);
+      continue;
+    }
+    if(r->x1 < room->x1)
+      memset(line + r->x1,0,(r->x2 < room->x1 ? r->x2 : room->x1) - r->x1);
+    if(r->x2 > room->x2) {
+      int x = r->x1 > room->x2 ? r->x1 : room->x2;
+      memset(line + x,0,r->x2 - x);
+    }
+  }
+}
 
 int scvm_view_draw(scvm_t* vm, scvm_view_t* view,
                    uint8_t* buffer, int stride,
@@ -146,7 +357,12 @@ int scvm_view_draw(scvm_t* vm, scvm_view_t* view,
   int sx,dx,dy,w,h,dw,dh,a;
   int i,num_actor = 0;
   scvm_actor_t* actor[vm->num_actor];
+  scvm_image_t* obj_img[vm->room ? vm->room->num_object+1 : 1];
+  scvm_image_t* vrb_img[vm->num_verb];
+  scvm_rect_t room_rect, clip;
+  uint32_t sig,key,zkey;
 
+  view->num_dirty = 0;
   if(!vm->room) return 0;
 
   h = vm->room->height;
@@ -168,68 +384,164 @@ int scvm_view_draw(scvm_t* vm, scvm_view_t* view,
   dh = h*height/view->screen_height;
   dx = (view->screen_width-w)*width/view->screen_width/2;
   dy = view->room_start*height/view->screen_height;
+  room_rect.x1 = dx;
+  room_rect.y1 = dy;
+  room_rect.x2 = dx + dw;
+  room_rect.y2 = dy + dh;
+
+  // Anything that move the whole picture need a full redraw
+  if(view->buffer != buffer || view->stride != stride ||
+     view->width != width || view->height != height ||
+     view->room != vm->room || view->src_x != sx ||
+     view->room_y != view->room_start || view->room_height != h) {
+    view->buffer = buffer;
+    view->stride = stride;
+    view->width = width;
+    view->height = height;
+    view->room = vm->room;
+    view->src_x = sx;
+    view->room_y = view->room_start;
+    view->room_height = h;
+    view->flags |= SCVM_VIEW_REDRAW;
+  }
+
+  if(!view->verb_item) {
+    view->verb_item = calloc(vm->num_verb,sizeof(scvm_view_item_t));
+    view->actor_item = calloc(vm->num_actor,sizeof(scvm_view_item_t));
+  }
+  if(view->num_object_item < vm->room->num_object) {
+    view->object_item = realloc(view->object_item,vm->room->num_object*
+                                sizeof(scvm_view_item_t));
+    memset(view->object_item + view->num_object_item,0,
+           (vm->room->num_object-view->num_object_item)*
+           sizeof(scvm_view_item_t));
+    view->num_object_item = vm->room->num_object;
+  }
 
-  scale_copy(buffer,stride,width,height,
-             dx,dy,dw,dh,
-             vm->room->image.data+sx, vm->room->width,
-             w,h,-1);
+  // The composed zplanes stay valid as long as the camera,
+  // the output size and the object states don't change
+  zkey = scvm_view_hash(SCVM_VIEW_HASH_INIT,&room_rect,sizeof(room_rect));
+  zkey = scvm_view_hash(zkey,&sx,sizeof(sx));
 
   for(a = 0 ; a < vm->room->num_object ; a++) {
     scvm_object_t* obj = vm->room->object[a];
-    scvm_image_t* img;
+    scvm_image_t* img = NULL;
+    scvm_rect_t rect = { 0, 0, 0, 0 };
     int obj_w,obj_h;
-    if(!obj->pdata->state ||
-       obj->pdata->state > obj->num_image)
-      continue;
-    img = &obj->image[obj->pdata->state];
-    obj_w = obj->width;
-    obj_h = obj->height;
-    if(obj->x >= sx + vm->room->width ||
-       obj->x + obj->width < sx ||
-       obj->y >= h ||
-       obj->y + obj_h < 0)
-      continue;
+    if(obj->num_zplane) {
+      zkey = scvm_view_hash(zkey,&obj->pdata->state,
+                            sizeof(obj->pdata->state));
+      zkey = scvm_view_hash(zkey,&obj->x,sizeof(obj->x));
+      zkey = scvm_view_hash(zkey,&obj->y,sizeof(obj->y));
+    }
+    if(obj->pdata->state &&
+       obj->pdata->state <= obj->num_image) {
+      obj_w = obj->width;
+      obj_h = obj->height;
+      if(!(obj->x >= sx + vm->room->width ||
+           obj->x + obj->width < sx ||
+           obj->y >= h ||
+           obj->y + obj_h < 0)) {
+        img = &obj->image[obj->pdata->state];
+        rect.x1 = dx + (obj->x-sx)*width/view->screen_width;
+        rect.y1 = dy + obj->y*height/view->screen_height;
+        rect.x2 = rect.x1 + obj_w*width/view->screen_width;
+        rect.y2 = rect.y1 + obj_h*height/view->screen_height;
+      }
+    }
+    obj_img[a] = img;
+    sig = scvm_view_hash(SCVM_VIEW_HASH_INIT,&img,sizeof(img));
+    if(img)
+      sig = scvm_view_hash(sig,&vm->room->trans,sizeof(vm->room->trans));
+    scvm_view_update_item(view,&view->object_item[a],&rect,sig);
+  }
 
-    scale_copy(buffer,stride,width,height,
-               dx + (obj->x-sx)*width/view->screen_width,
-               dy + obj->y*height/view->screen_height,
-               obj_w*width/view->screen_width,
-               obj_h*height/view->screen_height,
-               img->data, obj_w, obj_w, obj_h,
-               img->have_trans ? vm->room->trans : -1);
+  if(zkey != vm->room->zplane_key || dw*dh != vm->room->zplane_size) {
+    if(dw*dh != vm->room->zplane_size)
+      for(a = 0 ; a <= vm->room->num_zplane ; a++) {
+        free(vm->room->zplane[a]);
+        vm->room->zplane[a] = NULL;
+      }
+    vm->room->zplane_key = zkey;
+    vm->room->zplane_size = dw*dh;
+    vm->room->zplane_valid = 0;
   }
 
   for(a = 0 ; a < vm->num_verb ; a++) {
-    scvm_image_t* img;
+    scvm_image_t* img = NULL;
+    scvm_rect_t rect = { 0, 0, 0, 0 };
     int vrb_x,vrb_y,vrb_w,vrb_h;
     scvm_verb_t* vrb = vm->verb + a;
-    if(!vrb->mode || vrb->save_id ||
-       !(img = scvm_get_verb_image(vm,vrb))) continue;
-    vrb_w = vrb->width;
-    vrb_h = vrb->height;
+    vrb_img[a] = NULL;
+    if(!vrb->mode || vrb->save_id) {
+      scvm_view_update_item(view,&view->verb_item[a],&rect,0);
+      continue;
+    }
+    // Only render the verb again if something changed
+    key = scvm_view_hash(SCVM_VIEW_HASH_INIT,&vrb->x,sizeof(vrb->x));
+    key = scvm_view_hash(key,&vrb->y,sizeof(vrb->y));
+    key = scvm_view_hash(key,&vrb->color,sizeof(vrb->color));
+    key = scvm_view_hash(key,&vrb->back_color,sizeof(vrb->back_color));
+    key = scvm_view_hash(key,&vrb->hi_color,sizeof(vrb->hi_color));
+    key = scvm_view_hash(key,&vrb->dim_color,sizeof(vrb->dim_color));
+    key = scvm_view_hash(key,&vrb->charset,sizeof(vrb->charset));
+    key = scvm_view_hash(key,&vrb->key,sizeof(vrb->key));
+    key = scvm_view_hash(key,&vrb->mode,sizeof(vrb->mode));
+    key = scvm_view_hash(key,&vrb->flags,sizeof(vrb->flags));
+    if(vrb->name)
+      key = scvm_view_hash(key,vrb->name,strlen((char*)vrb->name));
+    if((vrb->flags & SCVM_VERB_HAS_IMG) && vrb->img.data)
+      key = scvm_view_hash(key,vrb->img.data,vrb->width*vrb->height);
     vrb_x = vrb->x;
     vrb_y = vrb->y;
     if(vrb->flags & SCVM_VERB_CENTER)
-        vrb_x -= vrb_w/2;
-    if(vrb_x >=  view->screen_width ||
-       vrb_x + vrb_w < 0 ||
-       vrb_y >= view->screen_height ||
-       vrb_y + vrb_h < 0)
-      continue;
+        vrb_x -= vrb->width/2;
+    i = vm->var->mouse_x >= vrb_x && vm->var->mouse_x < vrb_x+vrb->width &&
+        vm->var->mouse_y >= vrb_y && vm->var->mouse_y < vrb_y+vrb->height;
+    key = scvm_view_hash(key,&i,sizeof(i));
+    // Names with escape codes can change without notice
+    if(key != view->verb_item[a].key ||
+       (vrb->name && strchr((char*)vrb->name,SCVM_CHAR_ESCAPE)) ||
+       rect_empty(&view->verb_item[a].rect)) {
+      view->verb_item[a].key = key;
+      sig = key;
+      if((img = scvm_get_verb_image(vm,vrb)))
+        sig = scvm_view_hash(sig,img->data,vrb->width*vrb->height);
+    } else {
+      img = vrb->img.data ? &vrb->img : NULL;
+      sig = view->verb_item[a].sig;
+    }
 
-    scale_copy(buffer,stride,width,height,
-               vrb_x*width/view->screen_width,
-               vrb_y*height/view->screen_height,
-               vrb_w*width/view->screen_width,
-               vrb_h*height/view->screen_height,
-               img->data, vrb_w, vrb_w, vrb_h,
-               img->have_trans ? vm->room->trans : -1);
+    if(img) {
+      vrb_w = vrb->width;
+      vrb_h = vrb->height;
+      vrb_x = vrb->x;
+      if(vrb->flags & SCVM_VERB_CENTER)
+        vrb_x -= vrb_w/2;
+      if(vrb_x >=  view->screen_width ||
+         vrb_x + vrb_w < 0 ||
+         vrb_y >= view->screen_height ||
+         vrb_y + vrb_h < 0)
+        img = NULL;
+      else {
+        rect.x1 = vrb_x*width/view->screen_width;
+        rect.y1 = vrb_y*height/view->screen_height;
+        rect.x2 = rect.x1 + vrb_w*width/view->screen_width;
+        rect.y2 = rect.y1 + vrb_h*height/view->screen_height;
+      }
+    }
+    vrb_img[a] = img;
+    scvm_view_update_item(view,&view->verb_item[a],&rect,sig);
   }
 
   for(a = 0 ; a < vm->num_actor ; a++) {
+    scvm_rect_t rect = { 0, 0, 0, 0 };
     if(!vm->actor[a].room ||
        vm->actor[a].room != vm->room->id ||
-       !vm->actor[a].costdec.cost) continue;
+       !vm->actor[a].costdec.cost) {
+      scvm_view_update_item(view,&view->actor_item[a],&rect,0);
+      continue;
+    }
     for(i = 0 ; i < num_actor ; i++)
       if(vm->actor[a].y < actor[i]->y) break;
     if(i < num_actor) memmove(&actor[i+1],&actor[i],
@@ -239,40 +551,126 @@ int scvm_view_draw(scvm_t* vm, scvm_view_t* view,
   }
 
   for(a = 0 ; a < num_actor ; a++) {
-    uint8_t* zplane = NULL;
-    if(actor[a]->box) {
-      int mask = vm->room->box[actor[a]->box].mask;
-      if(mask && mask <= vm->room->num_zplane) {
-        if(!vm->room->zplane[mask])
-          vm->room->zplane[mask] = make_zplane(vm,view,
-                                               width,height,
-                                               dw,dh,
-                                               w,h,sx,mask);
-        zplane = vm->room->zplane[mask];
-      }
+    scvm_actor_t* act = actor[a];
+    scvm_view_item_t* item = &view->actor_item[act - vm->actor];
+    scvm_rect_t rect = { 0, 0, 0, 0 };
+    int x1,y1,x2,y2,mask = 0;
+    if(act->box) mask = vm->room->box[act->box].mask;
+    if(scc_cost_dec_frame_bbox(&act->costdec,
+                               act->scale_x*width/view->screen_width,
+                               act->scale_y*height/view->screen_height,
+                               &x1,&y1,&x2,&y2)) {
+      int x = dx + (act->x-sx)*width/view->screen_width;
+      int y = dy + act->y*height/view->screen_height;
+      rect.x1 = x + x1 - 1;
+      rect.y1 = y + y1 - 1;
+      rect.x2 = x + x2 + 1;
+      rect.y2 = y + y2 + 1;
+      if(!rect_intersect(&rect,&rect,&room_rect))
+        memset(&rect,0,sizeof(rect));
     }
+    sig = scvm_view_hash(SCVM_VIEW_HASH_INIT,&act->x,sizeof(act->x));
+    sig = scvm_view_hash(sig,&act->y,sizeof(act->y));
+    sig = scvm_view_hash(sig,&act->costdec.cost,sizeof(act->costdec.cost));
+    sig = scvm_view_hash(sig,&act->costdec.anim_id,
+                         sizeof(act->costdec.anim_id));
+    sig = scvm_view_hash(sig,act->costdec.pc,sizeof(act->costdec.pc));
+    sig = scvm_view_hash(sig,&act->costdec.stopped,
+                         sizeof(act->costdec.stopped));
+    sig = scvm_view_hash(sig,&act->scale_x,sizeof(act->scale_x));
+    sig = scvm_view_hash(sig,&act->scale_y,sizeof(act->scale_y));
+    sig = scvm_view_hash(sig,&mask,sizeof(mask));
+    if(memcmp(&item->rect,&rect,sizeof(rect)) || item->sig != sig)
+      scvm_trace(vm,"Draw actor %d at %dx%d (zplane: %d)\n",act->id,
+                 act->x,act->y,mask ? mask : -1);
+    scvm_view_update_item(view,item,&rect,sig);
+  }
 
-    scc_log(LOG_MSG,"Draw actor %d at %dx%d (zplane: %d)\n",a,
-            actor[a]->x,actor[a]->y,
-            zplane ? vm->room->box[actor[a]->box].mask : -1);
-
-    scc_cost_dec_frame(&actor[a]->costdec,
-                       buffer + dy*stride + dx,
-                       (actor[a]->x-sx)*width/view->screen_width,
-                       actor[a]->y*height/view->screen_height,
-                       dw,dh,stride,
-                       zplane,dw,
-                       actor[a]->scale_x*width/view->screen_width,
-                       actor[a]->scale_y*height/view->screen_height);
+  if(view->flags & (SCVM_VIEW_REDRAW|SCVM_VIEW_ALWAYS_REDRAW)) {
+    scvm_rect_t all = { 0, 0, width, height };
+    view->num_dirty = 0;
+    scvm_view_damage(view,&all);
+    view->flags &= ~SCVM_VIEW_REDRAW;
   }
 
-  // TODO: Use some invalidation to avoid recomputing the
-  //       whole thing when not needed
-  for(a = 0 ; a <= vm->room->num_zplane ; a++)
-    if(vm->room->zplane[a]) {
-      free(vm->room->zplane[a]);
-      vm->room->zplane[a] = NULL;
+  // Recompose the damaged areas
+  for(i = 0 ; i < view->num_dirty ; i++) {
+    scvm_rect_t* r = &view->dirty[i];
+
+    scvm_view_clear(buffer,stride,r,&room_rect);
+
+    scale_copy(buffer,stride,r,
+               dx,dy,dw,dh,
+               vm->room->image.data+sx, vm->room->width,
+               w,h,-1);
+
+    for(a = 0 ; a < vm->room->num_object ; a++) {
+      scvm_object_t* obj = vm->room->object[a];
+      scvm_image_t* img = obj_img[a];
+      scvm_rect_t* rect = &view->object_item[a].rect;
+      if(!img || !rect_intersect(&clip,rect,r)) continue;
+      scale_copy(buffer,stride,r,
+                 rect->x1,rect->y1,
+                 obj->width*width/view->screen_width,
+                 obj->height*height/view->screen_height,
+                 img->data, obj->width, obj->width, obj->height,
+                 img->have_trans ? vm->room->trans : -1);
+    }
+
+    for(a = 0 ; a < vm->num_verb ; a++) {
+      scvm_verb_t* vrb = vm->verb + a;
+      scvm_image_t* img = vrb_img[a];
+      scvm_rect_t* rect = &view->verb_item[a].rect;
+      if(!img || !rect_intersect(&clip,rect,r)) continue;
+      scale_copy(buffer,stride,r,
+                 rect->x1,rect->y1,
+                 vrb->width*width/view->screen_width,
+                 vrb->height*height/view->screen_height,
+                 img->data, vrb->width, vrb->width, vrb->height,
+                 img->have_trans ? vm->room->trans : -1);
+    }
+
+    for(a = 0 ; a < num_actor ; a++) {
+      uint8_t* zplane = NULL;
+      if(!rect_intersect(&clip,&view->actor_item[actor[a] - vm->actor].rect,
+                         r))
+        continue;
+      if(actor[a]->box) {
+        int mask = vm->room->box[actor[a]->box].mask;
+        if(mask && mask <= vm->room->num_zplane) {
+          if(!(vm->room->zplane_valid & (1<<mask))) {
+            vm->room->zplane[mask] = make_zplane(vm,view,
+                                                 width,height,
+                                                 dw,dh,
+                                                 w,h,sx,mask,
+                                                 vm->room->zplane[mask]);
+            vm->room->zplane_valid |= 1<<mask;
+          }
+          zplane = vm->room->zplane[mask];
+        }
+      }
+
+      scc_cost_dec_frame(&actor[a]->costdec,
+                         buffer + clip.y1*stride + clip.x1,
+                         dx - clip.x1 +
+                         (actor[a]->x-sx)*width/view->screen_width,
+                         dy - clip.y1 +
+                         actor[a]->y*height/view->screen_height,
+                         clip.x2-clip.x1,clip.y2-clip.y1,stride,
+                         zplane ? zplane + (clip.y1-dy)*dw + clip.x1-dx :
+                         NULL, dw,
+                         actor[a]->scale_x*width/view->screen_width,
+                         actor[a]->scale_y*height/view->screen_height,
+                         &view->cost_cache);
     }
+  }
+
+  if(view->flags & SCVM_VIEW_FLIP_ALL) {
+    scvm_rect_t all = { 0, 0, width, height };
+    view->num_dirty = 0;
+    scvm_view_damage(view,&all);
+    view->flags &= ~SCVM_VIEW_FLIP_ALL;
+  }
 
   return 1;
 }